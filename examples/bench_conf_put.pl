@@ -0,0 +1,58 @@
+#!/usr/bin/perl
+#
+# Module: bench_conf_put.pl
+# Description: Measure conf mode PUTs per second.
+#
+# Sets and deletes a value under --path in a scratch session, one PUT
+# each, and prints the rate. Run it against the rest server before and
+# after a change to compare. Nothing is committed.
+#
+#   ./bench_conf_put.pl --count 500 127.0.0.1 vyatta vyatta
+#
+# Copyright (c) 2019, AT&T Intellectual Property.  All rights reserved.
+#
+# SPDX-License-Identifier: GPL-2.0-only
+
+use strict;
+use warnings;
+
+use POSIX;
+use Getopt::Long;
+use Time::HiRes qw(time);
+
+use lib '../lib';
+use Vyatta::RestClient;
+
+my $path  = "resources group address-group rest-bench address";
+my $count = 200;
+GetOptions("path=s" => \$path, "count=i" => \$count);
+
+my ($target, $user, $passwd) = @ARGV;
+die "usage: $0 [--path P] [--count N] <target> <user> <passwd>\n"
+    unless defined $passwd;
+
+my $cli = new RestClient;
+my ($code, $status) = $cli->auth($target, $user, $passwd);
+die "auth failed - $status\n" if defined $code;
+# one connection for all requests, as a client doing bulk edits would
+$cli->conn_cache(1);
+my ($err) = $cli->configure();
+die "$err\n" if defined $err;
+
+my %took = (set => 0, delete => 0);
+for (my $i = 0; $i < $count; $i++) {
+    my $value = sprintf("10.%d.%d.%d", ($i >> 16) & 255, ($i >> 8) & 255, $i & 255);
+    foreach my $op ("set", "delete") {
+        my $start = time;
+        $err = ($op eq "set") ? $cli->set("set $path $value")
+                              : $cli->delete("delete $path $value");
+        $took{$op} += time - $start;
+        die "$err\n" if defined $err;
+    }
+}
+$cli->configure_exit_discard();
+
+foreach my $op ("set", "delete") {
+    printf("%-6s %d PUTs, %.1f PUTs/s, mean %.2f ms\n", $op, $count,
+           $count / $took{$op}, 1000 * $took{$op} / $count);
+}
@@ -0,0 +1,120 @@
+#!/usr/bin/perl
+#
+# Module: bench_op_spawn.pl
+# Description: Measure chunker2 process count and memory under op load.
+#
+# Starts --jobs op commands at once, each from its own client, and while
+# they run samples the chunker2 processes and the jobs they spawned
+# from /proc. Prints the peak process count and summed VmRSS. Given a
+# log of "chunker2 -d" (run it in the foreground), also prints the
+# spawn latency and maxrss of the jobs it reports.
+#
+#   ./bench_op_spawn.pl --jobs 20 --log /tmp/chunker2.log \
+#       127.0.0.1 vyatta vyatta "show version"
+#
+# Copyright (c) 2019, AT&T Intellectual Property.  All rights reserved.
+#
+# SPDX-License-Identifier: GPL-2.0-only
+
+use strict;
+use warnings;
+
+use POSIX;
+use Getopt::Long;
+use Time::HiRes qw(time sleep);
+
+use lib '../lib';
+use Vyatta::RestClient;
+
+my $jobs = 10;
+my $log;
+GetOptions("jobs=i" => \$jobs, "log=s" => \$log);
+
+my ($target, $user, $passwd, $cmd) = @ARGV;
+die "usage: $0 [--jobs N] [--log F] <target> <user> <passwd> [op cmd]\n"
+    unless defined $passwd;
+$cmd = "show version" unless defined $cmd;
+
+# chunker2 processes and their children: (count, summed VmRSS in kB)
+sub sample {
+    my (%comm, %ppid, %rss);
+
+    opendir(my $PROC, "/proc") or die "Error: reading /proc $!";
+    foreach my $pid (grep { /^\d+$/ } readdir($PROC)) {
+        open(my $ST, "<", "/proc/$pid/status") or next;
+        while (<$ST>) {
+            $comm{$pid} = $1 if m/^Name:\s+(\S+)/;
+            $ppid{$pid} = $1 if m/^PPid:\s+(\d+)/;
+            $rss{$pid}  = $1 if m/^VmRSS:\s+(\d+)/;
+        }
+        close($ST);
+    }
+    closedir($PROC);
+
+    my ($count, $kb) = (0, 0);
+    foreach my $pid (keys %comm) {
+        my $parent = $ppid{$pid};
+        next unless $comm{$pid} eq "chunker2"
+            || (defined $parent && defined $comm{$parent}
+                && $comm{$parent} eq "chunker2");
+        $count++;
+        $kb += $rss{$pid} if defined $rss{$pid};
+    }
+    return ($count, $kb);
+}
+
+my ($base_count, $base_kb) = sample();
+
+my $start = time;
+my @children = ();
+for (1 .. $jobs) {
+    my $pid = fork();
+    die "Error: fork $!" unless defined $pid;
+    if ($pid == 0) {
+        my $cli = new RestClient;
+        my ($code, $status) = $cli->auth($target, $user, $passwd);
+        POSIX::_exit(2) if defined $code;
+        my ($err, $output) = $cli->run_op_cmd($cmd);
+        POSIX::_exit(defined $err ? 1 : 0);
+    }
+    push @children, $pid;
+}
+
+my ($peak_count, $peak_kb) = ($base_count, $base_kb);
+my $failed = 0;
+while (@children) {
+    my ($count, $kb) = sample();
+    $peak_count = $count if $count > $peak_count;
+    $peak_kb = $kb if $kb > $peak_kb;
+    @children = grep {
+        my $rc = waitpid($_, WNOHANG);
+        $failed++ if $rc == $_ && $? != 0;
+        $rc == 0;
+    } @children;
+    sleep(0.05);
+}
+my $took = time - $start;
+
+printf("%d x [%s]: %.2f s, %d failed\n", $jobs, $cmd, $took, $failed);
+printf("chunker2 processes: %d idle, %d peak\n", $base_count, $peak_count);
+printf("chunker2 VmRSS:     %d kB idle, %d kB peak\n", $base_kb, $peak_kb);
+
+exit 0 unless defined $log;
+
+my (@spawn, @maxrss);
+open(my $LOG, "<", $log) or die "Error: reading $log $!";
+while (<$LOG>) {
+    next unless m/spawn: (\d+)us, maxrss: (\d+)kB/;
+    push @spawn, $1;
+    push @maxrss, $2;
+}
+close($LOG);
+die "no spawn lines in $log, was chunker2 run with -d?\n" unless @spawn;
+
+my ($sum, $max) = (0, 0);
+foreach (@spawn) { $sum += $_; $max = $_ if $_ > $max; }
+printf("spawn: %d jobs, mean %.0f us, max %d us\n", scalar(@spawn),
+       $sum / @spawn, $max);
+($sum, $max) = (0, 0);
+foreach (@maxrss) { $sum += $_; $max = $_ if $_ > $max; }
+printf("maxrss: mean %.0f kB, max %d kB\n", $sum / @maxrss, $max);
@@ -0,0 +1,91 @@
+#!/usr/bin/perl
+#
+# Module: bench_tag_children.pl
+# Description: Time conf GETs of a node with many children.
+#
+# For each size, a scratch session gets that many values under
+# --path, in batches of 500, and the node is then fetched --runs
+# times. Prints the mean and worst GET time, and the configd request
+# count if rest debugging is on (touch /run/vyatta-webgui2/debug_webgui2).
+# Nothing is committed, the session is discarded after each size.
+#
+#   ./bench_tag_children.pl 127.0.0.1 vyatta vyatta 100 1000 10000
+#
+# Copyright (c) 2019, AT&T Intellectual Property.  All rights reserved.
+#
+# SPDX-License-Identifier: GPL-2.0-only
+
+use strict;
+use warnings;
+
+use POSIX;
+use Getopt::Long;
+use Time::HiRes qw(time);
+
+use lib '../lib';
+use Vyatta::RestClient;
+
+my $path = "resources group address-group rest-bench address";
+my $runs = 5;
+GetOptions("path=s" => \$path, "runs=i" => \$runs);
+
+my ($target, $user, $passwd, @sizes) = @ARGV;
+die "usage: $0 [--path P] [--runs N] <target> <user> <passwd> [sizes]\n"
+    unless defined $passwd;
+@sizes = (100, 1000, 10000) unless @sizes;
+
+# configd requests of the last GET logged since $since, if any
+sub read_count {
+    my ($since) = @_;
+
+    my $count;
+    open(my $LOG, "-|", "journalctl", "-q", "-o", "cat", "-t", "rest",
+         "--since", "\@" . int($since)) or return;
+    while (<$LOG>) {
+        $count = $1 if m/Configuration: (\d+) configd requests/;
+    }
+    close($LOG);
+    return $count;
+}
+
+# n distinct addresses from 10.0.0.0/8
+sub value {
+    my ($i) = @_;
+    return sprintf("10.%d.%d.%d", ($i >> 16) & 255, ($i >> 8) & 255, $i & 255);
+}
+
+my $cli = new RestClient;
+my ($code, $status) = $cli->auth($target, $user, $passwd);
+die "auth failed - $status\n" if defined $code;
+
+foreach my $size (@sizes) {
+    my ($err, @nodes) = $cli->configure();
+    die "$err\n" if defined $err;
+
+    for (my $i = 0; $i < $size; $i += 500) {
+        my @cmds = ();
+        for (my $j = $i; $j < $size && $j < $i + 500; $j++) {
+            push @cmds, "set $path " . value($j);
+        }
+        $err = $cli->set_batch(@cmds);
+        die "$err\n" if defined $err;
+    }
+
+    my ($total, $worst) = (0, 0);
+    my $since = time;
+    for (1 .. $runs) {
+        my $start = time;
+        ($err, @nodes) = $cli->configure_show($path);
+        my $took = time - $start;
+        die $err if defined $err;
+        $total += $took;
+        $worst = $took if $took > $worst;
+    }
+    sleep(1); # let the journal catch up
+    my $count = read_count($since);
+
+    printf("%6d children: %d returned, mean %.1f ms, worst %.1f ms, %s configd requests\n",
+           $size, scalar(@nodes), 1000 * $total / $runs, 1000 * $worst,
+           defined $count ? $count : "?");
+    $cli->configure_exit_discard();
+}
@@ -0,0 +1,81 @@
+#!/usr/bin/perl
+#
+# Module: check_tmpl_rpcs.pl
+# Description: Check the number of configd requests made for a conf GET.
+#
+# Run on the router with rest debugging on, so the server logs its
+# request count per GET:
+#
+#   touch /run/vyatta-webgui2/debug_webgui2   (then restart the rest server)
+#   ./check_tmpl_rpcs.pl --max 8 127.0.0.1 vyatta vyatta "interfaces dataplane"
+#
+# The path is fetched twice in one session. The first GET is allowed at
+# most --max requests; the second, with the templates cached, no more
+# than the first. Exits non-zero if either is exceeded.
+#
+# Copyright (c) 2019, AT&T Intellectual Property.  All rights reserved.
+#
+# SPDX-License-Identifier: GPL-2.0-only
+
+use strict;
+use warnings;
+
+use POSIX;
+use Getopt::Long;
+use MIME::Base64;
+
+use lib '../lib';
+use Vyatta::RestClient;
+
+my $max = 8;
+GetOptions("max=i" => \$max);
+
+my ($target, $user, $passwd, $path) = @ARGV;
+die "usage: $0 [--max N] <target> <user> <passwd> <conf path>\n"
+    unless defined $path;
+
+# "Configuration: N configd requests" lines logged since $since
+sub read_counts {
+    my ($since) = @_;
+
+    my @counts = ();
+    open(my $LOG, "-|", "journalctl", "-q", "-o", "cat", "-t", "rest",
+         "--since", "\@$since") or die "Error: reading journal $!";
+    while (<$LOG>) {
+        push @counts, $1 if m/Configuration: (\d+) configd requests/;
+    }
+    close($LOG);
+    return @counts;
+}
+
+my $cli = new RestClient;
+my ($code, $status) = $cli->auth($target, $user, $passwd);
+die "auth failed - $status\n" if defined $code;
+my ($err, @nodes) = $cli->configure();
+die "$err\n" if defined $err;
+
+my @counts = ();
+foreach my $pass (1, 2) {
+    my $since = time;
+    ($err, @nodes) = $cli->configure_show($path);
+    die $err if defined $err;
+    sleep(1); # let the journal catch up
+    my @logged = read_counts($since);
+    die "no request count logged, is rest debugging on?\n" unless @logged;
+    push @counts, $logged[-1];
+    printf("GET %d [%s]: %d children, %d configd requests\n",
+           $pass, $path, scalar(@nodes), $logged[-1]);
+}
+$cli->configure_exit_discard();
+
+my $rc = 0;
+if ($counts[0] > $max) {
+    print "FAIL: first GET made $counts[0] requests, more than $max\n";
+    $rc = 1;
+}
+if ($counts[1] > $counts[0]) {
+    print "FAIL: cached GET made $counts[1] requests, more than $counts[0]\n";
+    $rc = 1;
+}
+print "OK\n" if $rc == 0;
+exit $rc;
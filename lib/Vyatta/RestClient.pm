@@ -511,6 +511,56 @@ sub delete {
     return set($self, $cmd);
 }
 
+# apply a list of "set ..."/"delete ..." commands in one request,
+# returns the error of the first failed command
+sub set_batch {
+    my ($self, @cmds) = @_;
+
+    my $target   = $self->{_target};
+    my $ua       = $self->{_ua};
+    my $location = $self->{_conf_loc};
+
+    if (! defined $location) {
+        return "set_batch called without session";
+    }
+
+    my @changes = ();
+    foreach my $cmd (@cmds) {
+        my ($op, $path) = split('/', _cmd_2_path($cmd), 2);
+        push @changes, { op => $op, path => $path };
+    }
+
+    my $url      = "https://$target/$location/changes";
+    my $request  = HTTP::Request->new(POST => "$url");
+    $request->content_type('application/json');
+    $request->content(encode_json({ stop_on_error => JSON::true,
+                                    changes => \@changes }));
+    my $response = $ua->request($request);
+    print "set_batch url [$url]\n", $response->content, "\n" if $self->{_debug};
+    if ($response->is_error) {
+        my $message = _get_error_message($self, $response);
+        return $message if defined $message;
+        return "set_batch error on post [$url] - " . $response->status_line;
+    }
+
+    my $perl_scalar;
+    eval {
+        $perl_scalar = decode_json($response->content);
+    };
+    return "set_batch JSON decode error" if $@;
+
+    $self->{_uncommitted} += $perl_scalar->{applied};
+    my $i = 0;
+    foreach my $result (@{$perl_scalar->{results}}) {
+        if ($result->{status} eq 'error') {
+            my $message = $result->{message} || '';
+            return "$cmds[$i] - $message";
+        }
+        $i++;
+    }
+    return;
+}
+
 sub uncommitted {
     my ($self) = @_;
 
@@ -17,6 +17,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string>
+#include <vector>
 #include <iostream>
 #include <unistd.h>
 #include <string>
@@ -28,6 +29,7 @@
 #include <libaudit.h>
 #include "rl_str_proc.hh"
 #include "common.hh"
+#include "executor.hh"
 #include "http.hh"
 #include "mode.hh"
 #include "appmode.hh"
@@ -63,41 +65,33 @@ AppMode::process(Session &session)
 		return;
 	}
 
-	string environment = "export REQUEST_METHOD=" + session._request.get(Rest::HTTP_REQ_METHOD) + ";";
-	environment += "export COMMIT_VIA=gui2_app;";
+	//the request body is the script's stdin
+	Executor exec(_debug);
+	exec.set_env("REQUEST_METHOD", session._request.get(Rest::HTTP_REQ_METHOD));
+	exec.set_env("COMMIT_VIA", "gui2_app");
 	if (session._session_key.empty() == false) {
-		environment += "export SESSION=" + session._session_key + ";";
+		exec.set_env("SESSION", session._session_key);
 	}
 	if (session._user.empty() == false) {
-		environment += "export USERNAME=" + session._user + ";";
+		exec.set_env("USERNAME", session._user);
 	}
-
-	// TODO: We cannot share the input across all sessions in Redding
 	string json = session._request.get(Rest::HTTP_BODY);
-	FILE *fd = fopen(Rest::JSON_INPUT.c_str(),"w");
-	if (!fd) {
-		ERROR(session,Error::SERVER_ERROR);
-		return;
-	}
-	if (fwrite(json.c_str(),sizeof(char),json.size(),fd) < json.size()) {
-		fclose(fd);
+	exec.set_input(json);
+	if (Mode::write_json_input(json) == false) {
 		ERROR(session,Error::SERVER_ERROR);
 		return;
 	}
-	fclose(fd);
 
-	string appmodecmd = "/bin/bash -p -c '" + environment + "umask 000; source /usr/lib/cgi-bin/vyatta-app;_vyatta_app_run " + command  + " < "+ Rest::JSON_INPUT +"'";
+	string appmodecmd = "umask 000; source /usr/lib/cgi-bin/vyatta-app;_vyatta_app_run " + command;
+	std::vector<string> argv;
+	argv.push_back("/bin/bash");
+	argv.push_back("-p");
+	argv.push_back("-c");
+	argv.push_back(appmodecmd);
 	string stdout;
 
-
-	//use true id and group in split process here
-
-	{
-		//    Timer tt("AppMode::process::execute()");
-		int err = 0;
-		if ((err = Mode::system_out(appmodecmd.c_str(),stdout)) != 0) {
-			ERROR(session,Error::APPMODE_SCRIPT_ERROR);
-		}
+	if (exec.run(argv,stdout) != 0) {
+		ERROR(session,Error::APPMODE_SCRIPT_ERROR);
 	}
 	if (!_debug) {
 		unlink(Rest::JSON_INPUT.c_str());
@@ -25,10 +25,6 @@ public:
 	void
 	process(Session &session);
 
-private:
-	int
-	system_out(const char *cmd, std::string &out);
-
 private: //variables
 };
 
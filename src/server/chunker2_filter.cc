@@ -0,0 +1,295 @@
+/**
+ * Module: chunker2_filter.cc
+ * Description: filters applied to op mode command output by the chunker
+ *
+ * Copyright (c) 2019, AT&T Intellectual Property.  All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ **/
+
+#include <stdlib.h>
+#include <string.h>
+#include <regex.h>
+#include <string>
+#include <deque>
+#include <memory>
+#include <algorithm>
+#include "common.hh"
+#include "chunker2_proto.hh"
+#include "chunker2_filter.hh"
+
+using namespace std;
+
+static void
+free_regex(regex_t *re)
+{
+	regfree(re);
+	delete re;
+}
+
+/**
+ * \brief Whether a pattern is safe to run in the chunker's event loop
+ *
+ * Backreferences make matching exponential, glibc accepts them in
+ * extended expressions too.
+ **/
+static bool
+safe_regex(const string &regex)
+{
+	if (regex.size() > OutputFilter::MAX_REGEX) {
+		return false;
+	}
+	for (size_t i = 0; i + 1 < regex.size(); ++i) {
+		if (regex[i] != '\\') {
+			continue;
+		}
+		if (regex[i+1] >= '1' && regex[i+1] <= '9') {
+			return false;
+		}
+		++i;
+	}
+	return true;
+}
+
+/**
+ * \brief Parse an unsigned decimal, an empty value leaves num unchanged
+ **/
+static bool
+parse_num(const string &value, unsigned long long &num)
+{
+	if (value.empty()) {
+		return true;
+	}
+	char *end = NULL;
+	num = strtoull(value.c_str(), &end, 10);
+	return (*end == '\0' && value[0] != '-');
+}
+
+/**
+ * \brief Set the stages from request parameters
+ *
+ * \param bytes Byte range as "start-end" or "start-"
+ **/
+bool
+OutputFilter::set(const string &match, const string &regex, const string &head,
+		  const string &tail, const string &bytes)
+{
+	_match = match;
+	_regex = regex;
+
+	unsigned long long num = 0;
+	if (parse_num(head, num) == false) {
+		return false;
+	}
+	_head = num;
+	num = 0;
+	if (parse_num(tail, num) == false) {
+		return false;
+	}
+	_tail = num;
+
+	if (bytes.empty() == false) {
+		size_t pos = bytes.find('-');
+		if (pos == string::npos ||
+		    parse_num(bytes.substr(0, pos), _byte_start) == false ||
+		    parse_num(bytes.substr(pos + 1), _byte_end) == false) {
+			return false;
+		}
+		if (_byte_end != 0 && _byte_end <= _byte_start) {
+			return false;
+		}
+	}
+	return compile();
+}
+
+/**
+ *
+ **/
+bool
+OutputFilter::compile()
+{
+	_compiled.reset();
+	if (_regex.empty()) {
+		return true;
+	}
+	if (safe_regex(_regex) == false) {
+		return false;
+	}
+	regex_t *re = new regex_t;
+	if (regcomp(re, _regex.c_str(), REG_EXTENDED | REG_NOSUB) != 0) {
+		delete re;
+		return false;
+	}
+	_compiled = shared_ptr<regex_t>(re, free_regex);
+	return true;
+}
+
+/**
+ *
+ **/
+void
+OutputFilter::encode(ChunkerEncoder &msg) const
+{
+	if (_match.empty() == false) {
+		msg.add(ChunkerProto::K_MATCH, _match);
+	}
+	if (_regex.empty() == false) {
+		msg.add(ChunkerProto::K_REGEX, _regex);
+	}
+	if (_head != 0) {
+		msg.add(ChunkerProto::K_HEAD, (uint64_t)_head);
+	}
+	if (_tail != 0) {
+		msg.add(ChunkerProto::K_TAIL, (uint64_t)_tail);
+	}
+	if (_byte_start != 0 || _byte_end != 0) {
+		msg.add(ChunkerProto::K_BYTE_START, (uint64_t)_byte_start);
+		msg.add(ChunkerProto::K_BYTE_END, (uint64_t)_byte_end);
+	}
+}
+
+/**
+ *
+ **/
+bool
+OutputFilter::decode(const ChunkerMessage &msg)
+{
+	_match = msg.get(ChunkerProto::K_MATCH);
+	_regex = msg.get(ChunkerProto::K_REGEX);
+	_head = msg.get_num(ChunkerProto::K_HEAD);
+	_tail = msg.get_num(ChunkerProto::K_TAIL);
+	_byte_start = msg.get_num(ChunkerProto::K_BYTE_START);
+	_byte_end = msg.get_num(ChunkerProto::K_BYTE_END);
+	return compile();
+}
+
+/**
+ *
+ **/
+string
+OutputFilter::key() const
+{
+	if (empty()) {
+		return string("");
+	}
+	return "match=" + _match + "%3Aregex=" + _regex +
+		"%3Ahead=" + Rest::ulltostring(_head) + "%3Atail=" + Rest::ulltostring(_tail) +
+		"%3Abytes=" + Rest::ulltostring(_byte_start) + "-" + Rest::ulltostring(_byte_end);
+}
+
+/**
+ * \brief Apply the byte range, then pass whole lines to the line stages
+ **/
+void
+OutputFilter::process(const char *data, size_t len, string &out)
+{
+	if (_done || len == 0) {
+		return;
+	}
+
+	//byte range of the output as a whole
+	unsigned long long start = _offset;
+	_offset += len;
+	if (_offset <= _byte_start) {
+		return;
+	}
+	if (start < _byte_start) {
+		data += _byte_start - start;
+		len -= _byte_start - start;
+		start = _byte_start;
+	}
+	if (_byte_end != 0) {
+		if (start >= _byte_end) {
+			_done = true;
+			return;
+		}
+		if (start + len >= _byte_end) {
+			len = _byte_end - start;
+			_done = (line_stages() == false);
+		}
+	}
+
+	if (line_stages() == false) {
+		out.append(data, len);
+		return;
+	}
+
+	const char *end = data + len;
+	while (data < end && _done == false) {
+		const char *nl = (const char*)memchr(data, '\n', end - data);
+		const char *stop = (nl != NULL) ? nl + 1 : end;
+		//a line longer than _max_line goes through in pieces
+		if (_max_line != 0 && _partial.size() + (stop - data) > _max_line) {
+			stop = data + (_max_line - _partial.size());
+		} else if (nl == NULL) {
+			_partial.append(data, end - data);
+			break;
+		}
+		if (_partial.empty()) {
+			process_line(data, stop - data, out);
+		} else {
+			_partial.append(data, stop - data);
+			process_line(_partial.data(), _partial.size(), out);
+			_partial.clear();
+		}
+		data = stop;
+	}
+
+	//the byte range ended mid line, nothing more will arrive for it
+	if (_byte_end != 0 && _offset >= _byte_end && _done == false) {
+		finish(out);
+	}
+}
+
+/**
+ * \brief Run one line, including its newline, through the line stages
+ **/
+void
+OutputFilter::process_line(const char *line, size_t len, string &out)
+{
+	if (_match.empty() == false &&
+	    search(line, line + len, _match.begin(), _match.end()) == line + len) {
+		return;
+	}
+	if (_compiled) {
+		size_t text_len = (len > 0 && line[len-1] == '\n') ? len - 1 : len;
+		string text(line, text_len);
+		if (regexec(_compiled.get(), text.c_str(), 0, NULL, 0) != 0) {
+			return;
+		}
+	}
+
+	++_lines;
+	if (_tail != 0) {
+		_tail_lines.push_back(string(line, len));
+		_tail_bytes += len;
+		while (_tail_lines.size() > _tail || _tail_bytes > Rest::MAX_BODY_SIZE) {
+			_tail_bytes -= _tail_lines.front().size();
+			_tail_lines.pop_front();
+		}
+	} else {
+		out.append(line, len);
+	}
+	if (_head != 0 && _lines >= _head) {
+		_done = true;
+	}
+}
+
+/**
+ *
+ **/
+void
+OutputFilter::finish(string &out)
+{
+	if (_partial.empty() == false && _done == false) {
+		string line;
+		line.swap(_partial);
+		process_line(line.data(), line.size(), out);
+	}
+	while (_tail_lines.empty() == false) {
+		out += _tail_lines.front();
+		_tail_lines.pop_front();
+	}
+	_tail_bytes = 0;
+	_done = true;
+}
@@ -0,0 +1,122 @@
+/**
+ * Module: chunker2_filter.hh
+ * Description: filters applied to op mode command output by the chunker
+ *
+ * Copyright (c) 2019, AT&T Intellectual Property.  All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ **/
+
+#ifndef __CHUNKER_FILTER_HH__
+#define __CHUNKER_FILTER_HH__
+
+#include <regex.h>
+#include <string>
+#include <deque>
+#include <memory>
+
+class ChunkerEncoder;
+class ChunkerMessage;
+
+/**
+ * Stages applied to command output as it is produced, in order:
+ *
+ *   bytes  keep only bytes [start,end) of the output
+ *   match  keep lines containing a string
+ *   regex  keep lines matching a POSIX extended regular expression,
+ *          without backreferences and at most MAX_REGEX long
+ *   head   keep the first N remaining lines
+ *   tail   keep the last N remaining lines
+ *
+ * Unset stages pass everything through. With no line stages the
+ * output is not split into lines. Lines longer than the maximum are
+ * split, the tail keeps no more than Rest::MAX_BODY_SIZE bytes.
+ **/
+class OutputFilter
+{
+public:
+	OutputFilter() :
+		_head(0),
+		_tail(0),
+		_byte_start(0),
+		_byte_end(0),
+		_max_line(0),
+		_offset(0),
+		_lines(0),
+		_tail_bytes(0),
+		_done(false) {}
+
+	//set from request parameters, false if a value is invalid
+	bool
+	set(const std::string &match, const std::string &regex, const std::string &head,
+	    const std::string &tail, const std::string &bytes);
+
+	//bytes, 0 for no limit
+	void
+	set_max_line(size_t max_line) {
+		_max_line = max_line;
+	}
+
+	bool
+	empty() const {
+		return _match.empty() && _regex.empty() && _head == 0 && _tail == 0 &&
+			_byte_start == 0 && _byte_end == 0;
+	}
+
+	void
+	encode(ChunkerEncoder &msg) const;
+
+	bool
+	decode(const ChunkerMessage &msg);
+
+	//identifies the filter when coalescing identical commands
+	std::string
+	key() const;
+
+	//filter the next piece of output, appending what is kept to out
+	void
+	process(const char *data, size_t len, std::string &out);
+
+	//end of output, flushes the last line and the tail
+	void
+	finish(std::string &out);
+
+	//no further output can be kept
+	bool
+	done() const {
+		return _done;
+	}
+
+	static const size_t MAX_REGEX = 256; //characters
+
+private:
+	bool
+	compile();
+
+	bool
+	line_stages() const {
+		return !_match.empty() || !_regex.empty() || _head != 0 || _tail != 0;
+	}
+
+	void
+	process_line(const char *line, size_t len, std::string &out);
+
+private:
+	std::string _match;
+	std::string _regex;
+	unsigned long _head;
+	unsigned long _tail;
+	unsigned long long _byte_start;
+	unsigned long long _byte_end; //0 for end of output
+	std::shared_ptr<regex_t> _compiled;
+	size_t _max_line;
+
+	unsigned long long _offset; //bytes of output seen
+	unsigned long _lines; //lines kept
+	std::string _partial; //line without its newline yet
+	std::deque<std::string> _tail_lines;
+	unsigned long long _tail_bytes; //held in _tail_lines
+	bool _done;
+};
+
+#endif //__CHUNKER_FILTER_HH__
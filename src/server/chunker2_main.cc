@@ -38,11 +38,16 @@ pid_output (const char *path);
  **/
 static void usage()
 {
-	cout << "chunker -sipkdh" << endl;
+	cout << "chunker -sipkctmuqdh" << endl;
 	cout << "  -s chunk size" << endl;
 	cout << "  -i session pid path" << endl;
 	cout << "  -p process pid path" << endl;
 	cout << "  -k kill timeout (seconds)" << endl;
+	cout << "  -c file listing commands whose output is cached" << endl;
+	cout << "  -t cache timeout (seconds)" << endl;
+	cout << "  -m maximum number of running commands" << endl;
+	cout << "  -u maximum number of running commands per user" << endl;
+	cout << "  -q maximum bytes of command output kept" << endl;
 	cout << "  -d debug" << endl;
 	cout << "  -h help" << endl;
 }
@@ -67,13 +72,18 @@ int main(int argc, char* argv[])
 	string process_pid_path;
 	long chunk_size = Rest::CHUNKER_READ_SIZE;
 	unsigned long kill_timeout = 300; //5 minutes
+	string cache_file;
+	unsigned long cache_ttl = 10;
+	unsigned long max_jobs = 16;
+	unsigned long max_user_jobs = 4;
+	unsigned long long quota = 0;
 	bool debug = false;
 
 	signal(SIGINT, sig_end);
 	signal(SIGTERM, sig_end);
 
 	//grab inputs
-	while ((ch = getopt(argc, argv, "s:i:p:k:dh")) != -1) {
+	while ((ch = getopt(argc, argv, "s:i:p:k:c:t:m:u:q:dh")) != -1) {
 		switch (ch) {
 		case 's':
 			chunk_size = strtoul(optarg,NULL,10);
@@ -93,6 +103,30 @@ int main(int argc, char* argv[])
 				kill_timeout = 86400;
 			}
 			break;
+		case 'c':
+			cache_file = optarg;
+			break;
+		case 't':
+			cache_ttl = strtoul(optarg,NULL,10);
+			if (cache_ttl > 3600) { //one hour
+				cache_ttl = 3600;
+			}
+			break;
+		case 'm':
+			max_jobs = strtoul(optarg,NULL,10);
+			if (max_jobs < 1) {
+				max_jobs = 1;
+			}
+			break;
+		case 'u':
+			max_user_jobs = strtoul(optarg,NULL,10);
+			if (max_user_jobs < 1) {
+				max_user_jobs = 1;
+			}
+			break;
+		case 'q':
+			quota = strtoull(optarg,NULL,10);
+			break;
 		case 'd':
 			debug = true;
 			break;
@@ -118,12 +152,16 @@ int main(int argc, char* argv[])
 	ChunkerManager mgr(pid_path,kill_timeout,chunk_size,debug);
 
 	mgr.init();
+	mgr.set_limits(max_jobs,max_user_jobs);
+	mgr.set_quota(quota);
+	if (cache_file.empty() == false) {
+		mgr.init_cache(cache_file,cache_ttl);
+	}
 	while (g_shutdown == false) {
 		if (debug == true) {
 			cout << "waiting on read of data" << endl;
 		}
-		mgr.read();
-		usleep(200 * 1000); //.2 second sleep
+		mgr.read(); //waits up to .2 second for work
 	}
 
 	mgr.shutdown();
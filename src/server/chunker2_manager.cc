@@ -23,14 +23,28 @@
 #include <syslog.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <pwd.h>
+#include <grp.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <poll.h>
+#include <signal.h>
+#include <errno.h>
 #include <iostream>
+#include <fstream>
 #include <string>
 #include <map>
+#include <deque>
+#include <vector>
+#include <algorithm>
 #include "common.hh"
 #include "chunker2_manager.hh"
+#include "chunker2_proto.hh"
 
 using namespace std;
 
+static const unsigned long TERM_GRACE = 3; //seconds from SIGTERM to SIGKILL
+
 /**
  *
  **/
@@ -79,36 +93,156 @@ ChunkerManager::init()
 		flags = 0;
 	}
 	fcntl(_listen_sock, F_SETFL, flags | O_NONBLOCK);
+	listen(_listen_sock,5);
 
 
 	chmod(Rest::CHUNKER_SOCKET.c_str(),S_IROTH|S_IWOTH|S_IXOTH|S_IRGRP|S_IWGRP|S_IXGRP|S_IRUSR|S_IWUSR|S_IXUSR);
 }
 
 /**
- * listen for commands from pipe
+ * \brief Load the list of commands whose output may be served from cache
+ *
+ * The file holds one op mode command per line, e.g. "show version".
+ *
+ * \param file Path of the command list
+ * \param ttl Seconds a finished command's output is served for
+ **/
+bool
+ChunkerManager::init_cache(const string &file, unsigned long ttl)
+{
+	ifstream in(file.c_str());
+	if (!in) {
+		syslog(LOG_ERR, "webgui: Unable to read cache command list %s", file.c_str());
+		return false;
+	}
+
+	string line;
+	while (getline(in, line)) {
+		line = Rest::trim(line);
+		if (line.empty() || line[0] == '#') {
+			continue;
+		}
+		_cache_cmds.insert(normalize(line));
+	}
+	_cache_ttl = ttl;
+	return true;
+}
+
+/**
+ * listen for commands from pipe, and for output of running jobs
+ *
+ * Waits at most 200ms for either.
  **/
 void
 ChunkerManager::read()
 {
-	char buf[1025];
+	vector<struct pollfd> fds;
+	vector<string> outputs; //job of each fds entry after the socket
+	struct pollfd pfd;
+	pfd.fd = _listen_sock;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	fds.push_back(pfd);
+
+	set<string>::iterator run_iter = _running_coll.begin();
+	while (run_iter != _running_coll.end()) {
+		JobIter job_iter = _job_coll.find(*run_iter);
+		if (job_iter != _job_coll.end() && job_iter->second._proc.fd() >= 0) {
+			pfd.fd = job_iter->second._proc.fd();
+			fds.push_back(pfd);
+			outputs.push_back(*run_iter);
+		}
+		++run_iter;
+	}
+
+	if (poll(&fds[0], fds.size(), 200) > 0) {
+		if (fds[0].revents & POLLIN) {
+			accept_requests();
+		}
+		for (size_t i = 1; i < fds.size(); ++i) {
+			if (fds[i].revents == 0) {
+				continue;
+			}
+			//the job may have been released while handling a request
+			JobIter job_iter = _job_coll.find(outputs[i-1]);
+			if (job_iter != _job_coll.end() && job_iter->second._proc.service() == false) {
+				is_running(job_iter->second);
+			}
+		}
+	}
+
+	reap_children();
+
+	struct timeval t;
+	gettimeofday(&t,NULL);
+	if ((unsigned long)t.tv_sec != _last_reap) {
+		_last_reap = t.tv_sec;
+		reap(t.tv_sec);
+	}
+
+	schedule();
+
+	if (_cache_cmds.empty() == false) {
+		expire_cache(t.tv_sec);
+	}
+	return;
+}
+
+/**
+ * \brief Handle pending connections from the webserver
+ **/
+void
+ChunkerManager::accept_requests()
+{
 	struct sockaddr_un  cli_addr;
-	//listen for new connection
-	listen(_listen_sock,5);
-	int clilen = sizeof(cli_addr);
-	int clientsock = accept(_listen_sock,(struct sockaddr *)&cli_addr,(socklen_t*)&clilen);
-	if (clientsock > -1) {
-		printf("ChunkerManager::read(), new connection\n");
-		int n = ::read(clientsock,buf,1024);
-		printf("Read %d bytes from socket: %s\n",n,buf);
-		buf[n] = '\0';
-		process(clientsock,buf);
+	while (true) {
+		int clilen = sizeof(cli_addr);
+		int clientsock = accept(_listen_sock,(struct sockaddr *)&cli_addr,(socklen_t*)&clilen);
+		if (clientsock < 0) {
+			return;
+		}
+		if (_debug) {
+			cout << "ChunkerManager::read(), new connection" << endl;
+		}
+
+		//a stalled client must not hold up the other jobs
+		struct timeval tv;
+		tv.tv_sec = Rest::CHUNKER_MAX_WAIT_TIME;
+		tv.tv_usec = 0;
+		setsockopt(clientsock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+		setsockopt(clientsock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+		ChunkerMessage msg;
+		if (msg.recv(clientsock)) {
+			process(clientsock,msg);
+		}
 		//done processing now close the socket
 		close(clientsock);
-	} else {
-		//    process(NULL);
 	}
+}
 
-	return;
+/**
+ * \brief Collect exited commands
+ **/
+void
+ChunkerManager::reap_children()
+{
+	int status;
+	struct rusage usage;
+	pid_t pid;
+	while ((pid = wait4(-1, &status, WNOHANG, &usage)) > 0) {
+		map<pid_t, string>::iterator iter = _child_coll.find(pid);
+		if (iter == _child_coll.end()) {
+			continue;
+		}
+		if (_debug) {
+			JobIter job_iter = _job_coll.find(iter->second);
+			unsigned long spawn_usec = (job_iter != _job_coll.end()) ? job_iter->second._proc.spawn_usec() : 0;
+			cout << "job " << iter->second << " exited, status: " << status
+			     << ", spawn: " << spawn_usec << "us, maxrss: " << usage.ru_maxrss << "kB" << endl;
+		}
+		_child_coll.erase(iter);
+	}
 }
 
 
@@ -116,7 +250,7 @@ ChunkerManager::read()
  *
  **/
 void
-ChunkerManager::process(int sock, char *buf)
+ChunkerManager::process(int sock, const ChunkerMessage &msg)
 {
 	/****
 	     ADD CMD PROCESSOR HERE FOR DATA FROM THE SOCKET
@@ -125,184 +259,236 @@ ChunkerManager::process(int sock, char *buf)
 	gettimeofday(&t,NULL);
 	unsigned long cur_time = t.tv_sec;
 
-	if (sock == 0 || buf == NULL) {
-		return;
-	}
-
 	if (_debug) {
 		cout << "ChunkerManager::process(), processing message" << endl;;
 	}
 
-	if (buf != NULL) {
-		string command = string(buf);
+	string token = msg.get(ChunkerProto::K_TOKEN);
+	string statement = msg.get(ChunkerProto::K_STATEMENT);
+	string user = msg.get(ChunkerProto::K_USER);
+	//and the priority class of new commands
+	string priority = msg.get(ChunkerProto::K_PRIORITY);
 
-		string token;
-		size_t start_pos = command.find("<token>");
-		size_t stop_pos = command.find("</token>");
-		if (start_pos == string::npos || stop_pos == string::npos) {
+	switch (msg.type()) {
+	case ChunkerProto::K_COMMAND: {
+		if (token.empty()) {
 			return; //doesn't have a token, then ignore request and return
-		} else {
-			token = command.substr(start_pos+7,stop_pos-start_pos-7);
 		}
-
-		//now grab the command
-		string statement;
-		start_pos = command.find("<statement>");
-		stop_pos = command.find("</statement>");
-		if (start_pos == string::npos || stop_pos == string::npos) {
-			//do nothing here
-		} else {
-			statement = command.substr(start_pos+11,stop_pos-start_pos-11);
+		if (_debug) {
+			cout << "ChunkerManager::process(): command received, token: " << token << ", statement: " << statement << ", user: " << user << endl;
 		}
 
-		//finally grab the user
-		string user;
-		start_pos = command.find("<user>");
-		stop_pos = command.find("</user>");
-		if (start_pos == string::npos || stop_pos == string::npos) {
-			//do nothing here
-		} else {
-			user = command.substr(start_pos+6,stop_pos-start_pos-6);
-		}
+		//finally convert the token to a key
+		string key = token;
 
+		//ALSO NEED TO MATCH THE COMMAND TO SEE IF THIS IS A NEW OR ONGOING COMMAND
+		ProcIter iter = _proc_coll.find(key);
+		if (iter != _proc_coll.end() && statement.empty()) {
+			touch(iter->second,cur_time); //update time
+		} else if (iter != _proc_coll.end() || _job_coll.find(token) != _job_coll.end()) {
+			//a token names one process and its job, they are never replaced
+			syslog(LOG_ERR, "webgui: Duplicate chunker token %s", token.c_str());
+			return;
+		} else {
+			ProcessData pd;
+			pd._start_time = pd._last_update = cur_time;
+			pd._token = token;
+			pd._output = token;
+			pd._command = statement;
+			pd._user = user;
+			pd._format = (msg.get(ChunkerProto::K_FORMAT) == "ndjson") ? "ndjson" : "text";
+			pd._status = ProcessData::K_RUNNING;
 
-		if (command.find("<command>") != string::npos) {
-			//grab the token
-			if (_debug) {
-				cout << "ChunkerManager::process(): command received, token: " << token << ", statement: " << statement << ", user: " << user << endl;
+			//only the filtered output is kept
+			OutputFilter filter;
+			if (filter.decode(msg) == false) {
+				syslog(LOG_ERR, "webgui: Invalid output filter for %s", token.c_str());
+				return;
 			}
 
-			//finally convert the token to a key
-			string key = token;
+			//attach to an identical command that is still running
+			string jkey = job_key(statement,user);
+			if (jkey.empty() == false && filter.empty() == false) {
+				jkey += "%3A" + filter.key();
+			}
+			if (jkey.empty() == false && pd._format != "text") {
+				jkey += "%3Aformat=" + pd._format;
+			}
+			JobIter job_iter = _job_coll.end();
+			SharedIter shared_iter = _shared_coll.find(jkey);
+			if (shared_iter != _shared_coll.end()) {
+				job_iter = _job_coll.find(shared_iter->second);
+			}
 
-			//ALSO NEED TO MATCH THE COMMAND TO SEE IF THIS IS A NEW OR ONGOING COMMAND
-			ProcIter iter = _proc_coll.find(key);
-			if (iter != _proc_coll.end() && statement.empty()) {
-				iter->second._last_update = cur_time; //update time
+			if (job_iter != _job_coll.end() &&
+			    (is_running(job_iter->second) || is_cache_valid(job_iter->second,cur_time))) {
+				pd._output = job_iter->first;
+				++job_iter->second._refs;
+				if (_debug) {
+					cout << "attaching " << token << " to job: " << pd._output << endl;
+				}
 			} else {
-				ProcessData pd;
-				pd._start_time = pd._last_update = cur_time;
-				pd._token = token;
-				pd._command = statement;
-				pd._user = user;
-				pd._status = ProcessData::K_RUNNING;
-
-				//now start up the procesor
-				pd._proc.init(_chunk_size,_pid,_debug);
-
-				if (pd._proc.start_new(token,statement,user) == false) {
-					return;
+				JobData job;
+				job._output = token;
+				job._command = statement;
+				job._user = user;
+				job._key = jkey;
+				job._start_time = cur_time;
+				job._refs = 1;
+				if (priority == "high") {
+					job._priority = JobData::K_PRIO_HIGH;
+				} else if (priority == "low") {
+					job._priority = JobData::K_PRIO_LOW;
 				}
 
-				if (_debug) {
-					cout << "inserting new process into table: " << key << ", current table size: " << _proc_coll.size() << endl;
+				//the procesor is started by schedule() once a slot is free
+				job._proc.init(_chunk_size,_pid,_debug);
+				job._proc.set_filter(filter);
+				job._proc.set_ndjson(pd._format == "ndjson");
+				//the cache holds its own reference until the output expires
+				if (jkey.empty() == false && _cache_cmds.find(normalize(statement)) != _cache_cmds.end()) {
+					job._cached = true;
+					++job._refs;
 				}
-				_proc_coll.insert(pair<string, ProcessData>(key,pd));
-			}
-		} else if (command.find("<process>") != string::npos) {
-			if (_debug) {
-				cout << "received process query: " << user << endl;
-			}
-
-			string resp;
-			ProcIter iter = _proc_coll.begin();
-			while (iter != _proc_coll.end()) {
-				if (iter->second._user != user) {
-					++iter;
-					continue;
+				JobIter new_iter = _job_coll.insert(pair<string, JobData>(token,job)).first;
+				if (jkey.empty() == false) {
+					_shared_coll[jkey] = token;
 				}
-				sprintf(buf,"%ld",iter->second._start_time);
-				resp += string(buf) + "%3A" + iter->second._command + "%3A" + iter->second._token + "%3A" + iter->second._user;
-				sprintf(buf,"%ld",iter->second._read_offset);
-				resp += string("%3A") + string(buf) + "%2C";
-				++iter;
+				enqueue(new_iter->second);
 			}
+
 			if (_debug) {
-				cout << "responding with: " << resp << endl;
-			}
-			if (write(sock,resp.c_str(),resp.length()) < 0) {
-				return;
-			}
-		} else if (command.find("<details>") != string::npos) {
-			//information about a specific process
-			if (_debug) {
-				cout << "received process query: " << user << endl;
+				cout << "inserting new process into table: " << key << ", current table size: " << _proc_coll.size() << endl;
 			}
+			_proc_coll.insert(pair<string, ProcessData>(key,pd));
+			_user_coll[user].insert(key);
+			_idle_timer.schedule(key,cur_time + _kill_timeout);
+			schedule();
+		}
+		break;
+	}
+	case ChunkerProto::K_PROCESS: {
+		//a page of the processes of user, starting after the cursor
+		if (_debug) {
+			cout << "received process query: " << user << endl;
+		}
 
-			string resp;
-			ProcIter iter = _proc_coll.begin();
-			while (iter != _proc_coll.end()) {
-				if (iter->second._user != user) {
-					++iter;
-					continue;
+		unsigned long limit = msg.get_num(ChunkerProto::K_LIMIT);
+		string cursor = msg.get(ChunkerProto::K_CURSOR);
+		ChunkerEncoder resp(ChunkerProto::K_REPLY);
+		deque<ChunkerEncoder> records;
+		UserIter user_iter = _user_coll.find(user);
+		if (user_iter != _user_coll.end()) {
+			set<string> &tokens = user_iter->second;
+			set<string>::iterator iter = cursor.empty() ? tokens.begin() : tokens.upper_bound(cursor);
+			string last;
+			while (iter != tokens.end() && (limit == 0 || records.size() < limit)) {
+				ProcIter proc_iter = _proc_coll.find(*iter);
+				if (proc_iter != _proc_coll.end()) {
+					records.emplace_back(ChunkerProto::K_REPLY);
+					encode_process(proc_iter->second,records.back());
+					resp.add(ChunkerProto::K_RECORD,records.back());
+					last = *iter;
 				}
-				if (token != iter->second._token) {
-					++iter;
-					continue;
-				}
-				sprintf(buf,"%ld",iter->second._start_time);
-				resp += string(buf) + "%3A" + iter->second._command + "%3A" + iter->second._token + "%3A" + iter->second._user;
-				sprintf(buf,"%ld",iter->second._read_offset);
-				resp += string("%3A") + string(buf) + "%2C";
 				++iter;
 			}
-			if (_debug) {
-				cout << "responding with: " << resp << endl;
+			if (iter != tokens.end() && last.empty() == false) {
+				resp.add_copy(ChunkerProto::K_CURSOR,last);
 			}
-			if (write(sock,resp.c_str(),resp.length()) < 0) {
-				return;
+		}
+		if (_debug) {
+			cout << "responding with " << records.size() << " processes" << endl;
+		}
+		resp.send(sock);
+		break;
+	}
+	case ChunkerProto::K_DETAILS: {
+		//information about a specific process
+		if (_debug) {
+			cout << "received process query: " << user << endl;
+		}
+
+		ChunkerEncoder resp(ChunkerProto::K_REPLY);
+		ChunkerEncoder record(ChunkerProto::K_REPLY);
+		ProcIter iter = _proc_coll.find(token);
+		if (iter != _proc_coll.end() && iter->second._user == user) {
+			touch(iter->second,cur_time);
+			encode_process(iter->second,record);
+			resp.add(ChunkerProto::K_RECORD,record);
+		}
+		resp.send(sock);
+		break;
+	}
+	case ChunkerProto::K_NEXT: {
+		//increment count IF chunk is available.
+		ChunkerEncoder resp(ChunkerProto::K_REPLY);
+		ProcIter iter = _proc_coll.find(token);
+		//don't let someone else browse this data
+		if (iter != _proc_coll.end() && user == iter->second._user) {
+			touch(iter->second,cur_time);
+			const string &output = iter->second._output;
+			string chunk_file = Rest::CHUNKER_RESP_TOK_DIR + Rest::CHUNKER_RESP_TOK_BASE + output;
+			resp.add(ChunkerProto::K_START_TIME,(uint64_t)iter->second._start_time);
+			resp.add(ChunkerProto::K_STATEMENT,iter->second._command);
+			resp.add(ChunkerProto::K_TOKEN,iter->second._token);
+			resp.add(ChunkerProto::K_USER,iter->second._user);
+
+			if (iter->second._status == ProcessData::K_DEAD) {
+				iter->second._read_offset = -1; //denotes a terminated process that has been completely read
 			}
-		} else if (command.find("<next>") != string::npos) {
-			//increment count IF chunk is available.
-			string resp;
-			ProcIter iter = _proc_coll.find(token);
-			if (iter != _proc_coll.end()) {
-				if (user != iter->second._user) {
-					//don't let someone else browse this data
-					resp = "";
-				} else {
-					sprintf(buf,"%ld",iter->second._read_offset);
-					string chunk_file = Rest::CHUNKER_RESP_TOK_DIR + Rest::CHUNKER_RESP_TOK_BASE + token;
-					sprintf(buf,"%ld",iter->second._start_time);
-					resp = string(buf) + "%3A" + iter->second._command + "%3A" + iter->second._token + "%3A" + iter->second._user;
 
-					if (iter->second._status == ProcessData::K_DEAD) {
-						iter->second._read_offset = -1; //denotes a terminated process that has been completely read
-					}
+			resp.add(ChunkerProto::K_READ_OFFSET,(uint64_t)iter->second._read_offset);
+			resp.add(ChunkerProto::K_OUTPUT,output);
 
-					sprintf(buf,"%ld",iter->second._read_offset);
-					resp += string("%3A") + string(buf) + "\n";
-
-					struct stat s;
-					if ((lstat(chunk_file.c_str(), &s) == 0)) {
-						//ok to increment
-						if ((unsigned)s.st_size > (iter->second._read_offset + _chunk_size)) {
-							iter->second._read_offset += _chunk_size;
-						} else {
-							iter->second._read_offset = s.st_size; //will allow the file to be read to the limit
-							//but first check to see if we are at the end of the file....
-							string end_file = Rest::CHUNKER_RESP_TOK_DIR + Rest::CHUNKER_RESP_TOK_BASE + token + "_end";
-							if (lstat(end_file.c_str(),&s) == 0) {
-								iter->second._status = ProcessData::K_DEAD;
-							}
-						}
+			struct stat s;
+			if ((lstat(chunk_file.c_str(), &s) == 0)) {
+				//ok to increment
+				if ((unsigned)s.st_size > (iter->second._read_offset + _chunk_size)) {
+					iter->second._read_offset += _chunk_size;
+				} else {
+					iter->second._read_offset = s.st_size; //will allow the file to be read to the limit
+					//but first check to see if we are at the end of the file....
+					string end_file = Rest::CHUNKER_RESP_TOK_DIR + Rest::CHUNKER_RESP_TOK_BASE + output + "_end";
+					if (lstat(end_file.c_str(),&s) == 0) {
+						iter->second._status = ProcessData::K_DEAD;
 					}
 				}
-			} else {
-				resp = "  ";
 			}
-			if (write(sock,resp.c_str(),resp.length()) < 0) {
-				if (_debug) {
-					cout << "error writing response: " << resp << endl;
-				}
-			}
-		} else if (command.find("<delete>") != string::npos) {
+		}
+		if (resp.send(sock) == false) {
 			if (_debug) {
-				cout << "received process query: " << user << endl;
+				cout << "error writing response for: " << token << endl;
 			}
-			kill_process(token);
 		}
+		break;
 	}
+	case ChunkerProto::K_DELETE:
+		if (_debug) {
+			cout << "received process query: " << user << endl;
+		}
+		kill_process(token);
+		break;
+	default:
+		break;
+	}
+}
+
+/**
+ * \brief Add the fields describing a requester to a listing record
+ **/
+void
+ChunkerManager::encode_process(ProcessData &pd, ChunkerEncoder &record)
+{
+	record.add(ChunkerProto::K_START_TIME,(uint64_t)pd._start_time);
+	record.add(ChunkerProto::K_STATEMENT,pd._command);
+	record.add(ChunkerProto::K_TOKEN,pd._token);
+	record.add(ChunkerProto::K_USER,pd._user);
+	record.add(ChunkerProto::K_READ_OFFSET,(uint64_t)pd._read_offset);
+	record.add(ChunkerProto::K_OUTPUT,pd._output);
+	record.add(ChunkerProto::K_FORMAT,pd._format);
+	unsigned long position = 0;
+	record.add_copy(ChunkerProto::K_STATE,job_state(pd._output,position));
+	record.add(ChunkerProto::K_POSITION,(uint64_t)position);
 }
 
 /**
@@ -311,13 +497,20 @@ ChunkerManager::process(int sock, char *buf)
 void
 ChunkerManager::kill_all()
 {
+	//kill_process() erases from the collection, so work from a copy of the keys
+	vector<string> keys;
 	ProcIter iter = _proc_coll.begin();
 	while (iter != _proc_coll.end()) {
 		if (!iter->first.empty()) {
-			kill_process(iter->first);
+			keys.push_back(iter->first);
 		}
 		++iter;
 	}
+	vector<string>::iterator k = keys.begin();
+	while (k != keys.end()) {
+		kill_process(*k);
+		++k;
+	}
 }
 
 /**
@@ -327,64 +520,580 @@ void
 ChunkerManager::shutdown()
 {
 	kill_all();
+	//there is no event loop left to follow up, wait out the grace period here
+	while (_term_coll.empty() == false) {
+		sleep(1);
+		reap_children();
+		struct timeval t;
+		gettimeofday(&t,NULL);
+		kill_terminated(t.tv_sec);
+	}
 	//clean up output directory on startup
 	string clean_cmd = string("rm -f ") + Rest::CHUNKER_RESP_TOK_DIR + "/* >/dev/null";
 	run_cmd(clean_cmd);
 }
 
 /**
- *
+ * \brief Remove a requester, the job goes once the last requester has gone
  **/
 void
 ChunkerManager::kill_process(string key)
 {
-	string term_cmd = "kill -15 -"; //now is expecting to kill group
-	string kill_cmd = "kill -9 -";
+	ProcIter iter = _proc_coll.find(key);
+	if (iter == _proc_coll.end()) {
+		return;
+	}
+	string output = iter->second._output;
+	UserIter user_iter = _user_coll.find(iter->second._user);
+	if (user_iter != _user_coll.end()) {
+		user_iter->second.erase(key);
+		if (user_iter->second.empty()) {
+			_user_coll.erase(user_iter);
+		}
+	}
+	//now remove entry from proc map:
+	_proc_coll.erase(iter);
+	_idle_timer.cancel(key);
+	release_job(output);
+}
 
-	//need to get pid from pid directory...
-	string file = Rest::CHUNKER_RESP_PID + "/" + key;
-	FILE *fp = fopen(file.c_str(), "r");
-	char pid[81];
-	size_t rslt;
+/**
+ * \brief Record activity of a requester, postponing its expiry
+ **/
+void
+ChunkerManager::touch(ProcessData &pd, unsigned long cur_time)
+{
+	pd._last_update = cur_time;
+	_idle_timer.schedule(pd._token,cur_time + _kill_timeout);
+}
 
-	if (fp) {
-		rslt = fread(pid, sizeof(char), sizeof(pid) - 1, fp);
-		fclose(fp);
-		if (rslt < 1) {
-			syslog(LOG_ERR, "webgui: Unable to read pid");
-			return;
+/**
+ * \brief Remove requesters idle for longer than the kill timeout
+ *
+ * Called once a second. Also keeps the output directory within quota
+ * and finishes off terminated jobs.
+ **/
+void
+ChunkerManager::reap(unsigned long cur_time)
+{
+	vector<string> expired = _idle_timer.advance(cur_time);
+	vector<string>::iterator iter = expired.begin();
+	while (iter != expired.end()) {
+		ProcIter proc_iter = _proc_coll.find(*iter);
+		if (proc_iter != _proc_coll.end()) {
+			syslog(LOG_INFO, "webgui: removing idle process %s, last update %lu",
+			       iter->c_str(), proc_iter->second._last_update);
+			kill_process(*iter);
 		}
-	} else {
+		++iter;
+	}
+
+	if (_quota > 0) {
+		enforce_quota();
+	}
+	kill_terminated(cur_time);
+}
+
+/**
+ * \brief Evict the oldest jobs until their output fits within the quota
+ **/
+void
+ChunkerManager::enforce_quota()
+{
+	multimap<unsigned long, string> by_age;
+	unsigned long long usage = 0;
+	JobIter iter = _job_coll.begin();
+	while (iter != _job_coll.end()) {
+		struct stat s;
+		string file = Rest::CHUNKER_RESP_TOK_DIR + Rest::CHUNKER_RESP_TOK_BASE + iter->first;
+		if (lstat(file.c_str(),&s) == 0) {
+			usage += s.st_size;
+			by_age.insert(pair<unsigned long, string>(iter->second._start_time,iter->first));
+		}
+		file += "_idx";
+		if (lstat(file.c_str(),&s) == 0) {
+			usage += s.st_size;
+		}
+		++iter;
+	}
+
+	multimap<unsigned long, string>::iterator oldest = by_age.begin();
+	while (usage > _quota && oldest != by_age.end()) {
+		struct stat s;
+		string file = Rest::CHUNKER_RESP_TOK_DIR + Rest::CHUNKER_RESP_TOK_BASE + oldest->second;
+		if (lstat(file.c_str(),&s) == 0) {
+			usage -= min<unsigned long long>(usage, s.st_size);
+		}
+		file += "_idx";
+		if (lstat(file.c_str(),&s) == 0) {
+			usage -= min<unsigned long long>(usage, s.st_size);
+		}
+		syslog(LOG_NOTICE, "webgui: output quota exceeded, removing %s", oldest->second.c_str());
+		evict_job(oldest->second);
+		++oldest;
+	}
+}
+
+/**
+ * \brief Remove a job along with every requester attached to it
+ **/
+void
+ChunkerManager::evict_job(const string &output)
+{
+	JobIter job_iter = _job_coll.find(output);
+	if (job_iter == _job_coll.end()) {
+		return;
+	}
+	bool cached = job_iter->second._cached;
+	job_iter->second._cached = false;
+
+	vector<string> tokens;
+	ProcIter iter = _proc_coll.begin();
+	while (iter != _proc_coll.end()) {
+		if (iter->second._output == output) {
+			tokens.push_back(iter->first);
+		}
+		++iter;
+	}
+
+	vector<string>::iterator t = tokens.begin();
+	while (t != tokens.end()) {
+		kill_process(*t);
+		++t;
+	}
+	if (cached) {
+		release_job(output);
+	}
+}
+
+/**
+ * \brief Drop a reference to a job, terminating and cleaning it up on the last one
+ **/
+void
+ChunkerManager::release_job(const string &output)
+{
+	JobIter iter = _job_coll.find(output);
+	if (iter == _job_coll.end()) {
+		return;
+	}
+	if (iter->second._refs > 1) {
+		--iter->second._refs;
 		return;
 	}
 
+	SharedIter shared_iter = _shared_coll.find(iter->second._key);
+	if (shared_iter != _shared_coll.end() && shared_iter->second == output) {
+		_shared_coll.erase(shared_iter);
+	}
+
+	if (iter->second._status == JobData::K_QUEUED) {
+		dequeue(iter->second);
+	} else if (is_running(iter->second)) {
+		terminate(iter->second);
+		release_slot(iter->second);
+	}
+	iter->second._proc.close_output();
+	_job_coll.erase(iter);
+
+	string file = Rest::CHUNKER_RESP_PID + "/" + output;
+	unlink(file.c_str());
+	file = Rest::CHUNKER_RESP_TOK_DIR + Rest::CHUNKER_RESP_TOK_BASE + output;
 	unlink(file.c_str());
+	unlink((file + "_idx").c_str());
+	file += "_end";
+	unlink(file.c_str());
+}
+
+/**
+ * \brief Ask the process group of a job to exit
+ *
+ * Does not wait, kill_terminated() follows up with SIGKILL from the
+ * reaper once the grace period is over.
+ **/
+void
+ChunkerManager::terminate(JobData &job)
+{
+	pid_t pid = job._proc.pid();
+	if (pid <= 0) {
+		return;
+	}
+
 	//little hammer
-	term_cmd += string(pid);
-	//big hammer
-	kill_cmd += string(pid);
-
-	int ct = 3; //attempt three times.
-	string exist_file = "/proc/" + string(pid) + "/stat";
-	bool killed = false;
-	while (ct > 0) {
-		run_cmd(term_cmd);
-		sleep(1); //one second
-		//does process still exist?
-		struct stat s;
-		if (stat(exist_file.c_str(), &s) == -1) {
-			killed = true;
-			break;
+	kill(-pid, SIGTERM);
+	struct timeval t;
+	gettimeofday(&t,NULL);
+	_term_coll[pid] = t.tv_sec + TERM_GRACE;
+}
+
+/**
+ * \brief SIGKILL terminated process groups that outlived their grace period
+ **/
+void
+ChunkerManager::kill_terminated(unsigned long cur_time)
+{
+	map<pid_t, unsigned long>::iterator iter = _term_coll.begin();
+	while (iter != _term_coll.end()) {
+		//reap_children() has collected the leader if it exited
+		if (kill(-iter->first, 0) == -1 && errno == ESRCH) {
+			_term_coll.erase(iter++);
+		} else if (iter->second <= cur_time) {
+			//now use big hammer
+			kill(-iter->first, SIGKILL);
+			_term_coll.erase(iter++);
+		} else {
+			++iter;
 		}
-		--ct;
+	}
+}
+
+/**
+ * \brief Whether a job is still producing output
+ *
+ * Jobs that have finished are no longer offered for coalescing.
+ **/
+bool
+ChunkerManager::is_running(JobData &job)
+{
+	if (job._status == JobData::K_DONE) {
+		return false;
 	}
 
-	if (killed == false) {
-		//now use big hammer
-		run_cmd(kill_cmd);
+	struct stat s;
+	string end_file = Rest::CHUNKER_RESP_TOK_DIR + Rest::CHUNKER_RESP_TOK_BASE + job._output + "_end";
+	if (lstat(end_file.c_str(),&s) != 0) {
+		return true;
 	}
-	//now remove entry from proc map:
-	_proc_coll.erase(key);
+
+	release_slot(job);
+	job._status = JobData::K_DONE;
+	job._end_time = s.st_mtime;
+	if (job._cached == true) {
+		//stays available for attaching until expire_cache()
+		return false;
+	}
+	SharedIter iter = _shared_coll.find(job._key);
+	if (iter != _shared_coll.end() && iter->second == job._output) {
+		_shared_coll.erase(iter);
+	}
+	return false;
+}
+
+/**
+ * \brief Whether there is a free slot to run a job for user
+ **/
+bool
+ChunkerManager::can_start(const string &user)
+{
+	if (_running_coll.size() >= _max_jobs) {
+		return false;
+	}
+	map<string, unsigned long>::iterator iter = _user_running_coll.find(user);
+	return (iter == _user_running_coll.end() || iter->second < _max_user_jobs);
+}
+
+/**
+ * \brief Start the processor of a queued job
+ **/
+bool
+ChunkerManager::start_job(JobData &job)
+{
+	if (_debug) {
+		cout << "starting job: " << job._output << ", running: " << _running_coll.size() << endl;
+	}
+
+	if (job._proc.start_new(job._output,job._command,job._user) == false) {
+		//let the requesters see the job as finished
+		string end_file = Rest::CHUNKER_RESP_TOK_DIR + Rest::CHUNKER_RESP_TOK_BASE + job._output + "_end";
+		FILE *fp = fopen(end_file.c_str(), "w");
+		if (fp) {
+			fclose(fp);
+		}
+		job._status = JobData::K_RUNNING;
+		is_running(job);
+		return false;
+	}
+
+	job._status = JobData::K_RUNNING;
+	_child_coll[job._proc.pid()] = job._output;
+	_running_coll.insert(job._output);
+	++_user_running_coll[job._user];
+	return true;
+}
+
+/**
+ * \brief Give up the run slot held by a job
+ **/
+void
+ChunkerManager::release_slot(JobData &job)
+{
+	if (_running_coll.erase(job._output) == 0) {
+		return;
+	}
+	map<string, unsigned long>::iterator iter = _user_running_coll.find(job._user);
+	if (iter != _user_running_coll.end() && --iter->second == 0) {
+		_user_running_coll.erase(iter);
+	}
+}
+
+/**
+ * \brief Queue a job behind the other jobs of its user and priority class
+ **/
+void
+ChunkerManager::enqueue(JobData &job)
+{
+	job._status = JobData::K_QUEUED;
+	RunQueue &queue = _queue_coll[job._priority];
+	if (queue._jobs.find(job._user) == queue._jobs.end()) {
+		queue._users.push_back(job._user);
+	}
+	queue._jobs[job._user].push_back(job._output);
+}
+
+/**
+ * \brief Remove a job that has not been started from its queue
+ **/
+void
+ChunkerManager::dequeue(JobData &job)
+{
+	QueueIter queue_iter = _queue_coll.find(job._priority);
+	if (queue_iter == _queue_coll.end()) {
+		return;
+	}
+	RunQueue &queue = queue_iter->second;
+	map<string, deque<string> >::iterator user_iter = queue._jobs.find(job._user);
+	if (user_iter == queue._jobs.end()) {
+		return;
+	}
+	deque<string> &jobs = user_iter->second;
+	jobs.erase(remove(jobs.begin(), jobs.end(), job._output), jobs.end());
+	if (jobs.empty()) {
+		queue._jobs.erase(user_iter);
+		queue._users.remove(job._user);
+	}
+	if (queue._users.empty()) {
+		_queue_coll.erase(queue_iter);
+	}
+}
+
+/**
+ * \brief Free the slots of finished jobs and start queued jobs
+ *
+ * Higher priority classes are served first. Within a class users take
+ * turns, users at their limit are passed over.
+ **/
+void
+ChunkerManager::schedule()
+{
+	vector<string> running(_running_coll.begin(), _running_coll.end());
+	vector<string>::iterator i = running.begin();
+	while (i != running.end()) {
+		JobIter job_iter = _job_coll.find(*i);
+		if (job_iter == _job_coll.end()) {
+			_running_coll.erase(*i);
+		} else {
+			is_running(job_iter->second);
+		}
+		++i;
+	}
+
+	QueueIter queue_iter = _queue_coll.begin();
+	while (queue_iter != _queue_coll.end() && _running_coll.size() < _max_jobs) {
+		RunQueue &queue = queue_iter->second;
+		size_t passed = 0;
+		while (queue._users.empty() == false && passed < queue._users.size() &&
+		       _running_coll.size() < _max_jobs) {
+			string user = queue._users.front();
+			queue._users.pop_front();
+			if (can_start(user) == false) {
+				queue._users.push_back(user);
+				++passed;
+				continue;
+			}
+			passed = 0;
+
+			deque<string> &jobs = queue._jobs[user];
+			if (jobs.empty()) {
+				queue._jobs.erase(user);
+				continue;
+			}
+			string output = jobs.front();
+			jobs.pop_front();
+			if (jobs.empty()) {
+				queue._jobs.erase(user);
+			} else {
+				queue._users.push_back(user);
+			}
+
+			JobIter job_iter = _job_coll.find(output);
+			if (job_iter != _job_coll.end()) {
+				start_job(job_iter->second);
+			}
+		}
+		if (queue._users.empty()) {
+			_queue_coll.erase(queue_iter++);
+		} else {
+			++queue_iter;
+		}
+	}
+}
+
+/**
+ * \brief Number of queued jobs started before and including this one
+ **/
+unsigned long
+ChunkerManager::queue_position(JobData &job)
+{
+	unsigned long position = 0;
+	QueueIter queue_iter = _queue_coll.begin();
+	while (queue_iter != _queue_coll.end() && queue_iter->first <= job._priority) {
+		RunQueue &queue = queue_iter->second;
+		if (queue_iter->first < job._priority) {
+			map<string, deque<string> >::iterator iter = queue._jobs.begin();
+			while (iter != queue._jobs.end()) {
+				position += iter->second.size();
+				++iter;
+			}
+			++queue_iter;
+			continue;
+		}
+
+		//this job's turn comes after index turns of its own user
+		deque<string> &own = queue._jobs[job._user];
+		unsigned long index = find(own.begin(), own.end(), job._output) - own.begin();
+		position += index;
+
+		//users ahead in the rotation get one more turn than those behind
+		bool ahead = true;
+		list<string>::iterator user = queue._users.begin();
+		while (user != queue._users.end()) {
+			if (*user == job._user) {
+				ahead = false;
+			} else {
+				unsigned long turns = index + (ahead ? 1 : 0);
+				position += min<unsigned long>(queue._jobs[*user].size(), turns);
+			}
+			++user;
+		}
+		break;
+	}
+	return position + 1;
+}
+
+/**
+ * \brief State of a job as reported in process listings
+ **/
+string
+ChunkerManager::job_state(const string &output, unsigned long &position)
+{
+	position = 0;
+	JobIter iter = _job_coll.find(output);
+	if (iter == _job_coll.end()) {
+		return string("finished");
+	}
+	if (iter->second._status == JobData::K_QUEUED) {
+		position = queue_position(iter->second);
+		return string("queued");
+	}
+	if (is_running(iter->second)) {
+		return string("running");
+	}
+	return string("finished");
+}
+
+/**
+ * \brief Whether a finished job's output can still be served from cache
+ **/
+bool
+ChunkerManager::is_cache_valid(JobData &job, unsigned long cur_time)
+{
+	return (job._cached == true && job._status == JobData::K_DONE &&
+		job._end_time + _cache_ttl >= cur_time);
+}
+
+/**
+ * \brief Drop the cache reference of finished jobs older than the ttl
+ **/
+void
+ChunkerManager::expire_cache(unsigned long cur_time)
+{
+	vector<string> expired;
+	JobIter iter = _job_coll.begin();
+	while (iter != _job_coll.end()) {
+		if (iter->second._cached == true && is_running(iter->second) == false &&
+		    is_cache_valid(iter->second,cur_time) == false) {
+			iter->second._cached = false;
+			SharedIter shared_iter = _shared_coll.find(iter->second._key);
+			if (shared_iter != _shared_coll.end() && shared_iter->second == iter->first) {
+				_shared_coll.erase(shared_iter);
+			}
+			expired.push_back(iter->first);
+		}
+		++iter;
+	}
+
+	vector<string>::iterator i = expired.begin();
+	while (i != expired.end()) {
+		if (_debug) {
+			cout << "expiring cached output: " << *i << endl;
+		}
+		release_job(*i);
+		++i;
+	}
+}
+
+/**
+ * \brief Strip the quoting added to op mode statements by the rest server
+ **/
+string
+ChunkerManager::normalize(const string &cmd)
+{
+	string out;
+	string::const_iterator iter = cmd.begin();
+	while (iter != cmd.end()) {
+		if (*iter != '\'') {
+			out += *iter;
+		}
+		++iter;
+	}
+	return out;
+}
+
+/**
+ * \brief Key identifying identical commands
+ *
+ * Commands are only shared between users with the same group
+ * membership, as that is what op mode command authorization is based on.
+ * Output may also depend on who runs the command (show login, files
+ * under $HOME), so a command is only shared by requests of the same
+ * user unless it is on the cache list, whose commands are declared to
+ * give every user the same output.
+ **/
+string
+ChunkerManager::job_key(const string &cmd, const string &user)
+{
+	struct passwd *pw = getpwnam(user.c_str());
+	if (pw == NULL) {
+		return string("");
+	}
+
+	int ngroups = 0;
+	getgrouplist(user.c_str(), pw->pw_gid, NULL, &ngroups);
+	vector<gid_t> groups(ngroups);
+	if (ngroups == 0 || getgrouplist(user.c_str(), pw->pw_gid, &groups[0], &ngroups) == -1) {
+		return string("");
+	}
+	sort(groups.begin(), groups.end());
+
+	string key;
+	if (_cache_cmds.find(normalize(cmd)) == _cache_cmds.end()) {
+		key = "uid=" + Rest::ulltostring(pw->pw_uid) + ";";
+	}
+	vector<gid_t>::iterator iter = groups.begin();
+	while (iter != groups.end()) {
+		key += Rest::ulltostring(*iter) + ",";
+		++iter;
+	}
+	return key + "%3A" + cmd;
 }
 
 /**
@@ -14,8 +14,54 @@
 
 #include <string>
 #include <map>
+#include <unordered_map>
+#include <set>
+#include <list>
+#include <deque>
 #include "chunker2_processor.hh"
+#include "chunker2_timer.hh"
 
+class ChunkerMessage;
+class ChunkerEncoder;
+
+/**
+ * A running (or finished) op mode command. Several requesters may be
+ * attached to the same job, the job's output is shared between them.
+ **/
+class JobData
+{
+public:
+	typedef enum {K_QUEUED, K_RUNNING, K_DONE} JobStatus;
+	typedef enum {K_PRIO_HIGH, K_PRIO_NORMAL, K_PRIO_LOW} Priority;
+
+public:
+	JobData() :
+		_priority(K_PRIO_NORMAL),
+		_start_time(0),
+		_end_time(0),
+		_refs(0),
+		_cached(false),
+		_status(K_RUNNING)
+	{}
+
+public:
+	ChunkerProcessor _proc;
+	std::string _output; //token the output and pid files are named after
+	std::string _command;
+	std::string _user; //user the job runs as
+	std::string _key; //coalescing key, see job_key()
+	Priority _priority;
+	unsigned long _start_time;
+	unsigned long _end_time;
+	unsigned long _refs; //number of requesters attached to this job
+	bool _cached; //result cache holds a reference to this job
+	JobStatus _status;
+};
+
+/**
+ * A requester of an op mode command, each has its own token and
+ * read cursor.
+ **/
 class ProcessData
 {
 public:
@@ -30,12 +76,13 @@ public:
 	{}
 
 public:
-	ChunkerProcessor _proc;
 	unsigned long _start_time;
 	unsigned long _last_update;
 	std::string _command;
 	std::string _token; //is the string version of the key
+	std::string _output; //token of the job producing the output
 	std::string _user;
+	std::string _format; //text or ndjson
 	unsigned long _read_offset;
 	ProcStatus _status;
 };
@@ -43,21 +90,60 @@ public:
 class ChunkerManager
 {
 public:
-	typedef std::map<std::string, ProcessData> ProcColl;
-	typedef std::map<std::string, ProcessData>::iterator ProcIter;
+	typedef std::unordered_map<std::string, ProcessData> ProcColl;
+	typedef std::unordered_map<std::string, ProcessData>::iterator ProcIter;
+	typedef std::map<std::string, std::set<std::string> > UserColl;
+	typedef std::map<std::string, std::set<std::string> >::iterator UserIter;
+	typedef std::map<std::string, JobData> JobColl;
+	typedef std::map<std::string, JobData>::iterator JobIter;
+	typedef std::map<std::string, std::string> SharedColl;
+	typedef std::map<std::string, std::string>::iterator SharedIter;
+
+	/**
+	 * Queued jobs of one priority class. Users take turns, each user's
+	 * jobs are started in the order they were submitted.
+	 **/
+	class RunQueue
+	{
+	public:
+		std::list<std::string> _users; //round robin order
+		std::map<std::string, std::deque<std::string> > _jobs; //per user, by output token
+	};
+	typedef std::map<JobData::Priority, RunQueue> QueueColl;
+	typedef std::map<JobData::Priority, RunQueue>::iterator QueueIter;
 
 public:
 	ChunkerManager(const std::string &pid, unsigned long kill_timeout, unsigned long chunk_size, bool debug) :
 		_pid(pid),
 		_kill_timeout(kill_timeout),
 		_chunk_size(chunk_size),
+		_cache_ttl(0),
+		_max_jobs(16),
+		_max_user_jobs(4),
+		_quota(0),
+		_last_reap(0),
 		_debug(debug) {}
 	~ChunkerManager();
 
 	void
 	init();
 
-	//listens on pipe for message from webserver
+	bool
+	init_cache(const std::string &file, unsigned long ttl);
+
+	void
+	set_limits(unsigned long max_jobs, unsigned long max_user_jobs) {
+		_max_jobs = max_jobs;
+		_max_user_jobs = max_user_jobs;
+	}
+
+	//bytes of output kept in Rest::CHUNKER_RESP_TOK_DIR, 0 for no limit
+	void
+	set_quota(unsigned long long quota) {
+		_quota = quota;
+	}
+
+	//listens on pipe for message from webserver and services running jobs
 	void
 	read();
 
@@ -69,19 +155,103 @@ public:
 
 private:
 	void
-	process(int socket, char *buf);
+	accept_requests();
+
+	void
+	reap_children();
+
+	void
+	process(int socket, const ChunkerMessage &msg);
+
+	void
+	encode_process(ProcessData &pd, ChunkerEncoder &record);
 
 	void
 	kill_process(std::string key);
 
+	void
+	release_job(const std::string &output);
+
+	void
+	evict_job(const std::string &output);
+
+	void
+	touch(ProcessData &pd, unsigned long cur_time);
+
+	void
+	reap(unsigned long cur_time);
+
+	void
+	enforce_quota();
+
+	void
+	terminate(JobData &job);
+
+	void
+	kill_terminated(unsigned long cur_time);
+
+	bool
+	is_running(JobData &job);
+
+	bool
+	can_start(const std::string &user);
+
+	bool
+	start_job(JobData &job);
+
+	void
+	enqueue(JobData &job);
+
+	void
+	dequeue(JobData &job);
+
+	void
+	release_slot(JobData &job);
+
+	void
+	schedule();
+
+	unsigned long
+	queue_position(JobData &job);
+
+	std::string
+	job_state(const std::string &output, unsigned long &position);
+
+	bool
+	is_cache_valid(JobData &job, unsigned long cur_time);
+
+	void
+	expire_cache(unsigned long cur_time);
+
+	std::string
+	normalize(const std::string &cmd);
+
+	std::string
+	job_key(const std::string &cmd, const std::string &user);
+
 	bool run_cmd(const std::string &cmd);
 
 private:
 	ProcColl _proc_coll;
+	UserColl _user_coll; //requester tokens of each user, ordered for paging
+	JobColl _job_coll;
+	SharedColl _shared_coll; //running and cached jobs that can be attached to, by job_key()
+	std::set<std::string> _cache_cmds; //commands whose output is kept, normalized
+	QueueColl _queue_coll;
+	std::set<std::string> _running_coll; //jobs holding a run slot, by output token
+	std::map<pid_t, std::string> _child_coll; //unreaped commands, by pid
+	std::map<pid_t, unsigned long> _term_coll; //process groups sent SIGTERM, by pid, with SIGKILL deadline
+	std::map<std::string, unsigned long> _user_running_coll; //run slots held per user
+	TimerWheel _idle_timer; //requesters by token, expire after _kill_timeout
 	std::string _pid;
 	int _listen_sock;
 	unsigned long _kill_timeout;
 	unsigned long _chunk_size;
+	unsigned long _cache_ttl;
+	unsigned long _max_jobs;
+	unsigned long _max_user_jobs;
+	unsigned long long _quota;
+	unsigned long _last_reap;
 	bool _debug;
 };
 
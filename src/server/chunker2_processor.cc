@@ -9,15 +9,16 @@
  * SPDX-License-Identifier: GPL-2.0-only
  **/
 
-#include <libaudit.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <stdint.h>
 #include <sys/time.h>
 #include <sys/sysinfo.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
 #include <cstring>
-#include <pwd.h>
 #include <strings.h>
 #include <signal.h>
 #include <syslog.h>
@@ -26,7 +27,7 @@
 #include <stdlib.h>
 #include <iostream>
 #include <string>
-#include <grp.h>
+#include <jansson.h>
 #include "common.hh"
 #include "http.hh"
 #include "chunker2_processor.hh"
@@ -34,6 +35,8 @@
 
 using namespace std;
 
+static const unsigned int SERVICE_READS = 4; //per call of service()
+
 /**
  *
  **/
@@ -48,132 +51,301 @@ ChunkerProcessor::start_new(string token, const string &cmd, const string &user)
 		return false;
 	}
 
-	struct sigaction sa;
-	sigaction(SIGCHLD, NULL, &sa);
-	sa.sa_flags |= SA_NOCLDWAIT;//(since POSIX.1-2001 and Linux 2.6 and later)
-	sigaction(SIGCHLD, &sa, NULL);
-
-	if (fork() != 0) {
-		//parent
-		return true;
+	Credentials cred;
+	if (cred.resolve(user) == false) {
+		syslog(LOG_ERR, "webgui: Unable to resolve credentials for %s", user.c_str());
+		return false;
 	}
 
-	//should detach child process at this point
+	string file = Rest::CHUNKER_RESP_TOK_DIR + Rest::CHUNKER_RESP_TOK_BASE + token;
+	_out_fd = open(file.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0666);
+	if (_out_fd < 0) {
+		syslog(LOG_ERR,"webgui: Failed to open response file %s", file.c_str());
+		return false;
+	}
 
-	umask(0);
-	setsid();
+	string idx_file = file + "_idx";
+	_idx_fd = open(idx_file.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0666);
+	if (_idx_fd < 0) {
+		syslog(LOG_ERR,"webgui: Failed to open response index %s", idx_file.c_str());
+		close_output();
+		return false;
+	}
 
 	int cp[2]; /* Child to parent pipe */
+	if (pipe2(cp, O_CLOEXEC) < 0) {
+		syslog(LOG_ERR, "webgui: Can't make pipe: %d", errno);
+		close_output();
+		return false;
+	}
 
-	if( pipe(cp) < 0) {
-		perror("Can't make pipe");
-		exit(1);
+	//everything the child needs is built here, it must not allocate
+	string opmodecmd = cmd;
+	string userenv = "EFFECTIVE_USER="+user;
+	string processclientenv = "VYATTA_PROCESS_CLIENT=gui2_rest";
+	vector <string> opcmdarr;
+	tokenizeOpCmd(opmodecmd, opcmdarr);
+
+	// Create json args to pass in via environment
+	// format is OPC_ARGS={"args": ["arg1", "args2", "argn"]}
+	JSON args;
+	for (vector <string>::size_type i = 0; i<opcmdarr.size(); i++) {
+		args.add_array("args", opcmdarr[i], false);
 	}
+	string opcargs;
+	args.serialize(opcargs);
+	opcargs = "OPC_ARGS=" + opcargs;
 
+	char *cmdarr[] = {
+		(char*)"/opt/vyatta/bin/opc",
+		(char*)"-op",
+		(char*)"run-from-env",
+		NULL
+	};
+	char *envarr[] = {
+		(char*)userenv.c_str(),
+		(char*)processclientenv.c_str(),
+		(char*)opcargs.c_str(),
+		NULL
+	};
 
-	//set up to run as user id...
+	SpawnArgs sa;
+	sa._argv = cmdarr;
+	sa._envp = envarr;
+	sa._out = cp[1];
+	sa._umask = 0;
+	sa._cred = &cred;
+
+	struct timespec t0, t1;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	_pid = Rest::spawn(sa);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	close(cp[1]);
 
-	//move this up the timeline in the future, but this is where we will initially set the uid/gid
-	//retreive username, then use getpwnam() from here to populate below
-	struct passwd *pw;
-	pw = getpwnam(user.c_str());
-	if (pw == NULL) {
+	if (_pid < 0) {
+		close(cp[0]);
+		close_output();
 		return false;
 	}
+	_spawn_usec = (t1.tv_sec - t0.tv_sec) * 1000000 + (t1.tv_nsec - t0.tv_nsec) / 1000;
 
-	pid_t pid = fork();
+	_fd = cp[0];
+	fcntl(_fd, F_SETFL, fcntl(_fd, F_GETFL) | O_NONBLOCK);
+	_token = token;
 
-	if (pid == 0) {
-		//child
-		if (audit_setloginuid(pw->pw_uid) < 0) {
-			perror("setloginuid");
-			exit(1);
-		}
+	//pgrp of the command, for external cleanup
+	if (_pid_path.empty() == false) {
+		pid_output((_pid_path + "/" + token).c_str(), _pid);
+	}
+	return true;
+}
 
-		/* Retrieve group list */
-		int ngroups = 10;
-		gid_t groups[10];
-		if (getgrouplist(user.c_str(), pw->pw_gid, groups, &ngroups) == -1) {
-			return false;
-		}
+/**
+ * Move output from the pipe into the response file. At most
+ * SERVICE_READS reads are made, the pipe stays readable and the
+ * event loop comes back, so a fast command can't hold up the others.
+ **/
+bool
+ChunkerProcessor::service()
+{
+	if (_fd < 0) {
+		return false;
+	}
 
-		if (setgroups(ngroups,groups) != 0) {
-			syslog(LOG_DEBUG,"grouperror: %d",errno);
-			return false;
+	if (_buf.size() < _chunk_size) {
+		_buf.resize(_chunk_size);
+	}
+	bool eof = false;
+	for (unsigned int reads = 0; reads < SERVICE_READS && eof == false; ++reads) {
+		ssize_t ct = read(_fd, &_buf[0], _chunk_size);
+		if (ct > 0) {
+			if (_filter.empty()) {
+				emit(&_buf[0], ct, false);
+				continue;
+			}
+			string out;
+			_filter.process(&_buf[0], ct, out);
+			if (_filter.done()) {
+				//nothing more will be kept, closing the pipe stops the command
+				_filter.finish(out);
+				emit(out.data(), out.size(), true);
+				eof = true;
+				continue;
+			}
+			emit(out.data(), out.size(), false);
+			continue;
 		}
-		if (setgid(pw->pw_gid) != 0) {
-			return false;
+		if (ct < 0 && errno == EINTR) {
+			continue;
 		}
-		if (setuid(pw->pw_uid) != 0) {
-			return false;
+		if (ct < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			return true;
 		}
+		string out;
+		_filter.finish(out);
+		emit(out.data(), out.size(), true);
+		eof = true;
+	}
+	if (eof == false) {
+		return true;
+	}
 
-		//now we are ready to do some real work....
+	//eof, or the pipe failed: either way the command is finished with us
+	close(_fd);
+	_fd = -1;
+	process_chunk_end();
+	return false;
+}
 
-		writer(token,cmd,cp,user);
-		exit(0);
-	} else {
-		//parent
-		reader(token,cp);
+/**
+ * \brief Store output in the job's format
+ *
+ * \param last No more output follows
+ **/
+void
+ChunkerProcessor::emit(const char *data, size_t len, bool last)
+{
+	if (_ndjson == false) {
+		write_output(data, len);
+		return;
+	}
+	string rec;
+	frame_ndjson(data, len, last, rec);
+	write_output(rec.data(), rec.size());
+}
 
-		//now wait on child to kick the bucket
-		wait(NULL);
-		exit(0);
+/**
+ * \brief A line of output as a json string
+ *
+ * Output that is not valid UTF-8 has its non-ASCII bytes replaced.
+ **/
+static json_t *
+line_string(const char *data, size_t len)
+{
+	json_t *str = json_stringn(data, len);
+	if (str != NULL) {
+		return str;
 	}
-	return true;
+	string ascii(data, len);
+	for (size_t i = 0; i < ascii.size(); ++i) {
+		if ((unsigned char)ascii[i] >= 0x80) {
+			ascii[i] = '?';
+		}
+	}
+	return json_stringn(ascii.data(), ascii.size());
 }
 
 /**
+ * \brief Wrap the complete lines of a piece of output in an NDJSON record
  *
+ * A record is {"seq":N,"offset":O,"ts":T,"lines":[...]}, where offset
+ * is the position of the first line in the plain text output and ts
+ * is when the output was read, in milliseconds since the epoch. Lines
+ * are never split between records, a trailing partial line is held
+ * until its newline arrives or last is set.
  **/
 void
-ChunkerProcessor::writer(string token, const string &cmd,int (&cp)[2], string user)
+ChunkerProcessor::frame_ndjson(const char *data, size_t len, bool last, string &out)
 {
-	//use child pid to allow cleanup of parent
-	if (_pid_path.empty() == false) {
-		_pid_path += "/" + token;
-		pid_output(_pid_path.c_str());
+	string text;
+	if (_partial_line.empty() == false) {
+		text.swap(_partial_line);
+		text.append(data, len);
+		data = text.data();
+		len = text.size();
 	}
-	/* Child. */
-	close(1); /* Close current stdout. */
-	dup2(cp[1],1); /* Make stdout go to write end of pipe. */
-	dup2(cp[1],2); /* Make stderr go to write end of pipe. */
-	close(0); /* Close current stdin. */
-	close(cp[0]);
 
-	string opmodecmd = cmd;
-	string userenv = "EFFECTIVE_USER="+user;
-	string processclientenv = "VYATTA_PROCESS_CLIENT=gui2_rest";
-	vector <string> opcmdarr;
-	tokenizeOpCmd(opmodecmd, opcmdarr);
+	json_t *lines = json_array();
+	const char *p = data;
+	const char *end = data + len;
+	const char *nl;
+	while ((nl = (const char*)memchr(p, '\n', end - p)) != NULL) {
+		json_array_append_new(lines, line_string(p, nl - p));
+		p = nl + 1;
+	}
+	if (p < end) {
+		if (last) {
+			json_array_append_new(lines, line_string(p, end - p));
+			p = end;
+		} else {
+			_partial_line.assign(p, end - p);
+		}
+	}
 
-	char **cmdarr = new char*[4];
-	cmdarr[0] = (char *)(string("/opt/vyatta/bin/opc").c_str());
-	cmdarr[1] = (char *)(string("-op").c_str());
-	cmdarr[2] = (char *)(string("run-from-env").c_str());
-	cmdarr[3] = NULL;
+	if (json_array_size(lines) == 0) {
+		json_decref(lines);
+		return;
+	}
 
-	// Create json args to pass in via environment
-	// format is OPC_ARGS={"args": ["arg1", "args2", "argn"]}
-	JSON args;
-	for (vector <string>::size_type i = 0; i<opcmdarr.size(); i++) {
-		args.add_array("args", opcmdarr[i], false);
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	json_t *rec = json_object();
+	json_object_set_new(rec, "seq", json_integer(_seq));
+	json_object_set_new(rec, "offset", json_integer(_text_offset));
+	json_object_set_new(rec, "ts", json_integer((long long)tv.tv_sec * 1000 + tv.tv_usec / 1000));
+	json_object_set_new(rec, "lines", lines);
+	++_seq;
+	_text_offset += p - data;
+
+	char *s = json_dumps(rec, JSON_COMPACT);
+	if (s != NULL) {
+		out = s;
+		out += '\n';
+		free(s);
 	}
-	string opcargs;
-	args.serialize(opcargs);
-	opcargs = "OPC_ARGS=" + opcargs;
+	json_decref(rec);
+}
 
-	char *envarr[] = {
-		(char*)userenv.c_str(),
-		(char*)processclientenv.c_str(),
-		(char*)opcargs.c_str(),
-		NULL
-	};
-	int err = execve("/opt/vyatta/bin/opc", cmdarr, envarr);
-	close(cp[1]);
-	delete[] cmdarr;
-	if (err == -1) {
-		syslog(LOG_ERR, "ERROR RECEIVED FROM EXECVP(1): %d, %d",err, errno);
+/**
+ *
+ **/
+void
+ChunkerProcessor::write_output(const char *data, size_t len)
+{
+	if (_out_fd < 0 || len == 0) {
+		return;
+	}
+	if (write(_out_fd, data, len) != (ssize_t)len) {
+		syslog(LOG_ERR,"webgui: Error writing out response chunk");
+		return;
+	}
+
+	//index the lines after the data so that entries never point past it
+	vector<uint64_t> starts;
+	if (_written == 0) {
+		starts.push_back(0);
+	}
+	const char *p = data;
+	const char *end = data + len;
+	while ((p = (const char*)memchr(p, '\n', end - p)) != NULL) {
+		++p;
+		starts.push_back(_written + (p - data));
+	}
+	_written += len;
+
+	size_t bytes = starts.size() * sizeof(uint64_t);
+	if (_idx_fd >= 0 && bytes > 0 && write(_idx_fd, &starts[0], bytes) != (ssize_t)bytes) {
+		syslog(LOG_ERR,"webgui: Error writing out response index");
+	}
+}
+
+/**
+ *
+ **/
+void
+ChunkerProcessor::close_output()
+{
+	if (_fd >= 0) {
+		close(_fd);
+		_fd = -1;
+	}
+	if (_out_fd >= 0) {
+		close(_out_fd);
+		_out_fd = -1;
+	}
+	if (_idx_fd >= 0) {
+		close(_idx_fd);
+		_idx_fd = -1;
 	}
 }
 
@@ -217,62 +389,16 @@ ChunkerProcessor::tokenizeOpCmd(string &opmodecmd, vector<string> &opcmdarr)
 	}
 }
 /**
- *
+ * close the response and create bumper
  **/
 void
-ChunkerProcessor::reader(string token, int (&cp)[2])
+ChunkerProcessor::process_chunk_end()
 {
-	/* Parent. */
-	/* Close what we don't need. */
-	char buf[_chunk_size+1];
-	bzero(buf,_chunk_size+1);
-	string tmp;
-
-	//  usleep(1000*1000);
-	close(cp[1]);
-	int ct = 0;
-	while ((ct = read(cp[0], &buf, _chunk_size)) > 0) {
-		tmp += string(buf);
-		tmp = process_chunk(tmp, token);
-		bzero(buf,_chunk_size+1);
-	}
-	process_chunk_end(tmp,token);
-	close(cp[0]);
-}
-
-
-/**
- * write out remainder and create bumper
- **/
-void
-ChunkerProcessor::process_chunk_end(string &str, string &token)
-{
-	//OK, let's find a natural break and start processing
-	size_t pos = str.rfind('\n');
-	string chunk;
-	if (pos != string::npos) {
-		chunk = str.substr(0,pos);
-		str = str.substr(pos+1,str.length());
-	} else {
-		chunk = str;
-		str = string("");
-	}
-
-	string file = Rest::CHUNKER_RESP_TOK_DIR + Rest::CHUNKER_RESP_TOK_BASE + token;
-	FILE *fp = fopen(file.c_str(), "a");
-	if (fp) {
-		size_t len = chunk.length();
-		if (fwrite(chunk.c_str(),1,len,fp) < len)
-			syslog(LOG_ERR,"webgui: Error writing out response chunk");
-		fclose(fp);
-	} else {
-		syslog(LOG_ERR,"webgui: Failed to write out response chunk");
-	}
-
+	close_output();
 
 	//if we naturally end write out bumper file to common directory...
-	file = Rest::CHUNKER_RESP_TOK_DIR + Rest::CHUNKER_RESP_TOK_BASE + token + "_end";
-	fp = fopen(file.c_str(), "w");
+	string file = Rest::CHUNKER_RESP_TOK_DIR + Rest::CHUNKER_RESP_TOK_BASE + _token + "_end";
+	FILE *fp = fopen(file.c_str(), "w");
 	if (fp) {
 		size_t endlen = 3;
 		if (fwrite("end", 1, endlen, fp) < endlen)
@@ -282,61 +408,17 @@ ChunkerProcessor::process_chunk_end(string &str, string &token)
 	return;
 }
 
-/**
- *
- **/
-string
-ChunkerProcessor::process_chunk(string &str, string &token)
-{
-
-	//OK, let's find a natural break and start processing
-	string file = Rest::CHUNKER_RESP_TOK_DIR + Rest::CHUNKER_RESP_TOK_BASE + token;
-	FILE *fp = fopen(file.c_str(), "a");
-	if (fp) {
-		size_t len = str.length();
-		if (fwrite(str.c_str(),1,len,fp) < len)
-			syslog(LOG_ERR,"webgui: Failed writing response chunk");
-		fclose(fp);
-	} else {
-		syslog(LOG_ERR,"webgui: Failed to write out response chunk");
-	}
-	return string("");
-}
-
-/**
- *
- **/
-void
-ChunkerProcessor::parse(char *line, char **argv)
-{
-	while (*line != '\0') {       /* if not the end of line ....... */
-		while (*line == ' ' || *line == '\t' || *line == '\n')
-			*line++ = '\0';     /* trim */
-		*argv++ = line;          /* save the argument position     */
-		while (*line != '\0' && *line != ' ' &&
-		        *line != '\t' && *line != '\n')
-			line++;             /* skip the argument until ...    */
-	}
-	*argv = NULL;                 /* mark the end of argument list  */
-}
-
-
 /**
  *
  *below borrowed from quagga library.
  **/
 #define PIDFILE_MASK 0644
 pid_t
-ChunkerProcessor::pid_output (const char *path)
+ChunkerProcessor::pid_output (const char *path, pid_t pid)
 {
 	FILE *fp;
-	pid_t pid;
 	mode_t oldumask;
 
-	//  pid = getpid();
-	//switched to pid group!
-	pid = getpgrp();
-
 	oldumask = umask(0777 & ~PIDFILE_MASK);
 	fp = fopen (path, "w");
 	if (fp != NULL) {
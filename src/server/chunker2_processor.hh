@@ -12,13 +12,33 @@
 #ifndef __CHUNKER_PROCESSOR_HH__
 #define __CHUNKER_PROCESSOR_HH__
 
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
 #include <string>
 #include <vector>
+#include "common.hh"
+#include "chunker2_filter.hh"
 
+/**
+ * Runs a single op mode command. The command's output is read by the
+ * manager's event loop through fd() and service().
+ **/
 class ChunkerProcessor
 {
 public:
-	ChunkerProcessor() {}
+	ChunkerProcessor() :
+		_chunk_size(0),
+		_debug(false),
+		_pid(-1),
+		_fd(-1),
+		_out_fd(-1),
+		_idx_fd(-1),
+		_written(0),
+		_spawn_usec(0),
+		_ndjson(false),
+		_seq(0),
+		_text_offset(0) {}
 
 	void
 	init (unsigned long chunk_size, const std::string &pid_path, bool debug) {
@@ -27,37 +47,84 @@ public:
 		_debug = debug;
 	}
 
+	//applied to the output as it is read, lines split at the chunk size set by init()
+	void
+	set_filter(const OutputFilter &filter) {
+		_filter = filter;
+		_filter.set_max_line(_chunk_size);
+	}
+
+	//store output as NDJSON records instead of plain text
+	void
+	set_ndjson(bool ndjson) {
+		_ndjson = ndjson;
+	}
+
 	bool
 	start_new(std::string token, const std::string &cmd, const std::string &user);
 
-private:
+	//read what the command has produced, false once all output is in
+	bool
+	service();
+
 	void
-	writer(std::string token, const std::string &cmd,int (&cp)[2], std::string user);
+	close_output();
+
+	//read end of the command's stdout/stderr, -1 once closed
+	int
+	fd() const {
+		return _fd;
+	}
+
+	//also the process group of the command
+	pid_t
+	pid() const {
+		return _pid;
+	}
+
+	//time taken to create the command's process
+	unsigned long
+	spawn_usec() const {
+		return _spawn_usec;
+	}
 
+private:
 	void
 	tokenizeOpCmd(std::string &opmodecmd, std::vector<std::string> &opcmdarr);
 
 	void
-	reader(std::string token, int (&cp)[2]);
+	emit(const char *data, size_t len, bool last);
 
-	std::string
-	process_chunk(std::string &str, std::string &token);
+	void
+	frame_ndjson(const char *data, size_t len, bool last, std::string &out);
 
 	void
-	process_chunk_end(std::string &str, std::string &token);
+	write_output(const char *data, size_t len);
 
 	void
-	parse(char *line, char **argv);
+	process_chunk_end();
 
 	pid_t
-	pid_output (const char *path);
+	pid_output (const char *path, pid_t pid);
 
 
 private:
 	unsigned long _chunk_size;
 	std::string _pid_path;
-	unsigned long _kill_timeout;
+	std::string _token;
 	bool _debug;
+	pid_t _pid;
+	int _fd;
+	int _out_fd;
+	int _idx_fd; //line index, offset of the start of each line
+	unsigned long long _written; //bytes in the response file
+	unsigned long _spawn_usec;
+	OutputFilter _filter;
+	std::vector<char> _buf; //_chunk_size, allocated on first read
+	bool _ndjson;
+	unsigned long long _seq; //of the next record
+	unsigned long long _text_offset; //plain text output framed so far
+	std::string _partial_line; //held back from the last record
 };
 
 #endif //__CHUNKER_PROCESSOR_HH__
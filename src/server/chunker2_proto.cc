@@ -0,0 +1,303 @@
+/**
+ * Module: chunker2_proto.cc
+ * Description: message framing between the rest server and the chunker
+ *
+ * Copyright (c) 2019, AT&T Intellectual Property.  All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ **/
+
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <sys/uio.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include "chunker2_proto.hh"
+
+using namespace std;
+
+static void
+put16(char *p, uint16_t v)
+{
+	v = htons(v);
+	memcpy(p, &v, sizeof(v));
+}
+
+static void
+put32(char *p, uint32_t v)
+{
+	v = htonl(v);
+	memcpy(p, &v, sizeof(v));
+}
+
+static uint16_t
+get16(const char *p)
+{
+	uint16_t v;
+	memcpy(&v, p, sizeof(v));
+	return ntohs(v);
+}
+
+static uint32_t
+get32(const char *p)
+{
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return ntohl(v);
+}
+
+/**
+ * \brief Value of a number field, 0 when the field is not a number
+ **/
+uint64_t
+ChunkerField::num() const
+{
+	if (_len != 8) {
+		return 0;
+	}
+	return ((uint64_t)get32(_data) << 32) | get32(_data + 4);
+}
+
+/**
+ * \brief Space for header or number bytes that lives as long as the encoder
+ **/
+char *
+ChunkerEncoder::store(size_t len)
+{
+	_store.push_back(string(len, '\0'));
+	return &_store.back()[0];
+}
+
+/**
+ *
+ **/
+void
+ChunkerEncoder::add(ChunkerProto::FieldTag tag, const string &value)
+{
+	char *hdr = store(ChunkerProto::FIELD_HEADER_SIZE);
+	put16(hdr, tag);
+	put32(hdr + 2, value.size());
+
+	struct iovec iov;
+	iov.iov_base = hdr;
+	iov.iov_len = ChunkerProto::FIELD_HEADER_SIZE;
+	_iov.push_back(iov);
+	if (value.empty() == false) {
+		iov.iov_base = (void*)value.data();
+		iov.iov_len = value.size();
+		_iov.push_back(iov);
+	}
+	_length += ChunkerProto::FIELD_HEADER_SIZE + value.size();
+}
+
+/**
+ *
+ **/
+void
+ChunkerEncoder::add_copy(ChunkerProto::FieldTag tag, const string &value)
+{
+	_store.push_back(value);
+	add(tag, _store.back());
+}
+
+/**
+ *
+ **/
+void
+ChunkerEncoder::add(ChunkerProto::FieldTag tag, uint64_t value)
+{
+	char *hdr = store(ChunkerProto::FIELD_HEADER_SIZE + 8);
+	put16(hdr, tag);
+	put32(hdr + 2, 8);
+	put32(hdr + 6, value >> 32);
+	put32(hdr + 10, value & 0xffffffff);
+
+	struct iovec iov;
+	iov.iov_base = hdr;
+	iov.iov_len = ChunkerProto::FIELD_HEADER_SIZE + 8;
+	_iov.push_back(iov);
+	_length += iov.iov_len;
+}
+
+/**
+ *
+ **/
+void
+ChunkerEncoder::add(ChunkerProto::FieldTag tag, const ChunkerEncoder &record)
+{
+	char *hdr = store(ChunkerProto::FIELD_HEADER_SIZE);
+	put16(hdr, tag);
+	put32(hdr + 2, record._length);
+
+	struct iovec iov;
+	iov.iov_base = hdr;
+	iov.iov_len = ChunkerProto::FIELD_HEADER_SIZE;
+	_iov.push_back(iov);
+	_iov.insert(_iov.end(), record._iov.begin(), record._iov.end());
+	_length += ChunkerProto::FIELD_HEADER_SIZE + record._length;
+}
+
+/**
+ * \brief Write the frame, gathering the referenced values
+ **/
+bool
+ChunkerEncoder::send(int fd)
+{
+	char hdr[ChunkerProto::FRAME_HEADER_SIZE];
+	hdr[0] = ChunkerProto::VERSION;
+	hdr[1] = _type;
+	put16(hdr + 2, 0);
+	put32(hdr + 4, _length);
+
+	vector<struct iovec> iov;
+	iov.reserve(_iov.size() + 1);
+	struct iovec h;
+	h.iov_base = hdr;
+	h.iov_len = sizeof(hdr);
+	iov.push_back(h);
+	iov.insert(iov.end(), _iov.begin(), _iov.end());
+
+	size_t i = 0;
+	while (i < iov.size()) {
+		int cnt = min<size_t>(iov.size() - i, IOV_MAX);
+		ssize_t n = writev(fd, &iov[i], cnt);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return false;
+		}
+		//skip what was written, a partial write leaves us mid iovec
+		while (i < iov.size() && (size_t)n >= iov[i].iov_len) {
+			n -= iov[i].iov_len;
+			++i;
+		}
+		if (n > 0) {
+			iov[i].iov_base = (char*)iov[i].iov_base + n;
+			iov[i].iov_len -= n;
+		}
+	}
+	return true;
+}
+
+/**
+ * \brief Read exactly len bytes
+ **/
+static bool
+read_full(int fd, char *buf, size_t len)
+{
+	size_t got = 0;
+	while (got < len) {
+		ssize_t n = ::read(fd, buf + got, len - got);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			return false;
+		}
+		got += n;
+	}
+	return true;
+}
+
+/**
+ * \brief Read a frame and index its fields
+ **/
+bool
+ChunkerMessage::recv(int fd)
+{
+	char hdr[ChunkerProto::FRAME_HEADER_SIZE];
+	if (read_full(fd, hdr, sizeof(hdr)) == false) {
+		return false;
+	}
+	if ((uint8_t)hdr[0] != ChunkerProto::VERSION) {
+		return false;
+	}
+	_type = hdr[1];
+
+	uint32_t len = get32(hdr + 4);
+	if (len > ChunkerProto::MAX_FRAME_SIZE) {
+		return false;
+	}
+	_buf.resize(len);
+	if (len > 0 && read_full(fd, &_buf[0], len) == false) {
+		return false;
+	}
+	_fields.clear();
+	return parse(len > 0 ? &_buf[0] : NULL, len, _fields);
+}
+
+/**
+ *
+ **/
+bool
+ChunkerMessage::parse(const char *data, size_t len, FieldColl &fields)
+{
+	size_t pos = 0;
+	while (pos < len) {
+		if (len - pos < ChunkerProto::FIELD_HEADER_SIZE) {
+			return false;
+		}
+		ChunkerField field;
+		field._tag = get16(data + pos);
+		field._len = get32(data + pos + 2);
+		pos += ChunkerProto::FIELD_HEADER_SIZE;
+		if (field._len > len - pos) {
+			return false;
+		}
+		field._data = data + pos;
+		pos += field._len;
+		fields.push_back(field);
+	}
+	return true;
+}
+
+/**
+ *
+ **/
+const ChunkerField *
+ChunkerMessage::find(ChunkerProto::FieldTag tag) const
+{
+	FieldIter iter = _fields.begin();
+	while (iter != _fields.end()) {
+		if (iter->_tag == tag) {
+			return &*iter;
+		}
+		++iter;
+	}
+	return NULL;
+}
+
+/**
+ *
+ **/
+string
+ChunkerMessage::get(ChunkerProto::FieldTag tag) const
+{
+	const ChunkerField *field = find(tag);
+	return field ? field->str() : string("");
+}
+
+/**
+ *
+ **/
+uint64_t
+ChunkerMessage::get_num(ChunkerProto::FieldTag tag) const
+{
+	const ChunkerField *field = find(tag);
+	return field ? field->num() : 0;
+}
+
+/**
+ *
+ **/
+bool
+ChunkerMessage::has(ChunkerProto::FieldTag tag) const
+{
+	return find(tag) != NULL;
+}
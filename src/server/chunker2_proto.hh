@@ -0,0 +1,182 @@
+/**
+ * Module: chunker2_proto.hh
+ * Description: message framing between the rest server and the chunker
+ *
+ * Copyright (c) 2019, AT&T Intellectual Property.  All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ **/
+
+#ifndef __CHUNKER_PROTO_HH__
+#define __CHUNKER_PROTO_HH__
+
+#include <stdint.h>
+#include <sys/uio.h>
+#include <string>
+#include <vector>
+#include <deque>
+
+/**
+ * Wire format, all integers in network byte order:
+ *
+ *   frame:  version(1) type(1) reserved(2) length(4) fields[length]
+ *   field:  tag(2) length(4) value[length]
+ *
+ * Numbers are carried as 8 byte values. A record field holds a nested
+ * field list, used for the entries of a process listing. Fields with
+ * unknown tags are skipped, frames of another version are rejected.
+ **/
+class ChunkerProto
+{
+public:
+	static const uint8_t VERSION = 1;
+	static const size_t FRAME_HEADER_SIZE = 8;
+	static const size_t FIELD_HEADER_SIZE = 6;
+	static const uint32_t MAX_FRAME_SIZE = 64 * 1024 * 1024;
+
+	typedef enum {
+		K_COMMAND = 1,
+		K_PROCESS,
+		K_DETAILS,
+		K_NEXT,
+		K_DELETE,
+		K_REPLY
+	} MsgType;
+
+	typedef enum {
+		K_TOKEN = 1,
+		K_STATEMENT,
+		K_USER,
+		K_PRIORITY,
+		K_START_TIME,
+		K_READ_OFFSET,
+		K_OUTPUT,
+		K_STATE,
+		K_POSITION,
+		K_RECORD,
+		K_LIMIT,
+		K_CURSOR,
+		K_MATCH,
+		K_REGEX,
+		K_HEAD,
+		K_TAIL,
+		K_BYTE_START,
+		K_BYTE_END,
+		K_FORMAT
+	} FieldTag;
+};
+
+/**
+ * A field of a received frame, pointing into the frame's buffer.
+ **/
+class ChunkerField
+{
+public:
+	ChunkerField() : _tag(0), _data(NULL), _len(0) {}
+
+	std::string
+	str() const {
+		return std::string(_data, _len);
+	}
+
+	uint64_t
+	num() const;
+
+public:
+	uint16_t _tag;
+	const char *_data;
+	uint32_t _len;
+};
+
+/**
+ * Builds a frame. String values are referenced, not copied, and must
+ * stay unchanged until send() returns.
+ **/
+class ChunkerEncoder
+{
+public:
+	ChunkerEncoder(ChunkerProto::MsgType type) :
+		_type(type),
+		_length(0) {}
+
+	void
+	add(ChunkerProto::FieldTag tag, const std::string &value);
+
+	//for values that do not outlive the encoder
+	void
+	add_copy(ChunkerProto::FieldTag tag, const std::string &value);
+
+	void
+	add(ChunkerProto::FieldTag tag, uint64_t value);
+
+	//nests the fields of record, which must outlive this encoder
+	void
+	add(ChunkerProto::FieldTag tag, const ChunkerEncoder &record);
+
+	bool
+	send(int fd);
+
+private:
+	//the iovecs point into _store
+	ChunkerEncoder(const ChunkerEncoder &);
+	ChunkerEncoder &operator=(const ChunkerEncoder &);
+
+	char *
+	store(size_t len);
+
+private:
+	ChunkerProto::MsgType _type;
+	uint32_t _length; //of the encoded fields
+	std::vector<struct iovec> _iov; //field headers and values, in order
+	std::deque<std::string> _store; //field headers, numbers and copied values
+};
+
+/**
+ * A received frame. The fields are views into the frame's buffer.
+ **/
+class ChunkerMessage
+{
+public:
+	typedef std::vector<ChunkerField> FieldColl;
+	typedef std::vector<ChunkerField>::const_iterator FieldIter;
+
+public:
+	ChunkerMessage() : _type(0) {}
+
+	bool
+	recv(int fd);
+
+	uint8_t
+	type() const {
+		return _type;
+	}
+
+	const FieldColl &
+	fields() const {
+		return _fields;
+	}
+
+	std::string
+	get(ChunkerProto::FieldTag tag) const;
+
+	uint64_t
+	get_num(ChunkerProto::FieldTag tag) const;
+
+	bool
+	has(ChunkerProto::FieldTag tag) const;
+
+	//splits the value of a record field into its fields
+	static bool
+	parse(const char *data, size_t len, FieldColl &fields);
+
+private:
+	const ChunkerField *
+	find(ChunkerProto::FieldTag tag) const;
+
+private:
+	uint8_t _type;
+	std::vector<char> _buf;
+	FieldColl _fields;
+};
+
+#endif //__CHUNKER_PROTO_HH__
@@ -0,0 +1,83 @@
+/**
+ * Module: chunker2_timer.cc
+ * Description: timer wheel used to expire idle background processes
+ *
+ * Copyright (c) 2019, AT&T Intellectual Property.  All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ **/
+
+#include <string>
+#include <vector>
+#include <set>
+#include <map>
+#include "chunker2_timer.hh"
+
+using namespace std;
+
+/**
+ * \brief Set (or move) the deadline of key
+ **/
+void
+TimerWheel::schedule(const string &key, unsigned long deadline)
+{
+	if (deadline <= _current) {
+		deadline = _current + 1;
+	}
+	_deadline_coll[key] = deadline;
+	_slots[deadline % _slots.size()].insert(key);
+}
+
+/**
+ * \brief Forget about key, its slot entry is dropped lazily
+ **/
+void
+TimerWheel::cancel(const string &key)
+{
+	_deadline_coll.erase(key);
+}
+
+/**
+ * \brief Process every slot up to now
+ *
+ * \param now Current time in seconds
+ * \return Keys that have expired, these are no longer scheduled
+ **/
+vector<string>
+TimerWheel::advance(unsigned long now)
+{
+	vector<string> expired;
+	if (_current == 0 || now < _current) {
+		//first call or clock went backwards, start from here
+		_current = now - 1;
+	}
+
+	//after a full turn every slot has been visited
+	unsigned long start = _current + 1;
+	if (now - _current > _slots.size()) {
+		start = now - _slots.size() + 1;
+	}
+
+	for (unsigned long tick = start; tick <= now; ++tick) {
+		set<string> &slot = _slots[tick % _slots.size()];
+		set<string> keep;
+		set<string>::iterator iter = slot.begin();
+		while (iter != slot.end()) {
+			DeadlineIter d = _deadline_coll.find(*iter);
+			if (d == _deadline_coll.end()) {
+				//cancelled
+			} else if (d->second <= now) {
+				expired.push_back(*iter);
+				_deadline_coll.erase(d);
+			} else if (d->second % _slots.size() == tick % _slots.size()) {
+				//due in a later turn of the wheel
+				keep.insert(*iter);
+			}
+			//otherwise rescheduled into another slot
+			++iter;
+		}
+		slot.swap(keep);
+	}
+	_current = now;
+	return expired;
+}
@@ -0,0 +1,50 @@
+/**
+ * Module: chunker2_timer.hh
+ * Description: timer wheel used to expire idle background processes
+ *
+ * Copyright (c) 2019, AT&T Intellectual Property.  All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ **/
+
+#ifndef __CHUNKER_TIMER_HH__
+#define __CHUNKER_TIMER_HH__
+
+#include <string>
+#include <vector>
+#include <set>
+#include <map>
+
+/**
+ * Hashed timer wheel with one second slots. Rescheduling a key only
+ * records its new deadline, stale slot entries are dropped or moved
+ * when their slot comes round.
+ **/
+class TimerWheel
+{
+public:
+	typedef std::map<std::string, unsigned long> DeadlineColl;
+	typedef std::map<std::string, unsigned long>::iterator DeadlineIter;
+
+public:
+	TimerWheel(unsigned long slots = 512) :
+		_slots(slots),
+		_current(0) {}
+
+	void
+	schedule(const std::string &key, unsigned long deadline);
+
+	void
+	cancel(const std::string &key);
+
+	//returns the keys whose deadline is at or before now
+	std::vector<std::string>
+	advance(unsigned long now);
+
+private:
+	std::vector< std::set<std::string> > _slots;
+	DeadlineColl _deadline_coll;
+	unsigned long _current; //last second processed
+};
+
+#endif //__CHUNKER_TIMER_HH__
@@ -12,13 +12,22 @@
 #include <stdlib.h>
 #include <iostream>
 #include <string>
+#include <vector>
 #include <dirent.h>
 #include <string.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <pwd.h>
+#include <grp.h>
 #include <sys/stat.h>
 #include <sys/time.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
 #include <curl/curl.h>
 #include <errno.h>
+#include <syslog.h>
 #include "common.hh"
 #include "debug.h"
 
@@ -57,12 +66,8 @@ const string Rest::CHUNKER_RESP_PID = "/tmp"; //"/opt/vyatta/var/run";
 const string Rest::CHUNKER_SOCKET = "/tmp/browser_pager2";
 const unsigned long Rest::CHUNKER_MAX_WAIT_TIME = 2; //seconds
 const unsigned long Rest::CHUNKER_READ_SIZE = 98304;
-const string Rest::CHUNKER_COMMAND_FORMAT = "<vyatta><command><token>%s</token><statement>%s</statement><user>%s</user></command></vyatta>\0\0";
-const string Rest::CHUNKER_PROCESS_FORMAT = "<vyatta><process><token>%s</token><user>%s</user></process></vyatta>\0\0";
-const string Rest::CHUNKER_DETAILS_FORMAT = "<vyatta><details><token>%s</token><user>%s</user></details></vyatta>\0\0";
-const string Rest::CHUNKER_NEXT_FORMAT = "<vyatta><next><token>%s</token><user>%s</user></next></vyatta>\0\0";
-const string Rest::CHUNKER_DELETE_FORMAT = "<vyatta><delete><token>%s</token><user>%s</user></delete></vyatta>\0\0";
 const string Rest::VYATTA_MODIFY_FILE = Rest::CONFIG_TMP_DIR + ".vyattamodify_";
+const string Rest::CONF_SESSION_DIR = Rest::CONFIG_TMP_DIR + ".vyattasessions/";
 
 
 const char* Rest::g_type_str[] = {"none", "text", "ipv4", "ipv4net", "ipv6", "ipv6net", "u32", "bool", "macaddr"};
@@ -103,55 +108,6 @@ Rest::ulltostring(unsigned long long in)
 	return ss.str();
 }
 
-/**
- * \brief Execute a command capturing the output
- *
- * \param cmd Command to execute
- * \param stdout Stores command output
- * \param read Flag indicating direction of stream (r or w)
- **/
-int
-Rest::execute(std::string &cmd, std::string &stdout, bool read)
-{
-	int err = 0;
-
-	string dir = "w";
-	if (read == true) {
-		dir = "r";
-	}
-	FILE *f = popen(cmd.c_str(), dir.c_str());
-	if (f) {
-		if (read == true) {
-			fflush(f);
-			char *buf = NULL;
-			size_t len = 0;
-			ssize_t read_len = 0;
-			while ((read_len = getline(&buf, &len, f)) != -1) {
-				stdout += string(buf) + " ";
-			}
-
-			if (buf) {
-				free(buf);
-			}
-		}
-		err = pclose(f);
-		if (WIFEXITED(err)) {
-			err = WEXITSTATUS(err);
-		}
-	}
-	/*
-	char b[10000];
-	sprintf(b,"echo '%s' >> /tmp/apperr0",stdout.c_str());
-	system(b);
-	sprintf(b,"echo %d >> /tmp/apperr0",err);
-	system(b);
-	*/
-
-
-	return err;
-}
-
-
 /**
  * \brief Replace all instances of victim with replacement
  *
@@ -193,6 +149,31 @@ Rest::trim(const std::string &src)
 	return str;
 }
 
+/**
+ * \brief Percent-encode a string without a curl handle
+ *
+ * \param src String to encode
+ **/
+std::string
+Rest::url_escape(const std::string &src)
+{
+	static const char hex[] = "0123456789ABCDEF";
+	string out;
+	out.reserve(src.length());
+	for (string::const_iterator iter = src.begin(); iter != src.end(); ++iter) {
+		unsigned char c = *iter;
+		if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+		    c == '-' || c == '.' || c == '_' || c == '~') {
+			out += c;
+		} else {
+			out += '%';
+			out += hex[c >> 4];
+			out += hex[c & 0x0f];
+		}
+	}
+	return out;
+}
+
 
 
 /**
@@ -314,12 +295,192 @@ Rest::mkdir_p(const char *path)
 }
 
 
+/**
+ * \brief Registry entry name of a session description
+ *
+ * A hash rather than the description itself, which may be longer
+ * than a file name can be. Entries are looked up by name and the
+ * description stored for the session compared.
+ **/
+static string
+conf_session_tag(const string &description)
+{
+	//64 bit FNV-1a, unlike std::hash the same across builds
+	unsigned long long hash = 14695981039346656037ULL;
+	for (string::const_iterator iter = description.begin(); iter != description.end(); ++iter) {
+		hash ^= (unsigned char)*iter;
+		hash *= 1099511628211ULL;
+	}
+	char buf[32];
+	snprintf(buf, sizeof(buf), "tag_%016llx", hash);
+	return string(buf);
+}
+
+/**
+ * \brief Registry directory holding the sessions of user
+ *
+ * CONF_SESSION_DIR/<user>/ has an "id_<id>" and, for sessions with a
+ * description, a "tag_<hash of description>" symlink per session, both
+ * pointing at the id. Listing a user's sessions or resolving a tag
+ * then only touches that user's entries instead of scanning /tmp.
+ *
+ * \param user[in] Session owner
+ * \param create[in] Create the directory if it does not exist
+ * \return string "" if there is no usable directory
+ **/
+string
+Rest::conf_session_dir(const string &user, bool create)
+{
+	if (user.empty() || user.find('/') != string::npos || user[0] == '.') {
+		return string("");
+	}
+	//the shared parent is only made by init_conf_session_dir(), as root
+	string parent = Rest::CONF_SESSION_DIR.substr(0, Rest::CONF_SESSION_DIR.size() - 1);
+	struct stat s;
+	if (lstat(parent.c_str(), &s) != 0 || S_ISDIR(s.st_mode) == false ||
+	    s.st_uid != 0 || (s.st_mode & 01002) != 01002) {
+		syslog(LOG_ERR, "webgui: session registry %s is missing or not a sticky directory owned by root",
+		       parent.c_str());
+		return string("");
+	}
+
+	string dir = parent + "/" + user;
+	if (create && mkdir(dir.c_str(), 0700) != 0 && errno != EEXIST) {
+		syslog(LOG_ERR, "webgui: unable to create %s: %s", dir.c_str(), strerror(errno));
+		return string("");
+	}
+	//only trust a directory the user owns
+	if (lstat(dir.c_str(), &s) != 0) {
+		return string("");
+	}
+	if (S_ISDIR(s.st_mode) == false || s.st_uid != geteuid()) {
+		syslog(LOG_ERR, "webgui: ignoring session registry %s, not owned by uid %u",
+		       dir.c_str(), (unsigned)geteuid());
+		return string("");
+	}
+	return dir + "/";
+}
+
+/**
+ * \brief Create the session registry, called once at startup as root
+ *
+ * Whatever is at CONF_SESSION_DIR and is not a directory owned by root
+ * is moved aside first. Sessions described in /tmp before the registry
+ * existed, i.e. before an upgrade, are then registered to their users.
+ *
+ * \return bool false if the registry is unusable
+ **/
+bool
+Rest::init_conf_session_dir()
+{
+	string parent = Rest::CONF_SESSION_DIR.substr(0, Rest::CONF_SESSION_DIR.size() - 1);
+	struct stat s;
+	if (lstat(parent.c_str(), &s) == 0 && (S_ISDIR(s.st_mode) == false || s.st_uid != 0)) {
+		string aside = parent + ".stale." + Rest::ulltostring(getpid());
+		if (rename(parent.c_str(), aside.c_str()) != 0) {
+			syslog(LOG_ERR, "webgui: unable to move %s aside: %s", parent.c_str(), strerror(errno));
+			return false;
+		}
+		syslog(LOG_WARNING, "webgui: moved %s, not a directory owned by root, to %s",
+		       parent.c_str(), aside.c_str());
+	}
+	if (mkdir(parent.c_str(), 01777) != 0 && errno != EEXIST) {
+		syslog(LOG_ERR, "webgui: unable to create %s: %s", parent.c_str(), strerror(errno));
+		return false;
+	}
+	if (lstat(parent.c_str(), &s) != 0 || S_ISDIR(s.st_mode) == false || s.st_uid != 0) {
+		syslog(LOG_ERR, "webgui: unable to create %s as root", parent.c_str());
+		return false;
+	}
+	//mkdir is subject to umask
+	chmod(parent.c_str(), 01777);
+
+	//register sessions that predate the registry
+	DIR *dp = opendir(Rest::CONFIG_TMP_DIR.c_str());
+	if (dp == NULL) {
+		return true;
+	}
+	string prefix = Rest::VYATTA_MODIFY_FILE.substr(Rest::CONFIG_TMP_DIR.size());
+	struct dirent *dirp;
+	while ((dirp = readdir(dp)) != NULL) {
+		if (strncmp(dirp->d_name, prefix.c_str(), prefix.size()) == 0) {
+			register_conf_modify_file(string(dirp->d_name).substr(prefix.size()));
+		}
+	}
+	closedir(dp);
+	return true;
+}
+
+/**
+ * \brief Add the registry entries of an existing session, as root
+ *
+ * Only the owner of a description file can have it registered, so a
+ * user cannot plant sessions in another user's registry.
+ **/
+void
+Rest::register_conf_modify_file(const string &id)
+{
+	string user, description;
+	struct stat s;
+	string file = Rest::VYATTA_MODIFY_FILE + id;
+	if (lstat(file.c_str(), &s) != 0 || S_ISREG(s.st_mode) == false ||
+	    read_conf_modify_file(id, user, description) == false ||
+	    user.empty() || user.find('/') != string::npos || user[0] == '.') {
+		return;
+	}
+	struct passwd *pw = getpwnam(user.c_str());
+	if (pw == NULL || pw->pw_uid != s.st_uid) {
+		return;
+	}
+
+	string dir = Rest::CONF_SESSION_DIR + user;
+	if (mkdir(dir.c_str(), 0700) == 0) {
+		if (chown(dir.c_str(), pw->pw_uid, pw->pw_gid) != 0) {
+			rmdir(dir.c_str());
+			return;
+		}
+	} else if (errno != EEXIST) {
+		return;
+	}
+	if (lstat(dir.c_str(), &s) != 0 || S_ISDIR(s.st_mode) == false || s.st_uid != pw->pw_uid) {
+		return;
+	}
+
+	string id_link = dir + "/id_" + id;
+	if (symlink(id.c_str(), id_link.c_str()) == 0) {
+		lchown(id_link.c_str(), pw->pw_uid, pw->pw_gid);
+	}
+	if (description.empty() == false) {
+		string tag_link = dir + "/" + conf_session_tag(description);
+		if (symlink(id.c_str(), tag_link.c_str()) == 0) {
+			lchown(tag_link.c_str(), pw->pw_uid, pw->pw_gid);
+		}
+	}
+}
+
+/**
+ * \brief Id a registry entry points at
+ **/
+static bool
+read_conf_session_link(const string &link, string &id)
+{
+	char buf[256];
+	ssize_t len = readlink(link.c_str(), buf, sizeof(buf) - 1);
+	if (len <= 0) {
+		return false;
+	}
+	id = string(buf, len);
+	return true;
+}
+
 /**
  * \brief Create a file containing user assigned description
  *
  * One set of REST commands allows the user to assign a description
  * field to a configuration tree and a tag. This function creates the
- * file containing that description.
+ * file containing that description and registers the session under
+ * its user, and its tag. Tags are unique per user, registering one
+ * that is in use by a live session fails.
  *
  * \param id Config session id (?)
  * \param user User associated with description
@@ -328,9 +489,34 @@ Rest::mkdir_p(const char *path)
 bool
 Rest::create_conf_modify_file(const string &id, const string &user, const string &description)
 {
+	string dir = conf_session_dir(user, true);
+	if (dir.empty()) {
+		return false;
+	}
+
+	string tag_link;
+	if (description.empty() == false) {
+		tag_link = dir + conf_session_tag(description);
+		if (symlink(id.c_str(), tag_link.c_str()) != 0) {
+			//the tag may be left over from a session that is gone
+			string f_id, f_user, f_tag;
+			if (errno != EEXIST || read_conf_session_link(tag_link, f_id) == false ||
+			    read_conf_modify_file(f_id, f_user, f_tag) == true) {
+				return false;
+			}
+			unlink(tag_link.c_str());
+			if (symlink(id.c_str(), tag_link.c_str()) != 0) {
+				return false;
+			}
+		}
+	}
+
 	string file = Rest::VYATTA_MODIFY_FILE + id;
 	FILE *fp = fopen(file.c_str(), "w");
 	if (!fp) {
+		if (tag_link.empty() == false) {
+			unlink(tag_link.c_str());
+		}
 		return false;
 	}
 
@@ -338,9 +524,22 @@ Rest::create_conf_modify_file(const string &id, const string &user, const string
 
 	if (fputs(str.c_str(), fp) == EOF) {
 		fclose(fp);
+		unlink(file.c_str());
+		if (tag_link.empty() == false) {
+			unlink(tag_link.c_str());
+		}
 		return false;
 	}
 	fclose(fp);
+
+	string id_link = dir + "id_" + id;
+	if (symlink(id.c_str(), id_link.c_str()) != 0 && errno != EEXIST) {
+		unlink(file.c_str());
+		if (tag_link.empty() == false) {
+			unlink(tag_link.c_str());
+		}
+		return false;
+	}
 	return true;
 }
 
@@ -361,7 +560,7 @@ Rest::read_conf_modify_file(const string &id, string &user, string &description)
 	}
 
 	char buf[Rest::CHUNKER_READ_SIZE];
-	if (fgets(buf,Rest::CHUNKER_READ_SIZE,fp) > 0) {
+	if (fgets(buf,Rest::CHUNKER_READ_SIZE,fp) != NULL) {
 		string str(buf);
 		size_t pos = str.find("/");
 		if (pos == string::npos) {
@@ -385,30 +584,318 @@ Rest::read_conf_modify_file(const string &id, string &user, string &description)
 bool
 Rest::read_conf_modify_file_from_tag(const std::string &tag, std::string &user, std::string &id)
 {
-	struct dirent *dirp;
-	DIR *dp;
-	if ((dp = opendir(Rest::CONFIG_TMP_DIR.c_str())) == NULL) {
+	if (tag.empty()) {
+		return false;
+	}
+	string dir = conf_session_dir(user, false);
+	if (dir.empty()) {
 		return false;
 	}
 
-	if (dp != NULL) {
-		while ((dirp = readdir(dp)) != NULL) {
-			string conf_file = string(dirp->d_name);
-			if (conf_file.length() < 22) {
-				continue;
-			}
+	string tag_link = dir + conf_session_tag(tag);
+	string f_id;
+	if (read_conf_session_link(tag_link, f_id) == false) {
+		return false;
+	}
+
+	string f_tag, f_user;
+	if (read_conf_modify_file(f_id,f_user,f_tag) == false) {
+		unlink(tag_link.c_str()); //session is gone
+		return false;
+	}
+	if (tag != f_tag || f_user != user) {
+		return false;
+	}
+	id = f_id;
+	return true;
+}
 
-			string f_tag, f_user;
-			string f_id = string(dirp->d_name).substr(14);
-			read_conf_modify_file(f_id,f_user,f_tag);
-			if (f_tag.empty() == false && tag == f_tag && f_user == user) {
-				id = f_id;
-				closedir(dp);
-				return true;
+/**
+ * \brief Remove a session description and its registry entries
+ *
+ * \param id Config session id
+ **/
+void
+Rest::remove_conf_modify_file(const string &id)
+{
+	string user, tag;
+	if (read_conf_modify_file(id, user, tag)) {
+		string dir = conf_session_dir(user, false);
+		if (dir.empty() == false) {
+			string f_id;
+			string tag_link = dir + conf_session_tag(tag);
+			if (tag.empty() == false && read_conf_session_link(tag_link, f_id) && f_id == id) {
+				unlink(tag_link.c_str());
 			}
+			string id_link = dir + "id_" + id;
+			unlink(id_link.c_str());
+		}
+	}
+	string file = Rest::VYATTA_MODIFY_FILE + id;
+	unlink(file.c_str());
+}
+
+/**
+ * \brief Ids of the configuration sessions owned by user
+ *
+ * Entries of sessions whose description file is gone are dropped.
+ *
+ * \param user[in] Session owner
+ * \param ids[out] Session ids
+ * \return bool false if the registry cannot be read
+ **/
+bool
+Rest::list_conf_modify_files(const string &user, std::vector<string> &ids)
+{
+	string dir = conf_session_dir(user, false);
+	if (dir.empty()) {
+		//nothing registered for this user
+		return true;
+	}
+
+	DIR *dp = opendir(dir.c_str());
+	if (dp == NULL) {
+		return false;
+	}
+	struct dirent *dirp;
+	while ((dirp = readdir(dp)) != NULL) {
+		if (strncmp(dirp->d_name, "id_", 3) != 0) {
+			continue;
+		}
+		string id = string(dirp->d_name).substr(3);
+		string f_user, f_tag;
+		if (read_conf_modify_file(id, f_user, f_tag) == false) {
+			string id_link = dir + dirp->d_name;
+			unlink(id_link.c_str());
+			continue;
+		}
+		if (f_user == user) {
+			ids.push_back(id);
 		}
 	}
 	closedir(dp);
+	return true;
+}
+
+/**
+ * Look up everything the child needs to assume the user's identity.
+ **/
+bool
+Credentials::resolve(const string &user)
+{
+	struct passwd *pw = getpwnam(user.c_str());
+	if (pw == NULL) {
+		return false;
+	}
+	_uid = pw->pw_uid;
+	_gid = pw->pw_gid;
+
+	int ngroups = 16;
+	_groups.resize(ngroups);
+	while (getgrouplist(user.c_str(), _gid, &_groups[0], &ngroups) == -1) {
+		if (ngroups <= (int)_groups.size()) {
+			return false;
+		}
+		_groups.resize(ngroups);
+	}
+	_groups.resize(ngroups);
+
+	char buf[32];
+	snprintf(buf, sizeof(buf), "%u", (unsigned int)_uid);
+	_loginuid = buf;
+	return true;
+}
+
+/**
+ * What the child shares with Rest::spawn(). The child runs on its own
+ * stack in our address space until it execs.
+ **/
+struct SpawnState
+{
+	const SpawnArgs *_args;
+	const sigset_t *_mask; //the caller's, restored just before exec
+	int _max_fd; //highest descriptor that may be open, plus one
+	int _err;
+};
+
+/**
+ * Child side of Rest::spawn(). It starts with every signal blocked,
+ * the handlers it inherited are ours and must not run on its stack,
+ * so they are reset before the mask is restored. Only
+ * async-signal-safe calls are made, credentials are changed with
+ * direct system calls, which libc does not broadcast to our threads.
+ **/
+static int
+spawn_child(void *arg)
+{
+	SpawnState *ss = (SpawnState*)arg;
+	const SpawnArgs *sa = ss->_args;
+	const Credentials *cred = sa->_cred;
+	int in = sa->_in;
+
+	//as posix_spawn, ignored signals stay ignored except SIGPIPE,
+	//which commands expect to end them
+	struct sigaction dfl;
+	memset(&dfl, 0, sizeof(dfl));
+	dfl.sa_handler = SIG_DFL;
+	for (int sig = 1; sig < NSIG; ++sig) {
+		struct sigaction cur;
+		if (sigaction(sig, NULL, &cur) != 0 || cur.sa_handler == SIG_DFL) {
+			continue;
+		}
+		if (cur.sa_handler != SIG_IGN || sig == SIGPIPE) {
+			sigaction(sig, &dfl, NULL);
+		}
+	}
+
+	if (sa->_umask >= 0) {
+		umask(sa->_umask);
+	}
+	//own session, so everything the command starts can be killed
+	setsid();
+
+	if (in < 0 && (in = open("/dev/null", O_RDONLY)) < 0) {
+		goto fail;
+	}
+	if (dup2(in, 0) < 0 || dup2(sa->_out, 1) < 0 || dup2(sa->_out, 2) < 0) {
+		goto fail;
+	}
+
+	//nothing else of ours goes to the command, whoever opened it
+#ifdef SYS_close_range
+	if (syscall(SYS_close_range, 3, ~0U, 0) != 0)
+#endif
+	{
+		for (int fd = 3; fd < ss->_max_fd; ++fd) {
+			close(fd);
+		}
+	}
+
+	if (cred != NULL && (geteuid() != cred->_uid || getuid() != cred->_uid)) {
+		int fd = open("/proc/self/loginuid", O_WRONLY | O_NOFOLLOW);
+		if (fd < 0) {
+			goto fail;
+		}
+		ssize_t len = cred->_loginuid.size();
+		if (write(fd, cred->_loginuid.data(), len) != len) {
+			close(fd);
+			goto fail;
+		}
+		close(fd);
+
+		if (syscall(SYS_setgroups, cred->_groups.size(), cred->_groups.data()) != 0 ||
+		    syscall(SYS_setgid, cred->_gid) != 0 ||
+		    syscall(SYS_setuid, cred->_uid) != 0) {
+			goto fail;
+		}
+	}
+
+	//run as the requesting user alone, the real ids may still be root's
+	if (sa->_drop_real_ids &&
+	    (syscall(SYS_setregid, getegid(), getegid()) != 0 ||
+	     syscall(SYS_setreuid, geteuid(), geteuid()) != 0)) {
+		goto fail;
+	}
+
+	sigprocmask(SIG_SETMASK, ss->_mask, NULL);
+	execve(sa->_argv[0], sa->_argv, sa->_envp);
+
+fail:
+	ss->_err = errno;
+	_exit(127);
+}
+
+/**
+ * \brief Start a command
+ *
+ * CLONE_VFORK suspends us until the child has exec'd or failed, so its
+ * stack and arguments stay valid and any failure is known here. All
+ * signals are blocked in this thread across the clone, as posix_spawn
+ * does, the child unblocks them once it has dropped our handlers.
+ *
+ * \param args[in] The command, built by the caller, the child must not allocate
+ * 
+eturn pid_t Process id, also its process group, -1 if it did not start
+ **/
+pid_t
+Rest::spawn(const SpawnArgs &args)
+{
+	static const size_t stack_size = 64 * 1024;
+	char *stack = (char*)malloc(stack_size);
+	if (stack == NULL) {
+		return -1;
+	}
+
+	sigset_t all, old;
+	sigfillset(&all);
+	sigprocmask(SIG_BLOCK, &all, &old);
+
+	SpawnState ss;
+	ss._args = &args;
+	ss._mask = &old;
+	ss._max_fd = (int)sysconf(_SC_OPEN_MAX);
+	ss._err = 0;
+
+	pid_t pid = clone(spawn_child, stack + stack_size, CLONE_VM | CLONE_VFORK | SIGCHLD, &ss);
+	int err = errno;
+	sigprocmask(SIG_SETMASK, &old, NULL);
+	free(stack);
+
+	if (pid < 0) {
+		syslog(LOG_ERR, "webgui: Unable to create process: %d", err);
+		return -1;
+	}
+	if (ss._err != 0) {
+		syslog(LOG_ERR, "webgui: Unable to start %s: %d", args._argv[0], ss._err);
+		waitpid(pid, NULL, 0);
+		return -1;
+	}
+	return pid;
+}
+
+/**
+ * \brief Strip query string from request uri
+ *
+ * REQUEST_URI carries the query string, the mode handlers only want
+ * the path portion.
+ *
+ * \param uri Request uri
+ **/
+std::string
+Rest::strip_query(const std::string &uri)
+{
+	size_t pos = uri.find('?');
+	if (pos == string::npos) {
+		return uri;
+	}
+	return uri.substr(0,pos);
+}
+
+/**
+ * \brief Find the value of key in a query string
+ *
+ * \param query Query string of the form a=1&b=2
+ * \param key Key to look for
+ * \param value Value associated with key (output)
+ * \return bool Whether key was found
+ **/
+bool
+Rest::get_query_param(const std::string &query, const std::string &key, std::string &value)
+{
+	size_t start = 0;
+	while (start < query.length()) {
+		size_t end = query.find('&',start);
+		if (end == string::npos) {
+			end = query.length();
+		}
+		string param = query.substr(start,end-start);
+		size_t pos = param.find('=');
+		if (param.substr(0,pos) == key) {
+			value = (pos == string::npos) ? string("") : param.substr(pos+1);
+			return true;
+		}
+		start = end + 1;
+	}
 	return false;
 }
 
@@ -12,9 +12,11 @@
 #ifndef __COMMON_HH__
 #define __COMMON_HH__
 
+#include <sys/types.h>
 #include <sys/time.h>
 #include <string>
 #include <sstream>
+#include <vector>
 
 typedef void CURL;
 
@@ -29,6 +31,51 @@ private:
 	std::string _id;
 };
 
+/**
+ * Identity a command runs with, resolved before the child is created
+ * so that the child only has to make system calls.
+ **/
+class Credentials
+{
+public:
+	Credentials() : _uid(0), _gid(0) {}
+
+	bool
+	resolve(const std::string &user);
+
+public:
+	uid_t _uid;
+	gid_t _gid;
+	std::vector<gid_t> _groups;
+	std::string _loginuid; //formatted for /proc/self/loginuid
+};
+
+/**
+ * How Rest::spawn() starts a command. Everything is in place before
+ * the child is created.
+ **/
+class SpawnArgs
+{
+public:
+	SpawnArgs() :
+		_argv(NULL),
+		_envp(NULL),
+		_in(-1),
+		_out(-1),
+		_umask(-1),
+		_cred(NULL),
+		_drop_real_ids(false) {}
+
+public:
+	char **_argv; //_argv[0] is the path of the program
+	char **_envp;
+	int _in; //stdin, -1 for /dev/null
+	int _out; //stdout and stderr
+	int _umask; //-1 to keep ours
+	const Credentials *_cred; //assumed if it is not who we are, NULL to keep ours
+	bool _drop_real_ids; //make the real ids the effective ones
+};
+
 class Rest
 {
 public:
@@ -52,6 +99,10 @@ public:
 		HTTP_RESP_VYATTA_SPECIFICATION_VERSION,
 		HTTP_RESP_CACHE_CONTROL,
                 HTTP_RESP_CONTENT_DISPOSITION,
+		HTTP_RESP_NEXT_OFFSET,
+		HTTP_RESP_TOTAL_SIZE,
+		HTTP_RESP_NEXT_LINE,
+		HTTP_RESP_TOTAL_LINES,
 		HTTP_BODY
 	} KEY;
 
@@ -122,14 +173,9 @@ public:
 	const static std::string CHUNKER_SOCKET;
 	const static unsigned long CHUNKER_READ_SIZE;
 	const static unsigned long CHUNKER_MAX_WAIT_TIME;
-	const static std::string CHUNKER_COMMAND_FORMAT;
-	const static std::string CHUNKER_PROCESS_FORMAT;
-	const static std::string CHUNKER_DETAILS_FORMAT;
-	const static std::string CHUNKER_NEXT_FORMAT;
-	const static std::string CHUNKER_UPDATE_FORMAT;
-	const static std::string CHUNKER_DELETE_FORMAT;
 	const static std::string VYATTA_MODIFY_FILE;
 	const static std::string CONFIG_TMP_DIR;
+	const static std::string CONF_SESSION_DIR;
 	const static std::string LOCAL_CHANGES_ONLY;
 	const static std::string LOCAL_CONFIG_DIR;
 
@@ -143,22 +189,21 @@ public:
 	 *
 	 *
 	 **/
-	static int
-	execute(std::string &cmd, std::string &sout, bool read = false);
+	static std::string
+	mass_replace(const std::string &source, const std::string &victim, const std::string &replacement);
 
 	/**
 	 *
 	 *
 	 **/
 	static std::string
-	mass_replace(const std::string &source, const std::string &victim, const std::string &replacement);
+	trim(const std::string &src);
 
 	/**
-	 *
-	 *
+	 * Percent-encode all but unreserved characters, as curl_easy_escape
 	 **/
 	static std::string
-	trim(const std::string &src);
+	url_escape(const std::string &src);
 
 
 	/**
@@ -196,6 +241,55 @@ public:
 	static bool
 	read_conf_modify_file_from_tag(const std::string &tag, std::string &user, std::string &id);
 
+	/**
+	 * Registry directory of user's configuration sessions
+	 **/
+	static std::string
+	conf_session_dir(const std::string &user, bool create);
+
+	/**
+	 * Create the session registry, at startup as root
+	 **/
+	static bool
+	init_conf_session_dir();
+
+	/**
+	 * Add the registry entries of a session made before the registry
+	 **/
+	static void
+	register_conf_modify_file(const std::string &id);
+
+	/**
+	 * Remove a session description and its registry entries
+	 **/
+	static void
+	remove_conf_modify_file(const std::string &id);
+
+	/**
+	 * Ids of the configuration sessions owned by user
+	 **/
+	static bool
+	list_conf_modify_files(const std::string &user, std::vector<std::string> &ids);
+
+
+	/**
+	 * Start a command in its own session, -1 if it could not be exec'd
+	 **/
+	static pid_t
+	spawn(const SpawnArgs &args);
+
+
+	/**
+	 * Strip the query string (if any) from a request uri
+	 **/
+	static std::string
+	strip_query(const std::string &uri);
+
+	/**
+	 * Look up a single key in a url query string
+	 **/
+	static bool
+	get_query_param(const std::string &query, const std::string &key, std::string &value);
 
 	/**
 	 *
@@ -0,0 +1,221 @@
+/**
+ * Module: confdiff.cc
+ * Description: changeset between the running and candidate configuration
+ *
+ * Copyright (c) 2019, AT&T Intellectual Property.  All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ **/
+
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <map>
+#include <set>
+#include <jansson.h>
+
+#include "common.hh"
+#include "confdiff.hh"
+
+using namespace std;
+
+static const char *TAG_KEY = "tagnode";
+
+/**
+ * \brief Tag value of a tag node entry, NULL if obj is not one
+ **/
+static const char *
+tag_value(json_t *obj)
+{
+	if (json_is_object(obj) == false) {
+		return NULL;
+	}
+	json_t *tag = json_object_get(obj, TAG_KEY);
+	if (json_is_string(tag) == false) {
+		return NULL;
+	}
+	return json_string_value(tag);
+}
+
+/**
+ * \brief Identity of an array entry when matching running to candidate
+ **/
+static string
+entry_key(json_t *value)
+{
+	const char *tag = tag_value(value);
+	if (tag != NULL) {
+		return "t:" + string(tag);
+	}
+	char *buf = json_dumps(value, JSON_ENCODE_ANY | JSON_COMPACT | JSON_SORT_KEYS);
+	string key = "v:" + ((buf != NULL) ? string(buf) : string(""));
+	free(buf);
+	return key;
+}
+
+/**
+ * \brief Scalar as it appears in a path, strings without quotes
+ **/
+static string
+scalar_string(json_t *value)
+{
+	if (json_is_string(value)) {
+		return string(json_string_value(value));
+	}
+	char *buf = json_dumps(value, JSON_ENCODE_ANY | JSON_COMPACT);
+	string str = (buf != NULL) ? string(buf) : string("");
+	free(buf);
+	return str;
+}
+
+/**
+ *
+ **/
+ConfigDiff::ConfigDiff() :
+	_added(json_array()),
+	_deleted(json_array()),
+	_changed(json_array())
+{
+}
+
+/**
+ *
+ **/
+ConfigDiff::~ConfigDiff()
+{
+	json_decref(_added);
+	json_decref(_deleted);
+	json_decref(_changed);
+}
+
+/**
+ *
+ **/
+bool
+ConfigDiff::empty() const
+{
+	return json_array_size(_added) == 0 && json_array_size(_deleted) == 0 &&
+		json_array_size(_changed) == 0;
+}
+
+/**
+ *
+ **/
+string
+ConfigDiff::dump() const
+{
+	json_t *out = json_object();
+	json_object_set(out, "added", _added);
+	json_object_set(out, "deleted", _deleted);
+	json_object_set(out, "changed", _changed);
+	char *buf = json_dumps(out, JSON_COMPACT);
+	string str = (buf != NULL) ? string(buf) : string("{}");
+	free(buf);
+	json_decref(out);
+	return str;
+}
+
+/**
+ *
+ **/
+void
+ConfigDiff::add(json_t *coll, const string &path, json_t *value)
+{
+	json_t *entry = json_object();
+	json_object_set_new(entry, "path", json_string(path.c_str()));
+	json_object_set(entry, "value", value);
+	json_array_append_new(coll, entry);
+}
+
+/**
+ * \brief Compare the trees at path
+ *
+ * \param path[in] Path of the trees, "" for the root
+ * \param old_tree[in] Running tree
+ * \param new_tree[in] Candidate tree
+ **/
+void
+ConfigDiff::compare(const string &path, json_t *old_tree, json_t *new_tree)
+{
+	if (old_tree == NULL && new_tree == NULL) {
+		return;
+	}
+	if (old_tree == NULL) {
+		add(_added, path, new_tree);
+		return;
+	}
+	if (new_tree == NULL) {
+		add(_deleted, path, old_tree);
+		return;
+	}
+
+	if (json_is_object(old_tree) && json_is_object(new_tree)) {
+		const char *key;
+		json_t *value;
+		json_object_foreach(old_tree, key, value) {
+			if (strcmp(key, TAG_KEY) == 0) {
+				continue;
+			}
+			compare(path + "/" + key, value, json_object_get(new_tree, key));
+		}
+		json_object_foreach(new_tree, key, value) {
+			if (strcmp(key, TAG_KEY) == 0 || json_object_get(old_tree, key) != NULL) {
+				continue;
+			}
+			add(_added, path + "/" + key, value);
+		}
+		return;
+	}
+
+	if (json_is_array(old_tree) && json_is_array(new_tree)) {
+		compare_array(path, old_tree, new_tree);
+		return;
+	}
+
+	if (json_equal(old_tree, new_tree) == false) {
+		json_t *entry = json_object();
+		json_object_set_new(entry, "path", json_string(path.c_str()));
+		json_object_set(entry, "old", old_tree);
+		json_object_set(entry, "new", new_tree);
+		json_array_append_new(_changed, entry);
+	}
+}
+
+/**
+ * \brief Compare tag node entries by tag value, and leaf-list values as sets
+ **/
+void
+ConfigDiff::compare_array(const string &path, json_t *old_arr, json_t *new_arr)
+{
+	size_t i;
+	json_t *value;
+
+	//entries keyed by tag value, or serialized value for leaf-lists
+	map<string,json_t*> new_coll;
+	json_array_foreach(new_arr, i, value) {
+		new_coll[entry_key(value)] = value;
+	}
+
+	set<string> old_coll;
+	json_array_foreach(old_arr, i, value) {
+		string key = entry_key(value);
+		old_coll.insert(key);
+		map<string,json_t*>::iterator match = new_coll.find(key);
+		const char *tag = tag_value(value);
+		if (tag != NULL) {
+			compare(path + "/" + Rest::url_escape(tag), value,
+				match != new_coll.end() ? match->second : NULL);
+		} else if (match == new_coll.end()) {
+			add(_deleted, path + "/" + Rest::url_escape(scalar_string(value)), value);
+		}
+	}
+
+	json_array_foreach(new_arr, i, value) {
+		if (old_coll.find(entry_key(value)) != old_coll.end()) {
+			continue;
+		}
+		const char *tag = tag_value(value);
+		string name = (tag != NULL) ? string(tag) : scalar_string(value);
+		add(_added, path + "/" + Rest::url_escape(name), value);
+	}
+}
@@ -0,0 +1,61 @@
+/**
+ * Module: confdiff.hh
+ * Description: changeset between the running and candidate configuration
+ *
+ * Copyright (c) 2019, AT&T Intellectual Property.  All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ **/
+
+#ifndef __CONFDIFF_HH__
+#define __CONFDIFF_HH__
+
+#include <string>
+#include <jansson.h>
+
+/**
+ * Compares two configuration trees in configd's JSON encoding and
+ * collects what the second adds, deletes and changes:
+ *
+ *   {"added":[{"path":..,"value":..}],
+ *    "deleted":[{"path":..,"value":..}],
+ *    "changed":[{"path":..,"old":..,"new":..}]}
+ *
+ * Paths are "/" separated with tag values url escaped, as in request
+ * URLs. Tag node entries are matched by their "tagnode" value and
+ * leaf-list values as sets.
+ **/
+class ConfigDiff
+{
+public:
+	ConfigDiff();
+	~ConfigDiff();
+
+	//old_tree and new_tree may be NULL for an absent tree
+	void
+	compare(const std::string &path, json_t *old_tree, json_t *new_tree);
+
+	//serialized changeset
+	std::string
+	dump() const;
+
+	bool
+	empty() const;
+
+private:
+	ConfigDiff(const ConfigDiff &);
+	ConfigDiff &operator=(const ConfigDiff &);
+
+	void
+	compare_array(const std::string &path, json_t *old_arr, json_t *new_arr);
+
+	void
+	add(json_t *coll, const std::string &path, json_t *value);
+
+private:
+	json_t *_added;
+	json_t *_deleted;
+	json_t *_changed;
+};
+
+#endif //__CONFDIFF_HH__
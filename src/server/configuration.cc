@@ -10,7 +10,6 @@
  *
  **/
 
-#include <curl/curl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
@@ -45,24 +44,76 @@
 #include "rl_str_proc.hh"
 #include "common.hh"
 #include "configuration.hh"
+#include "connpool.hh"
+#include "optmplcache.hh"
 #include "debug.h"
 
 using namespace std;
 
-bool Configuration::_enable_cache(false);
-Configuration::CacheColl Configuration::_conf_cache_coll;
-Configuration::CacheColl Configuration::_op_cache_coll;
-
-Configuration::Configuration(bool debug) : _conf_id(""), _debug(debug) {
-	if (configd_open_connection(&_conn) == -1)
-		syslog(LOG_ERR, "webgui: Unable to connect to configuration daemon");
-	if (opd_open(&_opd_conn) == -1)
-		syslog(LOG_ERR, "webgui: Unable to connect to operational daemon");
+Configuration::Configuration(bool debug) : _conf_id(""), _conn(NULL), _opd_conn(NULL), _conn_broken(false),
+	_opd_broken(false), _debug(debug), _rpc_count(0), _cursor_lost(false) {
 }
 
 Configuration::~Configuration() {
-	configd_close_connection(&_conn);
-	opd_close(&_opd_conn);
+	dsyslog(_debug, "Configuration: %lu configd requests, template cache %s", _rpc_count,
+		ConfTemplateCache::instance().stats().c_str());
+	if (_conn != NULL)
+		ConnPool::instance().release(_conn, _conn_broken);
+	if (_opd_conn != NULL)
+		ConnPool::instance().release(_opd_conn, _opd_broken);
+}
+
+/**
+ * \brief Take a pooled configd connection for the current session
+ *
+ * Private member function
+ *
+ * \return bool false if configd is unavailable
+ */
+bool Configuration::connect_configd()
+{
+	if (_conn == NULL)
+		_conn = ConnPool::instance().acquire_configd(_conv_conf_id);
+	return (_conn != NULL);
+}
+
+/**
+ * \brief Take a pooled opd connection
+ *
+ * Private member function
+ *
+ * \return bool false if opd is unavailable
+ */
+bool Configuration::connect_opd()
+{
+	if (_opd_conn == NULL)
+		_opd_conn = ConnPool::instance().acquire_opd();
+	return (_opd_conn != NULL);
+}
+
+/**
+ * \brief Note a failed configd call
+ *
+ * Private member function
+ *
+ * A connection the call left unusable is closed on release rather
+ * than going back to the pool.
+ */
+void Configuration::configd_failed()
+{
+	if (_conn != NULL && ConnPool::failed(_conn->fd))
+		_conn_broken = true;
+}
+
+/**
+ * \brief Note a failed opd call, see configd_failed()
+ *
+ * Private member function
+ */
+void Configuration::opd_failed()
+{
+	if (_opd_conn != NULL && ConnPool::failed(_opd_conn->fd))
+		_opd_broken = true;
 }
 
 /**
@@ -89,7 +140,95 @@ void Configuration::setConfId(const string &conf_id)
 	_conv_conf_id = "0x" + _conf_id;
 	_conv_conf_id =  Rest::ulltostring(strtoull(_conv_conf_id.c_str(), NULL,0));
 	dsyslog(_debug, "Configuration::%s: _conv_conf_id='%s'", __func__, _conv_conf_id.c_str());
-	configd_set_session_id(&_conn, _conv_conf_id.c_str());
+	//the next connect_configd() takes a connection on this session
+	if (_conn != NULL) {
+		ConnPool::instance().release(_conn, _conn_broken);
+		_conn = NULL;
+		_conn_broken = false;
+	}
+}
+
+/**
+ * \brief Describe a cfg mode template node
+ *
+ * Private member function
+ *
+ * Gathers everything get_template_node() and parse_value_and_state()
+ * need from the template, once per path for the life of the object,
+ * and from the process wide template cache where it is known. The
+ * cache is keyed by template path, every value of a tag node shares
+ * the description of its node.tag, only whether the path itself is
+ * valid is asked for each value.
+ *
+ * \param[in] cpath Path to cfg mode template node
+ * \return TemplateDescription _valid false if there is no such node
+ */
+const TemplateDescription &
+Configuration::describe_node(const string &cpath)
+{
+	DescribeIter iter = _describe_coll.find(cpath);
+	if (iter != _describe_coll.end())
+		return iter->second;
+
+	string tmpl_path = cpath;
+	size_t pos = cpath.rfind('/');
+	if (pos != string::npos) {
+		const TemplateDescription &parent = describe_node(cpath.substr(0, pos));
+		if (parent._type == NODE_TYPE_TAG)
+			tmpl_path = parent._tmpl_path + "/node.tag";
+		else
+			tmpl_path = parent._tmpl_path + cpath.substr(pos);
+	}
+
+	TemplateDescription &desc = _describe_coll[cpath];
+	if (ConfTemplateCache::instance().get(tmpl_path, desc)) {
+		if (tmpl_path == cpath)
+			return desc;
+		++_rpc_count;
+		if (configd_tmpl_validate_path(_conn, cpath.c_str(), NULL) == 1)
+			return desc;
+		configd_failed();
+		desc = TemplateDescription();
+		desc._tmpl_path = tmpl_path;
+		return desc;
+	}
+	desc._tmpl_path = tmpl_path;
+
+	++_rpc_count;
+	if (configd_tmpl_validate_path(_conn, cpath.c_str(), NULL) != 1) {
+		configd_failed();
+		return desc;
+	}
+	desc._valid = true;
+
+	++_rpc_count;
+	struct ::map *m = configd_tmpl_get(_conn, cpath.c_str(), NULL);
+	if (m == NULL)
+		configd_failed();
+	if (m) {
+		const char *next = NULL;
+		while ((next = map_next(m, next)))
+			desc._tmpl.push_back(next);
+		map_free(m);
+		desc._has_tmpl = true;
+
+		++_rpc_count;
+		desc._type = configd_node_get_type(_conn, cpath.c_str(), NULL);
+	}
+
+	++_rpc_count;
+	struct ::vector *v = configd_tmpl_get_children(_conn, cpath.c_str(), NULL);
+	if (v == NULL)
+		configd_failed();
+	const char *child = NULL;
+	while ((child = vector_next(v, child)))
+		desc._children.push_back(child);
+	vector_free(v);
+
+	//a description cut short by a broken connection is not kept
+	if (_conn_broken == false)
+		ConfTemplateCache::instance().put(tmpl_path, desc);
+	return desc;
 }
 
 /**
@@ -108,56 +247,21 @@ void Configuration::setConfId(const string &conf_id)
 bool
 Configuration::get_op_template_node(const string &path, TemplateParams &params)
 {
-	size_t pos = 0;
 	struct ::map *m;
-	struct ::vector *v;
 	string cpath(path);
 
 	dsyslog(_debug, "Configuration::%s path='%s'", __func__, path.c_str());
 
-	m = opd_tmpl(&_opd_conn, cpath.c_str(), NULL);
+	if (connect_opd() == false)
+		return false;
+
+	m = opd_tmpl(_opd_conn, cpath.c_str(), NULL);
+	if (m == NULL)
+		opd_failed();
 	if (m) {
 		const char *next = NULL;
 		while ((next = map_next(m, next))) {
-			dsyslog(_debug, "Configuration::%s Processing template", __func__);
-
-			string entry(next), key, value;
-
-			// Split entry into key and value
-			pos = entry.find("=");
-			if (pos == string::npos)
-				continue;
-			key = entry.substr(0, pos);
-			value = entry.substr(pos + 1, entry.length() - pos);
-
-			dsyslog(_debug, "Configuration::%s Processing key='%s', value='%s'",
-				__func__, key.c_str(), value.c_str());
-			if (key == "help") {
-				if (value.find("[REQUIRED]") != string::npos)
-					params._mandatory = true;
-
-				// TODO: need to escape out '<' and '>'
-				value = Rest::mass_replace(value, "\n", "");
-				//need to handle double quotes here
-				value = Rest::mass_replace(value, "\"", "'");
-				params._help = value;
-			} else if (key == "allowed") {
-				const char *str = NULL;
-				params._allowed_cmd = value;
-				cpath += "/";
-				v = opd_allowed(&_opd_conn, cpath.c_str(), NULL);
-				if (!v)
-					dsyslog(_debug, "Configuration::%s Unable to process allowed",
-						__func__);
-				while ((str = vector_next(v, str)))
-					params._enum.insert(str);
-				vector_free(v);
-			} else if (key == "run") {
-				params._action = (value != "");
-			} else {
-				syslog(LOG_DEBUG, "webgui: Ignoring template key %s", key.c_str());
-				continue;
-			}
+			parse_op_template_entry(next, path, params);
 		}
 		map_free(m);
 	}
@@ -165,6 +269,59 @@ Configuration::get_op_template_node(const string &path, TemplateParams &params)
 	return true;
 }
 
+/**
+ * \brief Parse one "key=value" entry of an op mode node template
+ *
+ * \param[in] entry Template entry
+ * \param[in] path Op mode path of the node, used for allowed values
+ * \param[out] params Template parameters
+ **/
+void
+Configuration::parse_op_template_entry(const string &entry, const string &path, TemplateParams &params)
+{
+	dsyslog(_debug, "Configuration::%s Processing template", __func__);
+
+	string key, value;
+
+	// Split entry into key and value
+	size_t pos = entry.find("=");
+	if (pos == string::npos)
+		return;
+	key = entry.substr(0, pos);
+	value = entry.substr(pos + 1, entry.length() - pos);
+
+	dsyslog(_debug, "Configuration::%s Processing key='%s', value='%s'",
+		__func__, key.c_str(), value.c_str());
+	if (key == "help") {
+		if (value.find("[REQUIRED]") != string::npos)
+			params._mandatory = true;
+
+		// TODO: need to escape out '<' and '>'
+		value = Rest::mass_replace(value, "\n", "");
+		//need to handle double quotes here
+		value = Rest::mass_replace(value, "\"", "'");
+		params._help = value;
+	} else if (key == "allowed") {
+		//allowed values are dynamic, always asked for
+		const char *str = NULL;
+		params._allowed_cmd = value;
+		string cpath = path + "/";
+		struct ::vector *v = opd_allowed(_opd_conn, cpath.c_str(), NULL);
+		if (!v) {
+			dsyslog(_debug, "Configuration::%s Unable to process allowed",
+				__func__);
+			opd_failed();
+		}
+		while ((str = vector_next(v, str)))
+			params._enum.insert(str);
+		vector_free(v);
+	} else if (key == "run") {
+		params._action = (value != "");
+	} else {
+		syslog(LOG_DEBUG, "webgui: Ignoring template key %s", key.c_str());
+	}
+}
+
 
 void
 split(const std::string &s, char delim, std::vector<std::string> &elems) {
@@ -190,26 +347,29 @@ Configuration::get_template_node(const string &path, TemplateParams &params)
 {
 	bool found_node_dot_def = false;
 	size_t pos = 0;
-	struct ::map *m;
 	string cpath(path);
 
+	if (connect_configd() == false)
+		return false;
+
 	// check for existence of template
-	if (configd_tmpl_validate_path(&_conn, cpath.c_str(), NULL) != 1)
+	const TemplateDescription &desc = describe_node(cpath);
+	if (desc._valid == false)
 		return false;
 
-	//if (configd_auth_authorized(&_conn, cpath.c_str(), 2, NULL) != 1) 
+	//if (configd_auth_authorized(_conn, cpath.c_str(), 2, NULL) != 1) 
 	//	return false;
 
-	m = configd_tmpl_get(&_conn, cpath.c_str(), NULL);
-	if (m) {
+	if (desc._has_tmpl) {
 		struct ::vector *v;
-		const char *next = NULL;
 		bool is_value = false;
-		while ((next = map_next(m, next))) {
+		bool known_key = false;
+		std::vector<string>::const_iterator iter;
+		for (iter = desc._tmpl.begin(); iter != desc._tmpl.end(); ++iter) {
 			// If we have a non-empty map, we have a template
 			found_node_dot_def = true;
 
-			string entry(next), key, value;
+			string entry(*iter), key, value;
 
 			// Split entry into key and value
 			pos = entry.find("=");
@@ -355,22 +515,23 @@ Configuration::get_template_node(const string &path, TemplateParams &params)
 				syslog(LOG_DEBUG, "webgui: Ignoring template key %s", key.c_str());
 				continue;
 			}
-
-			v = configd_tmpl_get_children(&_conn, cpath.c_str(), NULL);
-			if (vector_count(v) == 0) {
-				//typeless leaf nodes
-				params._end = true;
-			}
-			vector_free(v);
+			known_key = true;
 		}
-		map_free(m);
-		params.node_type = configd_node_get_type(&_conn, cpath.c_str(), NULL);
+		if (known_key && desc._children.empty()) {
+			//typeless leaf nodes
+			params._end = true;
+		}
+		params.node_type = desc._type;
 		if (params.node_type != NODE_TYPE_CONTAINER) {
+			//allowed values are dynamic, always asked for
 			const char *str = NULL;
-			v = configd_tmpl_get_allowed(&_conn, cpath.c_str(), NULL);
-			if (!v)
+			++_rpc_count;
+			v = configd_tmpl_get_allowed(_conn, cpath.c_str(), NULL);
+			if (!v) {
 				dsyslog(_debug, "Configuration::%s Unable to process allowed",
 						__func__);
+				configd_failed();
+			}
 			while ((str = vector_next(v, str))) {
 				string tmp = Rest::mass_replace(string(str), "\\<\\>", "*");
 				params._enum.insert(tmp);
@@ -421,11 +582,42 @@ Configuration::get_operational_node(const string &node_path, TemplateParams &tmp
 	if (cpath[0] == '/')
 		cpath.erase(0, 1);
 
+	if (connect_opd() == false)
+		return false;
+
+	//served from memory when the template tree is cached
+	std::vector<std::string> tmpl, children_coll;
+	bool failed = false;
+	if (OpTemplateCache::instance().get(_opd_conn, cpath, tmpl, children_coll, failed)) {
+		std::vector<std::string>::iterator iter = tmpl.begin();
+		while (iter != tmpl.end()) {
+			parse_op_template_entry(*iter, cpath, tmpl_params);
+			++iter;
+		}
+		if (children_coll.empty()) {
+			//typeless leaf nodes
+			tmpl_params._end = true;
+		}
+		iter = children_coll.begin();
+		while (iter != children_coll.end()) {
+			NodeParams np;
+			np._name = (*iter == "node.tag") ? string("*") : *iter;
+			np._state = NodeParams::k_ACTIVE;
+			tmpl_params._children_coll.push_back(np);
+			++iter;
+		}
+		return true;
+	}
+	if (failed)
+		opd_failed();
+
 	if (get_op_template_node(cpath, tmpl_params) == false) {
 		return false;
 	}
 
-	struct ::vector *children = opd_children(&_opd_conn, cpath.c_str(), NULL);
+	struct ::vector *children = opd_children(_opd_conn, cpath.c_str(), NULL);
+	if (children == NULL)
+		opd_failed();
 	if (vector_count(children) == 0) {
 		//typeless leaf nodes
 		tmpl_params._end = true;
@@ -457,6 +649,24 @@ Configuration::get_operational_node(const string &node_path, TemplateParams &tmp
  **/
 bool
 Configuration::get_configured_node(const string &data_path, const string &conf_id, TemplateParams &tmpl_params)
+{
+	string next;
+	return get_configured_node(data_path, conf_id, tmpl_params, ChildFilter(), next);
+}
+
+/**
+ * \brief Get configuration node and a window of its children
+ * public
+ *
+ * \param data_path Path to node
+ * \param conf_id Configuration id
+ * \param tmpl_params Parsed template parameters (output)
+ * \param filter Children to return
+ * \param next Cursor for the next page, empty on the last (output)
+ **/
+bool
+Configuration::get_configured_node(const string &data_path, const string &conf_id, TemplateParams &tmpl_params,
+				   const ChildFilter &filter, string &next)
 {
 	dsyslog(_debug, "Configuration::%s data_path='%s', conf_id=%s", __func__,
 		data_path.c_str(), conf_id.c_str());
@@ -468,7 +678,9 @@ Configuration::get_configured_node(const string &data_path, const string &conf_i
 	}
 
 	// Populate children in tmpl_params
-	parse_value_and_state(rel_config_path, conf_id, tmpl_params);
+	if (parse_value_and_state(rel_config_path, conf_id, tmpl_params, filter, next) == false) {
+		return false;
+	}
 
 	// Set template disable state and mirror in all children
 	tmpl_params._data._disabled_state = NodeParams::k_ENABLE;
@@ -502,7 +714,8 @@ void Configuration::get_node_params(const string &cpath, NodeParams &node)
 		node._name = cpath;
 	}
 	dsyslog(_debug, "Configuration::%s: Setting node name = %s  path = %s", __func__, node._name.c_str(), cpath.c_str());
-	switch (configd_node_get_status(&_conn, CANDIDATE, cpath.c_str(), NULL)) {
+	++_rpc_count;
+	switch (configd_node_get_status(_conn, CANDIDATE, cpath.c_str(), NULL)) {
 	case NODE_STATUS_DELETED:
 		node._state = NodeParams::k_DELETE;
 		node._is_changed = "true";
@@ -516,7 +729,8 @@ void Configuration::get_node_params(const string &cpath, NodeParams &node)
 		node._is_changed = "true";
 		break;
 	case NODE_STATUS_UNCHANGED:
-		if (configd_node_exists(&_conn, RUNNING, cpath.c_str(), NULL)) {
+		++_rpc_count;
+		if (configd_node_exists(_conn, RUNNING, cpath.c_str(), NULL)) {
 			node._state = NodeParams::k_ACTIVE;
 		} else {
 			node._state = NodeParams::k_NONE;
@@ -524,31 +738,13 @@ void Configuration::get_node_params(const string &cpath, NodeParams &node)
 		node._is_changed = "false";
 		break;
 	default: // error
+		configd_failed();
 		node._state = NodeParams::k_NONE;
 		node._is_changed = "false";
 		break;
 	}
 }
 
-/*
- * \brief Escape special characters, like /
- *
- * \param in[in] string to be escaped 
- * \return string escaped string
- */
-string
-url_escape(string in) {
-	string out = "";
-	CURL *c = curl_easy_init();
-	char *rets = curl_easy_escape(c, in.c_str(), in.length());
-	if (rets != NULL) { 
-		out = string(rets);
-	}
-	curl_free(rets);
-	curl_easy_cleanup(c);
-	return out;
-}
-
 /**
  * \brief Parse configuration node template
  * Private member function
@@ -556,9 +752,13 @@ url_escape(string in) {
  * \param rel_data_path[in] Relative path to ro active configuration
  * \param conf_id[in] Configuration id
  * \param params[in,out] Parsed template parameters
+ * \param filter[in] Children to include
+ * \param next[out] Cursor for the next page of children
+ * \return bool false if the filter's cursor is not a child
  **/
-void
-Configuration::parse_value_and_state(const string &rel_data_path, const string &conf_id, TemplateParams &params)
+bool
+Configuration::parse_value_and_state(const string &rel_data_path, const string &conf_id, TemplateParams &params,
+				     const ChildFilter &filter, string &next)
 {
 	NodeParams np;
 	string cpath(rel_data_path);
@@ -578,45 +778,62 @@ Configuration::parse_value_and_state(const string &rel_data_path, const string &
 	switch (params.node_type) {
 	case NODE_TYPE_LEAF:
 	case NODE_TYPE_MULTI:
-	case NODE_TYPE_TAG:
-		children = configd_node_get(&_conn, RUNNING, cpath.c_str(), NULL);
+	case NODE_TYPE_TAG: {
+		/*
+		 * A value's state follows from which of the two trees it is in:
+		 * running only is deleted, candidate only is added, and both is
+		 * active whether or not something below it changed. Two fetches
+		 * cover every child, rather than a status query per child.
+		 */
+		std::vector<string> candidate_order;
+		std::set<string> candidate_coll;
+		++_rpc_count;
+		children = configd_node_get(_conn, CANDIDATE, cpath.c_str(), NULL);
+		if (children == NULL)
+			configd_failed();
 		for (const char *next = NULL; (next = vector_next(children, next)); ) {
-			child = next;
-			child_cpath.clear();
-			if (!cpath.empty()) {
-				child_cpath = cpath + "/";
-			}
-			child_cpath += url_escape(child);
-
-			get_node_params(child_cpath, np);
-			value_coll.push_back(child);
-			state_coll.insert(pair<string,NodeParams::CONF_STATE>(child, np._state));
+			candidate_order.push_back(next);
+			candidate_coll.insert(next);
 		}
 		vector_free(children);
 
-		children = configd_node_get(&_conn, CANDIDATE, cpath.c_str(), NULL);
+		++_rpc_count;
+		children = configd_node_get(_conn, RUNNING, cpath.c_str(), NULL);
+		if (children == NULL)
+			configd_failed();
 		for (const char *next = NULL; (next = vector_next(children, next)); ) {
 			child = next;
-
-			if (state_coll.find(child) != state_coll.end())
-				continue;
-
-			child_cpath.clear();
-			if (!cpath.empty()) {
-				child_cpath = cpath + "/";
+			NodeParams::CONF_STATE state = NodeParams::k_DELETE;
+			std::set<string>::iterator found = candidate_coll.find(child);
+			if (found != candidate_coll.end()) {
+				state = NodeParams::k_ACTIVE;
+				candidate_coll.erase(found);
 			}
-			child_cpath += url_escape(child);
-
-			get_node_params(child_cpath, np);
 			value_coll.push_back(child);
-			state_coll.insert(pair<string,NodeParams::CONF_STATE>(child, np._state));
+			state_coll.insert(pair<string,NodeParams::CONF_STATE>(child, state));
 		}
 		vector_free(children);
+
+		//candidate only, kept in candidate order
+		std::vector<string>::iterator iter = candidate_order.begin();
+		for (; iter != candidate_order.end(); ++iter) {
+			if (candidate_coll.find(*iter) == candidate_coll.end())
+				continue;
+			value_coll.push_back(*iter);
+			state_coll.insert(pair<string,NodeParams::CONF_STATE>(*iter, NodeParams::k_SET));
+		}
+		if (window_children(value_coll, filter, next) == false)
+			return false;
 		break;
-	case NODE_TYPE_CONTAINER:
-		children = configd_tmpl_get_children(&_conn, cpath.c_str(), NULL);
-		for (const char *next = NULL; (next = vector_next(children, next)); ) {
-			child = next;
+	}
+	case NODE_TYPE_CONTAINER: {
+		//state is asked for per child, so only for those in the window
+		value_coll = describe_node(cpath)._children;
+		if (window_children(value_coll, filter, next) == false)
+			return false;
+		for (std::vector<string>::const_iterator iter = value_coll.begin();
+		     iter != value_coll.end(); ++iter) {
+			child = *iter;
 			child_cpath.clear();
 			if (!cpath.empty()) {
 				child_cpath = cpath + "/";
@@ -624,20 +841,20 @@ Configuration::parse_value_and_state(const string &rel_data_path, const string &
 			child_cpath += child;
 
 			NodeParams::CONF_STATE state = NodeParams::k_NONE;
-			if (configd_node_exists(&_conn, CANDIDATE, child_cpath.c_str(), NULL) == 1)
+			_rpc_count += 2;
+			if (configd_node_exists(_conn, CANDIDATE, child_cpath.c_str(), NULL) == 1)
 				state = NodeParams::k_SET;
 
-			if (configd_node_exists(&_conn, RUNNING, child_cpath.c_str(), NULL) == 1) {
+			if (configd_node_exists(_conn, RUNNING, child_cpath.c_str(), NULL) == 1) {
 				if (state != NodeParams::k_SET)
 					state = NodeParams::k_DELETE;
 				else
 					state = NodeParams::k_ACTIVE;
 			}
-			value_coll.push_back(child);
 			state_coll.insert(pair<string,NodeParams::CONF_STATE>(child, state));
 		}
-		vector_free(children);
 		break;
+	}
 	default: // error
 		dsyslog(_debug, "Configuration::%s: Unable to get node type, '%s'", __func__,
 			cpath.c_str());
@@ -658,5 +875,50 @@ Configuration::parse_value_and_state(const string &rel_data_path, const string &
 		}
 		++i;
 	}
+	return true;
+}
+
+/**
+ * \brief Reduce child names to the window selected by filter
+ * Private member function
+ *
+ * Paging resumes after the cursor. Children are not in name order,
+ * running values come before candidate only ones, so a cursor whose
+ * child has gone since the last page has no place to resume from.
+ *
+ * \param value_coll[in,out] Child names in output order
+ * \param filter[in] Children to keep
+ * \param next[out] Cursor for the next page, empty on the last
+ * \return bool false if the cursor is not a child, see cursor_lost()
+ **/
+bool
+Configuration::window_children(std::vector<string> &value_coll, const ChildFilter &filter, string &next)
+{
+	next.clear();
+
+	std::vector<string> coll;
+	coll.swap(value_coll);
+	std::vector<string>::iterator iter = coll.begin();
+	if (filter._cursor.empty() == false) {
+		iter = find(coll.begin(), coll.end(), filter._cursor);
+		if (iter == coll.end()) {
+			_cursor_lost = true;
+			return false;
+		}
+		++iter;
+	}
+
+	for (; iter != coll.end(); ++iter) {
+		if (iter->compare(0, filter._prefix.length(), filter._prefix) != 0)
+			continue;
+		if (filter._match.empty() == false && iter->find(filter._match) == string::npos)
+			continue;
+		if (filter._limit != 0 && value_coll.size() == filter._limit) {
+			next = value_coll.back();
+			break;
+		}
+		value_coll.push_back(*iter);
+	}
+	return true;
 }
 
@@ -17,6 +17,7 @@
 #include <string>
 #include <vector>
 #include "common.hh"
+#include "conftmplcache.hh"
 
 #include <client/connect.h>
 #include <opd_client.h>
@@ -86,22 +87,42 @@ public:
 	std::vector<NodeParams> _children_coll; ///< contains either values, or switches
 };
 
+/**
+ * Selects a window of a node's children: those starting with _prefix
+ * and containing _match, after _cursor, at most _limit of them.
+ **/
+class ChildFilter
+{
+public:
+	ChildFilter() : _limit(0) {}
+
+	unsigned long _limit; ///< 0 for all
+	std::string _cursor; ///< name of the last child of the previous page
+	std::string _prefix;
+	std::string _match;
+};
+
 /**
  *
  *
  **/
 class Configuration
 {
-public:
-	typedef std::map<std::string,TemplateParams> CacheColl;
-	typedef std::map<std::string,TemplateParams>::iterator CacheIter;
-
 public:
 	Configuration(bool debug = false);
 	~Configuration();
 	bool
 	get_configured_node(const std::string &root_node, const std::string &conf_id, TemplateParams &params);
 
+	//only the children selected by filter, next is the cursor of the next page
+	bool
+	get_configured_node(const std::string &root_node, const std::string &conf_id, TemplateParams &params,
+			    const ChildFilter &filter, std::string &next);
+
+	//get_configured_node() failed because the cursor's child is gone
+	bool
+	cursor_lost() const {return _cursor_lost;}
+
 	bool
 	get_operational_node(const std::string &data_path, TemplateParams &tmpl_params, bool is_admin);
 
@@ -109,30 +130,45 @@ public:
 	get_template_node(const std::string &path, TemplateParams &params);
 
 private:
+	typedef std::map<std::string,TemplateDescription> DescribeColl;
+	typedef std::map<std::string,TemplateDescription>::iterator DescribeIter;
+
+	Configuration(const Configuration &);
+	Configuration &operator=(const Configuration &);
+
+	const TemplateDescription &
+	describe_node(const std::string &cpath);
+
 	bool
 	get_op_template_node(const std::string &path, TemplateParams &params);
+	void
+	parse_op_template_entry(const std::string &entry, const std::string &path, TemplateParams &params);
 	bool
 	is_allowed_node(std::string node);
+	bool connect_configd();
+	bool connect_opd();
+	void configd_failed();
+	void opd_failed();
 	void setConfId(const std::string &conf_id);
 	void getConvConfId(std::string &convconfid);
 	void get_node_params(const std::string &cpath, NodeParams &node);
 
-	void
-	parse_value_and_state(const std::string &rel_data_path, const std::string &conf_id, TemplateParams &params);
+	bool
+	parse_value_and_state(const std::string &rel_data_path, const std::string &conf_id, TemplateParams &params,
+			      const ChildFilter &filter, std::string &next);
+
+	bool
+	window_children(std::vector<std::string> &value_coll, const ChildFilter &filter, std::string &next);
 	std::string _conf_id;
 	std::string _conv_conf_id;
-	struct configd_conn _conn;
-	struct opd_connection _opd_conn;
+	struct configd_conn *_conn; ///< pooled, taken on first use
+	struct opd_connection *_opd_conn;
+	bool _conn_broken; ///< release _conn as broken
+	bool _opd_broken;
 	bool _debug;
-
-private:
-	/*
-	 * If enabled, then don't reperform the directory looks up on the conf side of things if found in cache
-	 *
-	 */
-	static bool _enable_cache;
-	static CacheColl _conf_cache_coll;
-	static CacheColl _op_cache_coll;
+	DescribeColl _describe_coll; ///< per path template descriptions
+	unsigned long _rpc_count; ///< configd requests made, logged when debugging
+	bool _cursor_lost; ///< the filter's cursor was not among the children
 };
 
 
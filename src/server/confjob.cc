@@ -0,0 +1,365 @@
+/**
+ * Module: confjob.cc
+ * Description: commit and save running in the background
+ *
+ * Copyright (c) 2019, AT&T Intellectual Property.  All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ **/
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <dirent.h>
+#include <time.h>
+#include <string>
+#include <jansson.h>
+
+#include <client/connect.h>
+#include <client/transaction.h>
+#include <client/error.h>
+
+#include "common.hh"
+#include "confjob.hh"
+#include "debug.h"
+
+using namespace std;
+
+static const time_t JOB_EXPIRY = 3600; //seconds a finished job is kept
+static const useconds_t JOB_POLL_INTERVAL = 200000; //usecs between reads while waiting
+
+static const char *state_str[] = {"running", "succeeded", "failed"};
+
+/**
+ * \brief Start a commit or save in a detached process
+ *
+ * The job is recorded as running before this returns. The process is
+ * started twice removed, so it is not a child of the rest process and
+ * needs no reaping. The job's lock is taken here and inherited, so it
+ * is held from the moment the job is recorded.
+ *
+ * \param user[in] Owner of the session
+ * \param conf_id[in] Configuration session id as used in urls
+ * \param sid[in] Converted configuration session id
+ * \param action[in] "commit" or "save"
+ * \param debug[in] Debug logging
+ * \return bool false if the job could not be started
+ **/
+bool
+ConfJob::start(const string &user, const string &conf_id, const string &sid,
+	       const string &action, bool debug)
+{
+	expire(user);
+
+	_id = Rest::generate_token();
+	string file = job_file(user, _id, true);
+	if (file.empty()) {
+		return false;
+	}
+	_conf_id = conf_id;
+	_action = action;
+	_state = k_RUNNING;
+	_started = time(NULL);
+
+	string lock_file = file + ".lock";
+	int lock_fd = open(lock_file.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+	if (lock_fd == -1 || flock(lock_fd, LOCK_EX | LOCK_NB) == -1) {
+		syslog(LOG_ERR, "webgui: unable to lock %s: %s", lock_file.c_str(), strerror(errno));
+		if (lock_fd != -1) {
+			close(lock_fd);
+		}
+		return false;
+	}
+	if (store(file) == false) {
+		close(lock_fd);
+		unlink(lock_file.c_str());
+		return false;
+	}
+
+	pid_t pid = fork();
+	if (pid == -1) {
+		syslog(LOG_ERR, "webgui: unable to start %s job: %s", action.c_str(), strerror(errno));
+		close(lock_fd);
+		unlink(file.c_str());
+		unlink(lock_file.c_str());
+		return false;
+	}
+	if (pid == 0) {
+		setsid();
+		pid_t job = fork();
+		if (job == 0) {
+			run(file, sid, lock_fd);
+		}
+		_exit(job == -1 ? 1 : 0);
+	}
+	//the job's copy keeps the lock
+	close(lock_fd);
+
+	int status = 0;
+	while (waitpid(pid, &status, 0) == -1 && errno == EINTR);
+	if (WIFEXITED(status) == false || WEXITSTATUS(status) != 0) {
+		syslog(LOG_ERR, "webgui: unable to start %s job", action.c_str());
+		unlink(file.c_str());
+		unlink(lock_file.c_str());
+		return false;
+	}
+	dsyslog(debug, "ConfJob::%s: %s job %s on session %s", __func__, action.c_str(),
+		_id.c_str(), conf_id.c_str());
+	return true;
+}
+
+/**
+ * \brief Read a job, optionally waiting for it to finish
+ *
+ * \param user[in] Owner of the job
+ * \param id[in] Job id
+ * \param wait[in] Seconds to wait while the job is running, up to MAX_WAIT
+ * \return bool false if there is no such job
+ **/
+bool
+ConfJob::read(const string &user, const string &id, unsigned long wait)
+{
+	string file = job_file(user, id, false);
+	if (file.empty()) {
+		return false;
+	}
+	if (wait > MAX_WAIT) {
+		wait = MAX_WAIT;
+	}
+
+	unsigned long waited = 0; //usecs
+	while (true) {
+		if (load(file) == false) {
+			return false;
+		}
+		if (_state == k_RUNNING && is_alive(file) == false) {
+			//the job may have stored its result just before exiting
+			if (load(file) == false) {
+				return false;
+			}
+			if (_state == k_RUNNING) {
+				_state = k_FAILED;
+				_message = "Job ended without a result";
+			}
+		}
+		if (_state != k_RUNNING || waited >= wait * 1000000) {
+			return true;
+		}
+		usleep(JOB_POLL_INTERVAL);
+		waited += JOB_POLL_INTERVAL;
+	}
+}
+
+/**
+ *
+ **/
+string
+ConfJob::dump() const
+{
+	json_t *obj = json_object();
+	json_object_set_new(obj, "id", json_string(_id.c_str()));
+	json_object_set_new(obj, "session", json_string(_conf_id.c_str()));
+	json_object_set_new(obj, "action", json_string(_action.c_str()));
+	json_object_set_new(obj, "state", json_string(state_str[_state]));
+	json_object_set_new(obj, "started", json_integer(_started));
+	if (_state != k_RUNNING) {
+		json_object_set_new(obj, "finished", json_integer(_finished));
+		json_object_set_new(obj, "message", json_string(_message.c_str()));
+	}
+	char *buf = json_dumps(obj, JSON_COMPACT);
+	string str = (buf != NULL) ? string(buf) : string("{}");
+	free(buf);
+	json_decref(obj);
+	return str;
+}
+
+/**
+ * \brief Run the job, in the detached process
+ *
+ * Never returns.
+ **/
+void
+ConfJob::run(const string &file, const string &sid, int lock_fd)
+{
+	//nothing of the rest process is needed, least of all the fcgi socket
+	closelog();
+	long max_fd = sysconf(_SC_OPEN_MAX);
+	for (long fd = 0; fd < max_fd; ++fd) {
+		if (fd != lock_fd) {
+			close(fd);
+		}
+	}
+	int null_fd = open("/dev/null", O_RDWR);
+	if (null_fd == 0) {
+		dup2(null_fd, 1);
+		dup2(null_fd, 2);
+	}
+	signal(SIGPIPE, SIG_IGN);
+
+	struct configd_conn conn;
+	memset(&conn, 0, sizeof(conn));
+	if (configd_open_connection(&conn) == -1) {
+		_state = k_FAILED;
+		_message = "Unable to connect to configd";
+	} else if (configd_set_session_id(&conn, sid.c_str()) != 0) {
+		_state = k_FAILED;
+		_message = "Unable to set configuration session";
+		configd_close_connection(&conn);
+	} else {
+
+		struct configd_error err;
+		memset(&err, 0, sizeof(err));
+		char *buf;
+		if (_action == "commit") {
+			buf = configd_commit(&conn, "via gui", &err);
+		} else {
+			buf = configd_save(&conn, NULL, &err);
+		}
+		if (buf == NULL) {
+			_state = k_FAILED;
+			_message = (err.text != NULL) ? string(err.text) : string("Configuration error");
+			configd_error_free(&err);
+		} else {
+			_state = k_SUCCEEDED;
+			_message = string(buf);
+			free(buf);
+			if (_message.empty() && _action != "commit") {
+				_message = "Saving configuration ... Done";
+			}
+		}
+		configd_close_connection(&conn);
+	}
+
+	_finished = time(NULL);
+	store(file);
+	unlink((file + ".lock").c_str());
+	_exit(0);
+}
+
+/**
+ *
+ **/
+bool
+ConfJob::load(const string &file)
+{
+	json_error_t error;
+	json_t *obj = json_load_file(file.c_str(), 0, &error);
+	if (obj == NULL) {
+		return false;
+	}
+	const char *str;
+	_id = (str = json_string_value(json_object_get(obj, "id"))) ? str : "";
+	_conf_id = (str = json_string_value(json_object_get(obj, "session"))) ? str : "";
+	_action = (str = json_string_value(json_object_get(obj, "action"))) ? str : "";
+	_message = (str = json_string_value(json_object_get(obj, "message"))) ? str : "";
+	_state = k_FAILED;
+	str = json_string_value(json_object_get(obj, "state"));
+	for (int i = k_RUNNING; str != NULL && i <= k_FAILED; ++i) {
+		if (strcmp(str, state_str[i]) == 0) {
+			_state = State(i);
+		}
+	}
+	_started = json_integer_value(json_object_get(obj, "started"));
+	_finished = json_integer_value(json_object_get(obj, "finished"));
+	json_decref(obj);
+	return true;
+}
+
+/**
+ * \brief Replace the job file, readers never see a partial one
+ **/
+bool
+ConfJob::store(const string &file) const
+{
+	json_t *obj = json_object();
+	json_object_set_new(obj, "id", json_string(_id.c_str()));
+	json_object_set_new(obj, "session", json_string(_conf_id.c_str()));
+	json_object_set_new(obj, "action", json_string(_action.c_str()));
+	json_object_set_new(obj, "state", json_string(state_str[_state]));
+	json_object_set_new(obj, "started", json_integer(_started));
+	json_object_set_new(obj, "finished", json_integer(_finished));
+	json_object_set_new(obj, "message", json_string(_message.c_str()));
+
+	string tmp_file = file + ".tmp";
+	bool ok = json_dump_file(obj, tmp_file.c_str(), JSON_COMPACT) == 0 &&
+		rename(tmp_file.c_str(), file.c_str()) == 0;
+	json_decref(obj);
+	if (ok == false) {
+		syslog(LOG_ERR, "webgui: unable to write %s: %s", file.c_str(), strerror(errno));
+		unlink(tmp_file.c_str());
+	}
+	return ok;
+}
+
+/**
+ * \brief Path of a job file, "" for a bad id or unusable directory
+ **/
+string
+ConfJob::job_file(const string &user, const string &id, bool create)
+{
+	if (id.empty() || id.find_first_not_of("0123456789abcdefABCDEF") != string::npos) {
+		return string("");
+	}
+	string dir = Rest::conf_session_dir(user, create);
+	if (dir.empty()) {
+		return string("");
+	}
+	return dir + "job_" + id;
+}
+
+/**
+ * \brief Whether the process of a job is still running, by its lock
+ **/
+bool
+ConfJob::is_alive(const string &file)
+{
+	int fd = open((file + ".lock").c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd == -1) {
+		return false;
+	}
+	bool alive = (flock(fd, LOCK_SH | LOCK_NB) == -1 && errno == EWOULDBLOCK);
+	close(fd);
+	return alive;
+}
+
+/**
+ * \brief Drop finished jobs of user that are older than JOB_EXPIRY
+ **/
+void
+ConfJob::expire(const string &user)
+{
+	string dir = Rest::conf_session_dir(user, false);
+	if (dir.empty()) {
+		return;
+	}
+	DIR *dp = opendir(dir.c_str());
+	if (dp == NULL) {
+		return;
+	}
+	time_t now = time(NULL);
+	struct dirent *dirp;
+	while ((dirp = readdir(dp)) != NULL) {
+		if (strncmp(dirp->d_name, "job_", 4) != 0 || strchr(dirp->d_name, '.') != NULL) {
+			continue;
+		}
+		string file = dir + dirp->d_name;
+		struct stat s;
+		if (stat(file.c_str(), &s) != 0 || now - s.st_mtime < JOB_EXPIRY) {
+			continue;
+		}
+		ConfJob job;
+		if (job.load(file) == false || job._state != k_RUNNING || is_alive(file) == false) {
+			unlink(file.c_str());
+			unlink((file + ".lock").c_str());
+		}
+	}
+	closedir(dp);
+}
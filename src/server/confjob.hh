@@ -0,0 +1,82 @@
+/**
+ * Module: confjob.hh
+ * Description: commit and save running in the background
+ *
+ * Copyright (c) 2019, AT&T Intellectual Property.  All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ **/
+
+#ifndef __CONFJOB_HH__
+#define __CONFJOB_HH__
+
+#include <time.h>
+#include <string>
+
+/**
+ * A commit or save of a configuration session, run by a detached
+ * process so the request that started it can return at once.
+ *
+ * Jobs are kept as "job_<id>" files in the owner's session registry
+ * directory, so any rest process can report on them. The process
+ * replaces the file with the outcome when configd returns. It holds a
+ * lock on "job_<id>.lock" while it lives, a job still marked running
+ * without the lock held has died.
+ **/
+class ConfJob
+{
+public:
+	typedef enum {
+		k_RUNNING,
+		k_SUCCEEDED,
+		k_FAILED
+	} State;
+
+	ConfJob() : _state(k_RUNNING), _started(0), _finished(0) {}
+
+	//start action ("commit" or "save") on session sid, fills in _id
+	bool
+	start(const std::string &user, const std::string &conf_id, const std::string &sid,
+	      const std::string &action, bool debug);
+
+	//read job id of user, waiting up to wait seconds for it to finish
+	bool
+	read(const std::string &user, const std::string &id, unsigned long wait);
+
+	//{"id":..,"session":..,"action":..,"state":..,"started":..,"finished":..,"message":..}
+	std::string
+	dump() const;
+
+	//kept short, a waiting request holds a FastCGI worker; poll for longer jobs
+	static const unsigned long MAX_WAIT = 5; //seconds
+
+private:
+	bool
+	load(const std::string &file);
+
+	bool
+	store(const std::string &file) const;
+
+	static std::string
+	job_file(const std::string &user, const std::string &id, bool create);
+
+	static void
+	expire(const std::string &user);
+
+	static bool
+	is_alive(const std::string &file);
+
+	void
+	run(const std::string &file, const std::string &sid, int lock_fd);
+
+public:
+	std::string _id;
+	std::string _conf_id; ///< configuration session the job runs in
+	std::string _action;
+	State _state;
+	time_t _started;
+	time_t _finished;
+	std::string _message; ///< configd's output or error
+};
+
+#endif //__CONFJOB_HH__
@@ -20,17 +20,28 @@
 #include <string.h>
 #include <dirent.h>
 #include <curl/curl.h>
+#include <memory>
+#include <vector>
+#include <jansson.h>
 
 #include <client/connect.h>
 #include <client/session.h>
 #include <client/transaction.h>
 #include <client/error.h>
+#include <client/node.h>
 
 #include "rl_str_proc.hh"
 #include "common.hh"
 #include "http.hh"
 #include "mode.hh"
 #include "configuration.hh"
+#include "connpool.hh"
+#include "conftmplcache.hh"
+#include "confsubtree.hh"
+#include "confdiff.hh"
+#include "confjob.hh"
+#include "confshow.hh"
+#include "executor.hh"
 #include "confmode.hh"
 #include "debug.h"
 
@@ -80,6 +91,504 @@ string ConfMode::conv_url(string tmp)
 	curl_free(decode);
 	return tmp;
 }
+
+/**
+ * \brief Send the state of a background commit or save
+ *
+ * With ?wait=N the request is held for up to N seconds, at most
+ * ConfJob::MAX_WAIT, while the job is running. Clients poll for jobs
+ * that take longer.
+ *
+ * \param session[in/out] Request, the body is the job
+ * \param id[in] Configuration session id
+ * \param job_id[in] Job id
+ **/
+void
+ConfMode::get_job(Session &session, const string &id, const string &job_id)
+{
+	unsigned long wait = 0;
+	string tmp;
+	if (Rest::get_query_param(session._request.get(Rest::HTTP_REQ_QUERY_STRING),"wait",tmp)) {
+		char *end = NULL;
+		wait = strtoul(tmp.c_str(),&end,10);
+		if (tmp.empty() || *end != '\0') {
+			ERROR(session,Error::VALIDATION_FAILURE);
+			return;
+		}
+	}
+
+	ConfJob job;
+	if (job.read(session._user, job_id, wait) == false || job._conf_id != id) {
+		ERROR(session,Error::COMMAND_NOT_FOUND);
+		return;
+	}
+	session._response.set(Rest::HTTP_BODY,job.dump());
+}
+
+/**
+ * \brief Show the session's configuration as a JSON tree
+ *
+ * With ?format=json the candidate tree is fetched over configd, with
+ * defaults for show-all, and the node itself returned in "config".
+ * The curly brace text stays with cli-shell-api, configd's tree has no
+ * comments or deactivation marks for it.
+ *
+ * \param session[in/out] Request
+ * \param sid[in] Converted configuration session id
+ * \param action[in] "show[/path]" or "show-all[/path]"
+ * \return bool false for the text format, or if configd could not
+ * provide the tree; the caller runs cli-shell-api then
+ **/
+bool
+ConfMode::show_config(Session &session, const string &sid, const string &action)
+{
+	string format;
+	Rest::get_query_param(session._request.get(Rest::HTTP_REQ_QUERY_STRING),"format",format);
+	if (format != "json") {
+		return false;
+	}
+
+	bool show_all = action.compare(0,8,"show-all") == 0;
+	string rest = action.substr(show_all ? 8 : 4);
+	if (rest.empty() == false && rest[0] != '/') {
+		return false;
+	}
+
+	//path elements, unescaped
+	std::vector<string> path;
+	string tmp, cpath;
+	if (rest.length() > 1 && configd_path(action, tmp, cpath)) {
+		size_t start = 0;
+		while (start <= cpath.length()) {
+			size_t end = cpath.find("/", start);
+			if (end == string::npos) {
+				end = cpath.length();
+			}
+			path.push_back(conv_url(cpath.substr(start, end - start)));
+			start = end + 1;
+		}
+	}
+
+	json_t *tree = NULL;
+	{
+		ConfigdLease conn(sid);
+		if (conn.get() == NULL) {
+			return false;
+		}
+		//the encoding holds the path from the root down to the subtree
+		struct configd_error err;
+		memset(&err, 0, sizeof(err));
+		string root = cpath.empty() ? string("/") : cpath;
+		char *buf = show_all ?
+			configd_tree_get_full_encoding(conn.get(), CANDIDATE, root.c_str(), "json", &err) :
+			configd_tree_get_encoding(conn.get(), CANDIDATE, root.c_str(), "json", &err);
+		if (buf == NULL) {
+			dsyslog(_debug, "ConfMode::%s: no tree for '%s': %s", __func__, root.c_str(),
+				err.text != NULL ? err.text : "");
+			configd_error_free(&err);
+			conn.failed();
+			return false;
+		}
+		tree = json_loads(buf, 0, NULL);
+		free(buf);
+	}
+	if (tree == NULL) {
+		return false;
+	}
+
+	json_t *node = ConfigShow::find(tree, path);
+	string resp;
+	json_t *obj = json_object();
+	json_object_set(obj, "config", node != NULL ? node : json_null());
+	char *buf = json_dumps(obj, JSON_COMPACT);
+	if (buf != NULL) {
+		resp = buf;
+		free(buf);
+	}
+	json_decref(obj);
+	json_decref(tree);
+
+	session._response.set(Rest::HTTP_BODY,resp);
+	session._response._verbatim_body = true;
+	return true;
+}
+
+/**
+ * \brief Split a REST conf path into its action and configd path
+ *
+ * "set/a/'b c'/d%2Fe" becomes "set" and "a/b%20c/d%2Fe". Elements may be
+ * quoted as for cfgcli, quotes are dropped and elements url escaped
+ * again the way configd expects them.
+ *
+ * \param conf_path[in] Url encoded, "/" separated path
+ * \param action[out] First element
+ * \param cpath[out] Remaining elements
+ * \return bool false if there is no path below the action
+ **/
+bool
+ConfMode::configd_path(const string &conf_path, string &action, string &cpath)
+{
+	cpath.clear();
+	size_t pos = conf_path.find("/");
+	if (pos == string::npos || pos == 0) {
+		return false;
+	}
+	action = conf_path.substr(0, pos);
+
+	size_t start = pos + 1;
+	while (start <= conf_path.length()) {
+		size_t end = conf_path.find("/", start);
+		if (end == string::npos) {
+			end = conf_path.length();
+		}
+		string elem = conv_url(conf_path.substr(start, end - start));
+		if (elem.length() >= 2 &&
+		    ((elem[0] == '\'' && elem[elem.length()-1] == '\'') ||
+		     (elem[0] == '"' && elem[elem.length()-1] == '"'))) {
+			elem = elem.substr(1, elem.length()-2);
+		}
+		if (elem.empty() == false) {
+			if (cpath.empty() == false) {
+				cpath += "/";
+			}
+			cpath += Rest::url_escape(elem);
+		}
+		start = end + 1;
+	}
+	return cpath.empty() == false;
+}
+
+/**
+ * \brief Whether configd handles the action itself
+ **/
+bool
+ConfMode::edit_action(const string &action)
+{
+	return action == "set" || action == "delete" || action == "comment";
+}
+
+/**
+ * \brief Apply a set, delete or comment to the session's candidate
+ *
+ * \param conn[in] Connection on the configuration session
+ * \param action[in] "set", "delete" or "comment"
+ * \param cpath[in] Configd path, for comment the last element is the text
+ * \param out[out] Configd's message, the error text on failure
+ * \return bool true on success
+ **/
+bool
+ConfMode::edit_config(struct configd_conn *conn, const string &action, const string &cpath, string &out)
+{
+	struct configd_error err;
+	memset(&err, 0, sizeof(err));
+	char *buf = NULL;
+	if (action == "set") {
+		buf = configd_set(conn, cpath.c_str(), &err);
+	} else if (action == "delete") {
+		buf = configd_delete(conn, cpath.c_str(), &err);
+	} else if (action == "comment") {
+		buf = configd_comment(conn, cpath.c_str(), &err);
+	} else {
+		out = "Invalid command [" + action + "]";
+		return false;
+	}
+	dsyslog(_debug, "ConfMode::%s: %s %s: %s", __func__, action.c_str(), cpath.c_str(),
+		buf != NULL ? "ok" : "failed");
+
+	if (buf == NULL) {
+		out = (err.text != NULL) ? string(err.text) : string("Configuration error");
+		configd_error_free(&err);
+		return false;
+	}
+	out = string(buf);
+	free(buf);
+	return true;
+}
+
+/**
+ * \brief Apply a list of edits to the session in one request
+ *
+ * The body is an array of operations, or an object holding it as
+ * "changes" along with an optional "stop_on_error":
+ *
+ *   {"stop_on_error":true,
+ *    "changes":[{"op":"set","path":"a/b/c"},
+ *               {"op":"delete","path":["a","b","10.0.0.0/8"]}]}
+ *
+ * A path is either url encoded and "/" separated as in a PUT url, or an
+ * array of plain elements. Operations are applied in order on one
+ * connection and each gets a result, "ok", "error" with the message,
+ * or "skipped" after a failure with stop_on_error.
+ *
+ * \param session[in/out] Request
+ * \param sid[in] Converted configuration session id
+ **/
+void
+ConfMode::post_changes(Session &session, const string &sid)
+{
+	string body = session._request.get(Rest::HTTP_BODY);
+	json_error_t error;
+	json_t *root = json_loads(body.c_str(), 0, &error);
+	if (root == NULL) {
+		ERROR(session,Error::VALIDATION_FAILURE,error.text);
+		return;
+	}
+
+	json_t *changes = root;
+	bool stop_on_error = false;
+	if (json_is_object(root)) {
+		changes = json_object_get(root, "changes");
+		stop_on_error = json_is_true(json_object_get(root, "stop_on_error"));
+	}
+	if (json_is_array(changes) == false) {
+		json_decref(root);
+		ERROR(session,Error::VALIDATION_FAILURE,"expected an array of changes");
+		return;
+	}
+
+	ConfigdLease conn(sid);
+	if (conn.get() == NULL) {
+		dsyslog(_debug, "ConfMode::%s: Unable to open connection", __func__);
+		json_decref(root);
+		ERROR(session,Error::SERVER_ERROR);
+		return;
+	}
+
+	json_t *results = json_array();
+	unsigned long applied = 0, failed = 0;
+	size_t i;
+	json_t *change;
+	json_array_foreach(changes, i, change) {
+		json_t *result = json_object();
+		json_array_append_new(results, result);
+		if (stop_on_error && failed > 0) {
+			json_object_set_new(result, "status", json_string("skipped"));
+			continue;
+		}
+
+		const char *op = json_string_value(json_object_get(change, "op"));
+		json_t *path = json_object_get(change, "path");
+		string action, cpath, out;
+		if (op != NULL && json_is_string(path)) {
+			configd_path("changes/" + string(json_string_value(path)), action, cpath);
+			action = op;
+		} else if (op != NULL && json_is_array(path)) {
+			action = op;
+			size_t j;
+			json_t *elem;
+			json_array_foreach(path, j, elem) {
+				const char *str = json_string_value(elem);
+				if (str == NULL) {
+					cpath.clear();
+					break;
+				}
+				cpath += (j > 0 ? "/" : "") + Rest::url_escape(str);
+			}
+		}
+
+		bool ok;
+		if (op == NULL || cpath.empty()) {
+			out = "expected \"op\" and \"path\"";
+			ok = false;
+		} else if (edit_action(action) == false) {
+			out = "Invalid command [" + action + "]";
+			ok = false;
+		} else {
+			ok = edit_config(conn.get(), action, cpath, out);
+			if (ok == false) {
+				conn.failed();
+			}
+		}
+
+		if (ok) {
+			++applied;
+			json_object_set_new(result, "status", json_string("ok"));
+		} else {
+			++failed;
+			json_object_set_new(result, "status", json_string("error"));
+		}
+		if (out.empty() == false) {
+			json_object_set_new(result, "message", json_string(out.c_str()));
+		}
+	}
+	dsyslog(_debug, "ConfMode::%s: %zu changes, %lu applied, %lu failed", __func__,
+		json_array_size(changes), applied, failed);
+	json_decref(root);
+
+	json_t *out = json_object();
+	json_object_set_new(out, "applied", json_integer(applied));
+	json_object_set_new(out, "failed", json_integer(failed));
+	json_object_set_new(out, "results", results);
+	char *buf = json_dumps(out, JSON_COMPACT);
+	if (buf != NULL) {
+		session._response.set(Rest::HTTP_BODY,string(buf));
+		free(buf);
+	}
+	json_decref(out);
+}
+
+/**
+ * \brief Add a conf node, and what subtree holds of its descendants, to json
+ *
+ * \param params[in] Node to add
+ * \param subtree[in] Fetched descendants, or NULL
+ * \param path[in] Path of the node as given in the request
+ * \param json[out] Node object
+ **/
+void
+ConfMode::node_json(TemplateParams &params, ConfSubtree *subtree, const string &path, JSON &json)
+{
+	json.add_value("help",params._help);
+
+	//type
+	string bar = Rest::g_type_str[params._type];
+	json.add_array("type",bar);
+
+	//type
+	bar = Rest::g_type_str[params._type2];
+	if (bar != "none") {
+		json.add_array("type",bar);
+	}
+
+	if (params._default != "\n") {
+		json.add_value("default",params._default);
+	}
+
+
+	string tmp = params._comp_help;
+	tmp = Rest::mass_replace(tmp,"\"","\\\"");
+	tmp = Rest::url_escape(tmp);
+	json.add_value("comp_help", tmp);
+
+	if (params._val_help.empty() == false) {
+		set<string>::iterator iter = params._val_help.begin();
+		while (iter != params._val_help.end()) {
+			string l = *iter;
+			if (l.empty() == false) {
+				//find ;, then find :
+				size_t pos1 = l.find(";");
+				if (pos1 != string::npos) {
+					string val = " ",type;
+					string help = l.substr(pos1+2,l.length()-3);
+					help = Rest::mass_replace(help,"\"","\\\"");
+					help = Rest::mass_replace(help,"\n","");
+					string desc = l.substr(0,pos1);
+					size_t pos2 = desc.find(":");
+					if (pos2 != string::npos) {
+						type = desc.substr(0,pos2);
+						val = desc.substr(pos2+1,desc.length()-2);
+					} else {
+						type = desc;
+					}
+					string tmp = "{\"type\":\""+type+"\",\"vals\":\""+val+"\",\"help\":\""+help+"\"}";
+					json.add_array("val_help",tmp, true);
+				}
+
+			}
+			++iter;
+		}
+	}
+
+	json.add_value("allowed",params._allowed);
+	string foo("true");
+	if (params._multi == true) {
+		json.add_value("multi",foo);
+	}
+	if (params._multi_limit > 0) {
+		char buf[512];
+		sprintf(buf,"%ld",params._multi_limit);
+		string tmp(buf);
+		json.add_value("multi_limit",tmp);
+	}
+	if (params._end == true) {
+		json.add_value("end",foo);
+	}
+	if (params._action == true) {
+		json.add_value("action",foo);
+	}
+	if (params._mandatory == true) {
+		json.add_value("mandatory",foo);
+	}
+	if (params._secret == true) {
+		json.add_value("secret",foo);
+	}
+
+	json.add_value("name",params._data._name);
+	string state = "none";
+	if (params._data._state == NodeParams::k_SET) {
+		state = "set";
+	} else if (params._data._state == NodeParams::k_DELETE) {
+		state = "delete";
+	} else if (params._data._state == NodeParams::k_ACTIVE) {
+		state = "active";
+	}
+	json.add_value("state",state);
+	json.add_value("is_changed", params._data._is_changed);
+
+	string disable_state = "enable";
+	if (params._data._disabled_state == NodeParams::k_DISABLE) {
+		disable_state = "disable";
+	} else if (params._data._disabled_state == NodeParams::k_DISABLE_LOCAL) {
+		disable_state = "disable-local";
+	} else if (params._data._disabled_state == NodeParams::k_ENABLE_LOCAL) {
+		disable_state = "enable-local";
+	}
+	json.add_value("deactivate_state",disable_state);
+
+	std::vector<NodeParams>::iterator ii = params._children_coll.begin();
+	while (ii != params._children_coll.end()) {
+		string state = "none";
+		if (ii->_state == NodeParams::k_SET) {
+			state = "set";
+		} else if (ii->_state == NodeParams::k_ACTIVE) {
+			state = "active";
+		} else if (ii->_state == NodeParams::k_DELETE) {
+			state = "delete";
+		}
+
+		string disable_state = "enable";
+		if (ii->_disabled_state == NodeParams::k_DISABLE) {
+			disable_state = "disable";
+		} else if (ii->_disabled_state == NodeParams::k_DISABLE_LOCAL) {
+			disable_state = "disable-local";
+		} else if (ii->_disabled_state == NodeParams::k_ENABLE_LOCAL) {
+			disable_state = "enable-local";
+		}
+
+		string tmp = "{\"name\":\""+ii->_name+"\",\"state\":\""+state+"\",\"deactivate_state\":\""+disable_state +"\"";
+		if (subtree != NULL) {
+			//nested node when the subtree reached it
+			string child_path = path + "/" + Rest::url_escape(ii->_name);
+			TemplateParams *child = subtree->find(child_path);
+			if (child != NULL) {
+				JSON child_json;
+				node_json(*child, subtree, child_path, child_json);
+				string rep;
+				child_json.serialize(rep);
+				if (rep.empty() == false) {
+					tmp += ",\"node\":" + rep;
+				}
+			}
+		}
+		tmp += "}";
+		json.add_array("children",tmp, true);
+		++ii;
+	}
+
+	set<string>::iterator j = params._enum.begin();
+	while (j != params._enum.end()) {
+		if (j->empty() == false) {
+			if (j->find("\"") != string::npos) {
+				string t = *j;
+				json.add_array("enum",t,true);
+			} else {
+				string t = *j;
+				json.add_array("enum",t,false);
+			}
+		}
+		++j;
+	}
+}
 /**
  * \brief Process an HTTP session
  * \param session Session to process
@@ -156,10 +665,9 @@ ConfMode::process(Session &session)
 		//////////////////////////////////////////////////////////////////////////////////
 		if (path == Rest::CONF_REQ_ROOT) {
 
-			//look at configuration listings on dir, filter by user
-			struct dirent *dirp;
-			DIR *dp;
-			if ((dp = opendir(Rest::CONFIG_TMP_DIR.c_str())) == NULL) {
+			//configuration sessions registered to this user
+			std::vector<string> id_coll;
+			if (Rest::list_conf_modify_files(session._user, id_coll) == false) {
 				ERROR(session,Error::SERVER_ERROR);
 				return;
 			}
@@ -167,62 +675,52 @@ ConfMode::process(Session &session)
 			JSON json_root;
 			string empty(" ");
 			json_root.add_value("message",empty);
-			if (dp != NULL) {
-				while ((dirp = readdir(dp)) != NULL) {
-					string conf_file = string(dirp->d_name);
-					if (conf_file.length() < 22) {
-						continue;
-					}
+			std::vector<string>::iterator iter = id_coll.begin();
+			while (iter != id_coll.end()) {
+				string id = *iter++;
+				struct stat s;
+				string started = "0";
+				string updated = "0";
+				string tmp_path = Rest::VYATTA_MODIFY_FILE + id;
+
+				string conf_user;
+				string description;
+				if (Rest::read_conf_modify_file(id, conf_user, description) == false) {
+					continue;
+				}
 
-					string id = string(dirp->d_name).substr(14);
-					if (strncmp(dirp->d_name,".vyattamodify_",14) == 0) {
-						struct stat s;
-						string started = "0";
-						string updated = "0";
-						string tmp_path = Rest::CONFIG_TMP_DIR + string(dirp->d_name);
-
-						string conf_user;
-						string description;
-						if (Rest::read_conf_modify_file(id, conf_user, description) == false) {
-							continue;
-						}
-
-						if (conf_user != session._user) {
-							continue; //not yours man...
-						}
-
-						if (stat(tmp_path.c_str(), &s) == 0) {
-							time_t t = s.st_mtime;
-							char buf[80];
-							sprintf(buf,"%ld",(unsigned long)t);
-							started = string(buf);
-							t = s.st_ctime;
-							sprintf(buf,"%ld",(unsigned long)t);
-							updated = string(buf);
-						}
-
-						//let's add test for uncommitted changes
-						string convconfid = "0x"+id;
-						convconfid = Rest::ulltostring(strtoull(convconfid.c_str(), NULL,0));
-						string mods = is_configd_sess_changed(convconfid) ? "true" : "false";
-
-						//TODO: NEED TO FILTER ON USER
-						//TODO: FIX json object to handle arrays of hashes
-						string ttmp = "{\"id\":\""+id+"\",";
-						ttmp += "\"username\":\""+session._user+"\",";
-						ttmp += "\"description\":\""+description+"\",";
-						ttmp += "\"started\":\""+started+"\",";
-						ttmp += "\"modified\":\""+mods+"\",";
-						ttmp += "\"updated\":\""+updated+"\"}";
-						json_root.add_array("session",ttmp,true);
-					}
+				if (conf_user != session._user) {
+					continue; //not yours man...
 				}
 
-				string resp;
-				json_root.serialize(resp);
-				session._response.set(Rest::HTTP_BODY,resp);
-				closedir(dp);
+				if (stat(tmp_path.c_str(), &s) == 0) {
+					time_t t = s.st_mtime;
+					char buf[80];
+					sprintf(buf,"%ld",(unsigned long)t);
+					started = string(buf);
+					t = s.st_ctime;
+					sprintf(buf,"%ld",(unsigned long)t);
+					updated = string(buf);
+				}
+
+				//let's add test for uncommitted changes
+				string convconfid = "0x"+id;
+				convconfid = Rest::ulltostring(strtoull(convconfid.c_str(), NULL,0));
+				string mods = is_configd_sess_changed(convconfid) ? "true" : "false";
+
+				//TODO: FIX json object to handle arrays of hashes
+				string ttmp = "{\"id\":\""+id+"\",";
+				ttmp += "\"username\":\""+session._user+"\",";
+				ttmp += "\"description\":\""+description+"\",";
+				ttmp += "\"started\":\""+started+"\",";
+				ttmp += "\"modified\":\""+mods+"\",";
+				ttmp += "\"updated\":\""+updated+"\"}";
+				json_root.add_array("session",ttmp,true);
 			}
+
+			string resp;
+			json_root.serialize(resp);
+			session._response.set(Rest::HTTP_BODY,resp);
 		}
 		//////////////////////////////////////////////////////////////////////////////////
 		//
@@ -247,151 +745,78 @@ ConfMode::process(Session &session)
 				conf_path_url_encoded.erase(0, 1);
 			}
 
-			Configuration conf(_debug);
-			if (conf.get_configured_node(conf_path_url_encoded, id, params) == false) {
-				Error(session,Error::COMMAND_NOT_FOUND);
+			//changes in this session, optionally below a subtree
+			if (pos != string::npos &&
+			    (conf_path_url_encoded == "diff" || conf_path_url_encoded.compare(0, 5, "diff/") == 0)) {
+				get_diff(session, id, conf_path_url_encoded.substr(4));
 				return;
 			}
 
-			JSON json;
-			json.add_value("help",params._help);
-
-			//type
-			string bar = Rest::g_type_str[params._type];
-			json.add_array("type",bar);
-
-			//type
-			bar = Rest::g_type_str[params._type2];
-			if (bar != "none") {
-				json.add_array("type",bar);
-			}
-
-			if (params._default != "\n") {
-				json.add_value("default",params._default);
-			}
-
-
-			string tmp = params._comp_help;
-			tmp = Rest::mass_replace(tmp,"\"","\\\"");
-			char *encode = curl_easy_escape(_curl_handle, tmp.c_str(), tmp.length());
-			tmp = string(encode);
-			curl_free(encode);
-			json.add_value("comp_help", tmp);
-
-			if (params._val_help.empty() == false) {
-				set<string>::iterator iter = params._val_help.begin();
-				while (iter != params._val_help.end()) {
-					string l = *iter;
-					if (l.empty() == false) {
-						//find ;, then find :
-						size_t pos1 = l.find(";");
-						if (pos1 != string::npos) {
-							string val = " ",type;
-							string help = l.substr(pos1+2,l.length()-3);
-							help = Rest::mass_replace(help,"\"","\\\"");
-							help = Rest::mass_replace(help,"\n","");
-							string desc = l.substr(0,pos1);
-							size_t pos2 = desc.find(":");
-							if (pos2 != string::npos) {
-								type = desc.substr(0,pos2);
-								val = desc.substr(pos2+1,desc.length()-2);
-							} else {
-								type = desc;
-							}
-							string tmp = "{\"type\":\""+type+"\",\"vals\":\""+val+"\",\"help\":\""+help+"\"}";
-							json.add_array("val_help",tmp, true);
-						}
-
-					}
-					++iter;
-				}
+			//background commit or save of this session
+			if (pos != string::npos && conf_path_url_encoded.compare(0, 5, "jobs/") == 0) {
+				get_job(session, id, conf_path_url_encoded.substr(5));
+				return;
 			}
 
-			json.add_value("allowed",params._allowed);
-			string foo("true");
-			if (params._multi == true) {
-				json.add_value("multi",foo);
-			}
-			if (params._multi_limit > 0) {
-				char buf[512];
-				sprintf(buf,"%ld",params._multi_limit);
-				string tmp(buf);
-				json.add_value("multi_limit",tmp);
-			}
-			if (params._end == true) {
-				json.add_value("end",foo);
-			}
-			if (params._action == true) {
-				json.add_value("action",foo);
-			}
-			if (params._mandatory == true) {
-				json.add_value("mandatory",foo);
-			}
-                        if (params._secret == true) {
-                                json.add_value("secret",foo);
-                        }
-
-			json.add_value("name",params._data._name);
-			string state = "none";
-			if (params._data._state == NodeParams::k_SET) {
-				state = "set";
-			} else if (params._data._state == NodeParams::k_DELETE) {
-				state = "delete";
-			} else if (params._data._state == NodeParams::k_ACTIVE) {
-				state = "active";
-			}
-			json.add_value("state",state);
-			json.add_value("is_changed", params._data._is_changed);
-
-			string disable_state = "enable";
-			if (params._data._disabled_state == NodeParams::k_DISABLE) {
-				disable_state = "disable";
-			} else if (params._data._disabled_state == NodeParams::k_DISABLE_LOCAL) {
-				disable_state = "disable-local";
-			} else if (params._data._disabled_state == NodeParams::k_ENABLE_LOCAL) {
-				disable_state = "enable-local";
-			}
-			json.add_value("deactivate_state",disable_state);
-
-			std::vector<NodeParams>::iterator ii = params._children_coll.begin();
-			while (ii != params._children_coll.end()) {
-				string state = "none";
-				if (ii->_state == NodeParams::k_SET) {
-					state = "set";
-				} else if (ii->_state == NodeParams::k_ACTIVE) {
-					state = "active";
-				} else if (ii->_state == NodeParams::k_DELETE) {
-					state = "delete";
+			//optional window of the children
+			string query = session._request.get(Rest::HTTP_REQ_QUERY_STRING);
+			ChildFilter filter;
+			string limit;
+			if (Rest::get_query_param(query,"limit",limit)) {
+				char *end = NULL;
+				filter._limit = strtoul(limit.c_str(),&end,10);
+				if (limit.empty() || *end != '\0' || filter._limit == 0) {
+					ERROR(session,Error::VALIDATION_FAILURE);
+					return;
 				}
+			}
+			if (Rest::get_query_param(query,"cursor",filter._cursor)) {
+				filter._cursor = conv_url(filter._cursor);
+			}
+			if (Rest::get_query_param(query,"prefix",filter._prefix)) {
+				filter._prefix = conv_url(filter._prefix);
+			}
+			if (Rest::get_query_param(query,"match",filter._match)) {
+				filter._match = conv_url(filter._match);
+			}
+			unsigned long depth;
+			if (get_depth(query,depth) == false) {
+				ERROR(session,Error::VALIDATION_FAILURE);
+				return;
+			}
 
-				string disable_state = "enable";
-				if (ii->_disabled_state == NodeParams::k_DISABLE) {
-					disable_state = "disable";
-				} else if (ii->_disabled_state == NodeParams::k_DISABLE_LOCAL) {
-					disable_state = "disable-local";
-				} else if (ii->_disabled_state == NodeParams::k_ENABLE_LOCAL) {
-					disable_state = "enable-local";
+			string next;
+			Configuration conf(_debug);
+			if (conf.get_configured_node(conf_path_url_encoded, id, params, filter, next) == false) {
+				if (conf.cursor_lost()) {
+					ERROR(session,Error::VALIDATION_FAILURE,"cursor not found, start from the first page");
+					return;
 				}
-
-				string tmp = "{\"name\":\""+ii->_name+"\",\"state\":\""+state+"\",\"deactivate_state\":\""+disable_state +"\"}";
-				json.add_array("children",tmp, true);
-				++ii;
+				Error(session,Error::COMMAND_NOT_FOUND);
+				return;
 			}
 
-			set<string>::iterator j = params._enum.begin();
-			while (j != params._enum.end()) {
-				if (j->empty() == false) {
-					if (j->find("\"") != string::npos) {
-						string t = *j;
-						json.add_array("enum",t,true);
-					} else {
-						string t = *j;
-						json.add_array("enum",t,false);
-					}
-				}
-				++j;
+			//descendants in the same response
+			std::unique_ptr<ConfSubtree> subtree;
+			if (depth > 0) {
+				subtree.reset(new ConfSubtree(_debug));
+				subtree->fetch(conf_path_url_encoded, id, params, depth);
 			}
 
+			JSON json;
+			node_json(params, subtree.get(), conf_path_url_encoded, json);
+			if (subtree && subtree->truncated()) {
+				string t("true");
+				json.add_value("truncated",t);
+			}
+			if (next.empty() == false) {
+				next = Rest::url_escape(next);
+				json.add_value("next",next);
+			}
+			if (_debug) {
+				string cache_stats = ConfTemplateCache::instance().stats();
+				json.add_value("template_cache",cache_stats);
+			}
 			string resp;
 			json.serialize(resp);
 			session._response.set(Rest::HTTP_BODY,resp);
@@ -432,6 +857,26 @@ ConfMode::process(Session &session)
 
 		string convconfid = "0x"+id;
 		convconfid = Rest::ulltostring(strtoull(convconfid.c_str(), NULL,0));
+
+		//set, delete and comment go straight to configd on the session
+		string action, cpath;
+		if (configd_path(conf_path, action, cpath) && edit_action(action)) {
+			ConfigdLease conn(convconfid);
+			if (conn.get() == NULL) {
+				dsyslog(_debug, "ConfMode::%s: Unable to open connection", __func__);
+				ERROR(session,Error::SERVER_ERROR);
+				return;
+			}
+			string out;
+			if (edit_config(conn.get(), action, cpath, out) == false) {
+				conn.failed();
+				out = Rest::mass_replace(out,"\"","\\\"");
+				out = Rest::mass_replace(out,"\n","\\n");
+				ERROR(session,Error::CONFIGURATION_ERROR,out);
+			}
+			return;
+		}
+
 		string command = ConfMode::_shell_env +
 		                 "export VYATTA_ACTIVE_CONFIGURATION_DIR=/active;"
 		                 + "export VYATTA_CONFIG_TMP=/session/"
@@ -483,10 +928,8 @@ ConfMode::process(Session &session)
 		}
 		command += ";" + cmd + " 2>&1";
 		string stdout;
-
-
-		//NOTE error codes are not currently being returned via the popen call--temp fix until later investigation
-		if (Rest::execute(command,stdout,true) != 0) {
+		Executor exec(_debug);
+		if (exec.run_shell(command,stdout) != 0) {
 			stdout = Rest::mass_replace(stdout,"\"","\\\"");
 			stdout = Rest::mass_replace(stdout,"\n","\\n");
 			ERROR(session,Error::CONFIGURATION_ERROR,stdout);
@@ -559,6 +1002,8 @@ ConfMode::process(Session &session)
 
 			//write the username here to modify file
 			if (Rest::create_conf_modify_file(id,session._user,description) == false) {
+				//nothing could find the session again, don't leave it in configd
+				discard_session(id, true);
 				ERROR(session,Error::SERVER_ERROR);
 				return;
 			}
@@ -593,6 +1038,13 @@ ConfMode::process(Session &session)
 
 			string convconfid = "0x"+id;
 			convconfid = Rest::ulltostring(strtoull(convconfid.c_str(), NULL,0));
+
+			//batch of edits in the request body
+			if (cmd_path == "changes") {
+				post_changes(session, convconfid);
+				return;
+			}
+
 			string command = ConfMode::_shell_env +
 			                 "export VYATTA_ACTIVE_CONFIGURATION_DIR=/active;"
 			                 + "export VYATTA_CONFIG_TMP=/session/"
@@ -610,21 +1062,36 @@ ConfMode::process(Session &session)
 			string action = cmd_path;
 			session.vyatta_debug("CONF:G");
 
-			if ((action == "commit") || (action == "save")) {
+			string async;
+			if (((action == "commit") || (action == "save")) &&
+			    Rest::get_query_param(session._request.get(Rest::HTTP_REQ_QUERY_STRING),"async",async) &&
+			    async != "false" && async != "0") {
+				//leave the commit to a job and answer right away
+				ConfJob job;
+				if (job.start(session._user, id, convconfid, action, _debug) == false) {
+					ERROR(session,Error::SERVER_ERROR);
+					return;
+				}
+				string location = string("rest/conf/") + id + "/jobs/" + job._id;
+				session._response.set(Rest::HTTP_RESP_LOCATION,location);
+				ERROR(session,Error::ACCEPTED);
+				session._response.set(Rest::HTTP_BODY,job.dump());
+				return;
+			} else if ((action == "commit") || (action == "save")) {
 				string stdout = "";
-				struct configd_conn conn;
-				if (configd_open_connection(&conn) == -1) {
+				ConfigdLease conn(convconfid);
+				if (conn.get() == NULL) {
 					dsyslog(_debug, "ConfMode::%s: Unable to open connection", __func__);
 					return;
 				}
-				configd_set_session_id(&conn, convconfid.c_str());
 				struct configd_error err;
 				char * buf;
 				if (action == "commit")
-					buf = configd_commit(&conn, "via gui", &err);
+					buf = configd_commit(conn.get(), "via gui", &err);
 				else
-					buf = configd_save(&conn, NULL, &err);
+					buf = configd_save(conn.get(), NULL, &err);
 				if (buf == NULL) {
+					conn.failed();
 					if (err.text != NULL) {
 						buf = err.text;	
 					}
@@ -645,7 +1112,6 @@ ConfMode::process(Session &session)
 				string resp;
 				json.serialize(resp);
 				session._response.set(Rest::HTTP_BODY,resp);
-				configd_close_connection(&conn);
 				return;
 			} else if (action == "discard") {
 				discard_session(id,false);
@@ -674,6 +1140,8 @@ ConfMode::process(Session &session)
 					tmp += string(" '") + tmp2 + "'";
 					tmp = conv_url(tmp);
 				}
+			} else if (action.compare(0,4,"show") == 0 && show_config(session, convconfid, action)) {
+				return;
 			} else if (action.length() > 7 && action.substr(0,8) == "show-all") {
 				if (action.length() == 8) {
 					tmp = "/bin/cli-shell-api showConfig --show-show-defaults";
@@ -699,8 +1167,9 @@ ConfMode::process(Session &session)
 			command += ";" + tmp;
 			command += " 2>&1";
 
-			string stdout = " ";
-			if (Rest::execute(command,stdout,true) != 0) {
+			string stdout;
+			Executor exec(_debug);
+			if (exec.run_shell(command,stdout) != 0) {
 				if (_debug) {
 					JSON json;
 					json.add_value("cmd",command);
@@ -746,19 +1215,19 @@ ConfMode::process(Session &session)
  **/
 bool ConfMode::setup_session(const string &sid)
 {
-	struct configd_conn conn;
+	ConfigdLease conn(sid);
 	bool result;
 
-	if (configd_open_connection(&conn) == -1) {
+	if (conn.get() == NULL) {
 		dsyslog(_debug, "ConfMode::%s: Unable to open connection", __func__);
 		return false;
 	}
 
-	configd_set_session_id(&conn, sid.c_str());
-	result = (configd_sess_setup(&conn, NULL) != -1);
+	result = (configd_sess_setup(conn.get(), NULL) != -1);
+	if (result == false) {
+		conn.failed();
+	}
 	dsyslog(_debug, "ConfMode::%s: result = %d", __func__, result);
-
-	configd_close_connection(&conn);
 	return result;
 }
 
@@ -778,24 +1247,112 @@ ConfMode::discard_session(string &id, bool exit_session)
 	string convconfid = "0x"+id;
 	convconfid = Rest::ulltostring(strtoull(convconfid.c_str(), NULL,0));
 
-	struct configd_conn conn;
-	if (configd_open_connection(&conn) == -1) {
-		dsyslog(_debug, "ConfMode::%s: Unable to open connection", __func__);
-		return;
-	}
-
 	dsyslog(_debug, "ConfMode::%s: Setting session id = %s", __func__, convconfid.c_str());
-	configd_set_session_id(&conn, convconfid.c_str());
-	configd_discard(&conn, NULL);
-	if (exit_session)
-		configd_sess_teardown(&conn, NULL);
-	configd_close_connection(&conn);
+	{
+		ConfigdLease conn(convconfid);
+		if (conn.get() == NULL) {
+			dsyslog(_debug, "ConfMode::%s: Unable to open connection", __func__);
+			return;
+		}
+		configd_discard(conn.get(), NULL);
+		if (exit_session && configd_sess_teardown(conn.get(), NULL) == -1) {
+			conn.failed();
+		}
+	}
 
-	string mod_file = Rest::VYATTA_MODIFY_FILE + id;
 	if (exit_session == true) {
-		unlink(mod_file.c_str());
+		Rest::remove_conf_modify_file(id);
+	}
+
+}
+
+
+/**
+ * \brief Send the changes between running and candidate
+ *
+ * Both trees are fetched once in configd's JSON encoding and compared
+ * here, rather than walking the nodes and asking for their state.
+ *
+ * \param session[in/out] Request, the body is the changeset
+ * \param id[in] Configuration session id
+ * \param subtree[in] "/" separated path to limit the diff to, "" for all
+ **/
+void
+ConfMode::get_diff(Session &session, const string &id, const string &subtree)
+{
+	string convconfid = "0x"+id;
+	convconfid = Rest::ulltostring(strtoull(convconfid.c_str(), NULL,0));
+
+	string cpath = subtree;
+	while (cpath.empty() == false && cpath[cpath.length()-1] == '/') {
+		cpath.erase(cpath.length()-1);
+	}
+	if (cpath.empty()) {
+		cpath = "/";
+	}
+
+	json_t *running = NULL;
+	json_t *candidate = NULL;
+	bool failed = false;
+	{
+		ConfigdLease conn(convconfid);
+		if (conn.get() == NULL) {
+			dsyslog(_debug, "ConfMode::%s: Unable to open connection", __func__);
+			ERROR(session,Error::SERVER_ERROR);
+			return;
+		}
+		//an absent subtree comes back as NULL, which is an empty tree
+		//here; NULL for a path that exists is a configd failure
+		int dbs[] = {RUNNING, CANDIDATE};
+		json_t **trees[] = {&running, &candidate};
+		for (int i = 0; i < 2 && failed == false; ++i) {
+			struct configd_error err;
+			memset(&err, 0, sizeof(err));
+			char *buf = configd_tree_get_encoding(conn.get(), dbs[i], cpath.c_str(), "json", &err);
+			if (buf != NULL) {
+				*trees[i] = json_loads(buf, 0, NULL);
+				free(buf);
+				failed = (*trees[i] == NULL);
+				continue;
+			}
+			dsyslog(_debug, "ConfMode::%s: no tree for '%s': %s", __func__, cpath.c_str(),
+				err.text != NULL ? err.text : "");
+			configd_error_free(&err);
+			if (cpath == "/" || configd_node_exists(conn.get(), dbs[i], cpath.c_str(), NULL) != 0) {
+				conn.failed();
+				failed = true;
+			}
+		}
+	}
+
+	if (failed) {
+		if (running != NULL) {
+			json_decref(running);
+		}
+		if (candidate != NULL) {
+			json_decref(candidate);
+		}
+		ERROR(session,Error::SERVER_ERROR);
+		return;
+	}
+	if (running == NULL && candidate == NULL) {
+		ERROR(session,Error::COMMAND_NOT_FOUND);
+		return;
+	}
+
+	//configd encodes the path down to the subtree, so paths are absolute
+	ConfigDiff diff;
+	diff.compare("", running, candidate);
+	if (running != NULL) {
+		json_decref(running);
+	}
+	if (candidate != NULL) {
+		json_decref(candidate);
 	}
+	dsyslog(_debug, "ConfMode::%s: subtree='%s' changed=%d", __func__, cpath.c_str(),
+		diff.empty() == false);
 
+	session._response.set(Rest::HTTP_BODY,diff.dump());
 }
 
 
@@ -807,17 +1364,16 @@ ConfMode::discard_session(string &id, bool exit_session)
  **/
 bool ConfMode::is_configd_sess_changed(const string &sid)
 {
-	struct configd_conn conn;
-	bool result;
+	ConfigdLease conn(sid);
 
-	if (configd_open_connection(&conn) == -1) {
+	if (conn.get() == NULL) {
 		dsyslog(_debug, "ConfMode::%s: Unable to open connection", __func__);
 		return false;
 	}
 
-	configd_set_session_id(&conn, sid.c_str());
-	result = (configd_sess_changed(&conn, NULL) == 1);
-
-	configd_close_connection(&conn);
-	return result;
+	int changed = configd_sess_changed(conn.get(), NULL);
+	if (changed == -1) {
+		conn.failed();
+	}
+	return (changed == 1);
 }
@@ -17,6 +17,9 @@
 #include "mode.hh"
 
 typedef void CURL;
+class TemplateParams;
+class ConfSubtree;
+struct configd_conn;
 
 class ConfMode : protected Mode
 {
@@ -33,6 +36,23 @@ private:
 	discard_session(std::string &id, bool exit_session);
 	bool is_configd_sess_changed(const std::string &sid);
 	std::string conv_url(std::string);
+	void
+	node_json(TemplateParams &params, ConfSubtree *subtree, const std::string &path, JSON &json);
+	void
+	get_diff(Session &session, const std::string &id, const std::string &subtree);
+	bool
+	configd_path(const std::string &conf_path, std::string &action, std::string &cpath);
+	static bool
+	edit_action(const std::string &action);
+	bool
+	edit_config(struct configd_conn *conn, const std::string &action, const std::string &cpath,
+		    std::string &out);
+	void
+	post_changes(Session &session, const std::string &sid);
+	void
+	get_job(Session &session, const std::string &id, const std::string &job_id);
+	bool
+	show_config(Session &session, const std::string &sid, const std::string &action);
 
 private: //variables
 	CURL *_curl_handle;
@@ -0,0 +1,65 @@
+/**
+ * Module: confshow.cc
+ * Description: find nodes in configd's JSON configuration trees
+ *
+ * Copyright (c) 2019, AT&T Intellectual Property.  All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ **/
+
+#include <string>
+#include <vector>
+#include <jansson.h>
+
+#include "confshow.hh"
+
+using namespace std;
+
+static const char *TAG_KEY = "tagnode";
+
+/**
+ * \brief Tag value of a tag node entry, NULL if obj is not one
+ **/
+static const char *
+tag_value(json_t *obj)
+{
+	if (json_is_object(obj) == false) {
+		return NULL;
+	}
+	return json_string_value(json_object_get(obj, TAG_KEY));
+}
+
+/**
+ * \brief Walk down tree along path, matching tag entries by tag value
+ *
+ * \param tree[in] Tree from the root of the configuration
+ * \param path[in] Unescaped path elements
+ * \return json_t* Borrowed node, NULL if path is not in tree
+ **/
+json_t *
+ConfigShow::find(json_t *tree, const std::vector<string> &path)
+{
+	json_t *node = tree;
+	std::vector<string>::const_iterator iter = path.begin();
+	while (node != NULL && iter != path.end()) {
+		if (json_is_object(node)) {
+			node = json_object_get(node, iter->c_str());
+		} else if (json_is_array(node)) {
+			json_t *match = NULL;
+			size_t i;
+			json_t *entry;
+			json_array_foreach(node, i, entry) {
+				const char *tag = tag_value(entry);
+				if (tag != NULL && *iter == tag) {
+					match = entry;
+					break;
+				}
+			}
+			node = match;
+		} else {
+			node = NULL;
+		}
+		++iter;
+	}
+	return node;
+}
@@ -0,0 +1,29 @@
+/**
+ * Module: confshow.hh
+ * Description: find nodes in configd's JSON configuration trees
+ *
+ * Copyright (c) 2019, AT&T Intellectual Property.  All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ **/
+
+#ifndef __CONFSHOW_HH__
+#define __CONFSHOW_HH__
+
+#include <string>
+#include <vector>
+#include <jansson.h>
+
+/**
+ * Lookups in a configuration tree in configd's JSON encoding, where a
+ * tag node is an array of entries each naming itself with "tagnode".
+ **/
+class ConfigShow
+{
+public:
+	//node at path below the root of tree, NULL if there is none
+	static json_t *
+	find(json_t *tree, const std::vector<std::string> &path);
+};
+
+#endif //__CONFSHOW_HH__
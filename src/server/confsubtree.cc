@@ -0,0 +1,140 @@
+/**
+ * Module: confsubtree.cc
+ * Description: fetch the descendants of a conf node in parallel
+ *
+ * Copyright (c) 2019, AT&T Intellectual Property.  All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ **/
+
+#include <syslog.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <system_error>
+
+#include "common.hh"
+#include "configuration.hh"
+#include "confsubtree.hh"
+#include "debug.h"
+
+using namespace std;
+
+/**
+ * \brief Fetch the descendants of path down to depth levels
+ *
+ * \param path[in] Path of the root node as given in the request
+ * \param conf_id[in] Configuration session id
+ * \param root[in] The root node
+ * \param depth[in] Levels below root to fetch
+ **/
+void
+ConfSubtree::fetch(const string &path, const string &conf_id, const TemplateParams &root,
+		   unsigned long depth)
+{
+	_conf_id = conf_id;
+	_depth = depth;
+	if (depth == 0) {
+		return;
+	}
+	queue_children(path, root, 0);
+	if (_queue.empty()) {
+		return;
+	}
+
+	//idle workers wait for the levels below to be queued
+	std::vector<std::thread> threads;
+	for (unsigned long i = 1; i < MAX_THREADS; ++i) {
+		try {
+			threads.push_back(std::thread(&ConfSubtree::worker, this));
+		} catch (const std::system_error &e) {
+			syslog(LOG_ERR, "webgui: unable to start subtree thread: %s", e.what());
+			break;
+		}
+	}
+	//this thread works too, so there is always at least one
+	worker();
+
+	std::vector<std::thread>::iterator iter = threads.begin();
+	while (iter != threads.end()) {
+		iter->join();
+		++iter;
+	}
+	dsyslog(_debug, "ConfSubtree::%s: %zu nodes, %zu threads%s", __func__,
+		_node_coll.size(), threads.size() + 1, _truncated ? ", truncated" : "");
+}
+
+/**
+ *
+ **/
+TemplateParams *
+ConfSubtree::find(const string &path)
+{
+	NodeIter iter = _node_coll.find(path);
+	if (iter == _node_coll.end()) {
+		return NULL;
+	}
+	return &iter->second;
+}
+
+/**
+ * \brief Queue the children of a node that are worth descending into
+ *
+ * Called with _mutex held, or before any worker runs.
+ **/
+void
+ConfSubtree::queue_children(const string &path, const TemplateParams &params, unsigned long level)
+{
+	if (level >= _depth || params._end) {
+		return;
+	}
+	std::vector<NodeParams>::const_iterator iter = params._children_coll.begin();
+	while (iter != params._children_coll.end()) {
+		if (iter->_state != NodeParams::k_NONE) {
+			if (_node_coll.size() + _queue.size() + _active >= MAX_NODES) {
+				_truncated = true;
+				return;
+			}
+			_queue.push_back(Item(path + "/" + Rest::url_escape(iter->_name), level + 1));
+		}
+		++iter;
+	}
+}
+
+/**
+ * \brief Fetch queued nodes until there are none left and none in flight
+ **/
+void
+ConfSubtree::worker()
+{
+	Configuration conf(_debug);
+
+	std::unique_lock<std::mutex> lock(_mutex);
+	while (true) {
+		while (_queue.empty() && _active > 0) {
+			_cond.wait(lock);
+		}
+		if (_queue.empty()) {
+			break;
+		}
+		Item item = _queue.front();
+		_queue.pop_front();
+		++_active;
+
+		lock.unlock();
+		TemplateParams params;
+		bool found = conf.get_configured_node(item._path, _conf_id, params);
+		lock.lock();
+
+		--_active;
+		if (found) {
+			queue_children(item._path, params, item._level);
+			_node_coll[item._path] = params;
+		}
+		_cond.notify_all();
+	}
+}
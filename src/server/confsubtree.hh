@@ -0,0 +1,91 @@
+/**
+ * Module: confsubtree.hh
+ * Description: fetch the descendants of a conf node in parallel
+ *
+ * Copyright (c) 2019, AT&T Intellectual Property.  All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ **/
+
+#ifndef __CONFSUBTREE_HH__
+#define __CONFSUBTREE_HH__
+
+#include <string>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+
+#include "configuration.hh"
+
+/**
+ * Fetches the configured descendants of a node, level by level down to
+ * a depth, on a few threads each with its own Configuration and so its
+ * own pooled configd connection. Leaf values and children not present
+ * in the configuration are not descended into.
+ *
+ * Nodes are keyed by path, a child's path is its parent's path, "/"
+ * and its url escaped name.
+ **/
+class ConfSubtree
+{
+public:
+	ConfSubtree(bool debug) :
+		_debug(debug),
+		_depth(0),
+		_active(0),
+		_truncated(false) {}
+
+	//fetch below root, which the caller has already fetched
+	void
+	fetch(const std::string &path, const std::string &conf_id, const TemplateParams &root,
+	      unsigned long depth);
+
+	//NULL if the node was not fetched
+	TemplateParams *
+	find(const std::string &path);
+
+	//more nodes than MAX_NODES were reached, the rest were left out
+	bool
+	truncated() const {
+		return _truncated;
+	}
+
+private:
+	class Item
+	{
+	public:
+		Item(const std::string &path, unsigned long level) : _path(path), _level(level) {}
+		std::string _path;
+		unsigned long _level;
+	};
+
+	typedef std::map<std::string,TemplateParams> NodeColl;
+	typedef std::map<std::string,TemplateParams>::iterator NodeIter;
+
+	ConfSubtree(const ConfSubtree &);
+	ConfSubtree &operator=(const ConfSubtree &);
+
+	void
+	queue_children(const std::string &path, const TemplateParams &params, unsigned long level);
+
+	void
+	worker();
+
+private:
+	static const unsigned long MAX_THREADS = 4;
+	static const unsigned long MAX_NODES = 10000;
+
+	bool _debug;
+	std::string _conf_id;
+	unsigned long _depth;
+
+	std::mutex _mutex; //guards everything below
+	std::condition_variable _cond;
+	std::deque<Item> _queue;
+	unsigned long _active; //workers fetching a node
+	bool _truncated;
+	NodeColl _node_coll;
+};
+
+#endif //__CONFSUBTREE_HH__
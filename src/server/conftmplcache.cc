@@ -0,0 +1,180 @@
+/**
+ * Module: conftmplcache.cc
+ * Description: process wide cache of cfg mode template descriptions
+ *
+ * Copyright (c) 2019, AT&T Intellectual Property.  All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ **/
+
+#include <sys/types.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <syslog.h>
+#include <string>
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <mutex>
+
+#include "common.hh"
+#include "conftmplcache.hh"
+
+using namespace std;
+
+const string ConfTemplateCache::PACKAGE_DB_DIR = "/var/lib/dpkg";
+
+/**
+ *
+ **/
+unsigned long
+TemplateDescription::size() const
+{
+	unsigned long bytes = sizeof(*this) + _tmpl_path.capacity();
+	std::vector<string>::const_iterator iter;
+	for (iter = _tmpl.begin(); iter != _tmpl.end(); ++iter) {
+		bytes += sizeof(string) + iter->capacity();
+	}
+	for (iter = _children.begin(); iter != _children.end(); ++iter) {
+		bytes += sizeof(string) + iter->capacity();
+	}
+	return bytes;
+}
+
+/**
+ *
+ **/
+ConfTemplateCache &
+ConfTemplateCache::instance()
+{
+	static ConfTemplateCache cache;
+	return cache;
+}
+
+/**
+ *
+ **/
+bool
+ConfTemplateCache::get(const string &path, TemplateDescription &desc)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	if (refresh() == false) {
+		++_misses;
+		return false;
+	}
+	EntryIter iter = _entry_coll.find(path);
+	if (iter == _entry_coll.end()) {
+		++_misses;
+		return false;
+	}
+	//move to the front of the lru
+	_lru_coll.splice(_lru_coll.begin(), _lru_coll, iter->second.second);
+	desc = iter->second.first;
+	++_hits;
+	return true;
+}
+
+/**
+ * \brief Keep a valid description, evicting the least recently used
+ **/
+void
+ConfTemplateCache::put(const string &path, const TemplateDescription &desc)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	if (desc._valid == false || refresh() == false) {
+		return;
+	}
+	unsigned long bytes = desc.size() + path.capacity();
+	if (bytes > MAX_BYTES || _entry_coll.find(path) != _entry_coll.end()) {
+		return;
+	}
+
+	while (_bytes + bytes > MAX_BYTES && _lru_coll.empty() == false) {
+		EntryIter victim = _entry_coll.find(_lru_coll.back());
+		_bytes -= victim->second.first.size() + victim->first.capacity();
+		_entry_coll.erase(victim);
+		_lru_coll.pop_back();
+		++_evictions;
+	}
+
+	_lru_coll.push_front(path);
+	_entry_coll[path] = Entry(desc, _lru_coll.begin());
+	_bytes += bytes;
+}
+
+/**
+ *
+ **/
+void
+ConfTemplateCache::clear()
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	reset();
+}
+
+/**
+ *
+ **/
+void
+ConfTemplateCache::reset()
+{
+	if (_notify_fd != -1) {
+		close(_notify_fd);
+		_notify_fd = -1;
+	}
+	_entry_coll.clear();
+	_lru_coll.clear();
+	_bytes = 0;
+}
+
+/**
+ *
+ **/
+string
+ConfTemplateCache::stats() const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	return "hits=" + Rest::ulltostring(_hits) +
+		" misses=" + Rest::ulltostring(_misses) +
+		" evictions=" + Rest::ulltostring(_evictions) +
+		" entries=" + Rest::ulltostring(_entry_coll.size()) +
+		" bytes=" + Rest::ulltostring(_bytes);
+}
+
+/**
+ * \brief Empty the cache if packages have changed since it was filled
+ *
+ * \return bool false if changes cannot be watched, nothing is cached then
+ **/
+bool
+ConfTemplateCache::refresh()
+{
+	if (_notify_fd != -1) {
+		char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+		bool changed = false;
+		while (read(_notify_fd, buf, sizeof(buf)) > 0) {
+			changed = true;
+		}
+		if (changed == false) {
+			return true;
+		}
+		syslog(LOG_DEBUG, "webgui: packages changed, dropping template cache");
+		reset();
+	}
+
+	_notify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (_notify_fd == -1) {
+		syslog(LOG_ERR, "webgui: inotify_init1: %s", strerror(errno));
+		return false;
+	}
+	//dpkg replaces its status file on every install and removal
+	if (inotify_add_watch(_notify_fd, PACKAGE_DB_DIR.c_str(), IN_MOVED_TO | IN_CLOSE_WRITE) == -1) {
+		syslog(LOG_ERR, "webgui: unable to watch %s: %s", PACKAGE_DB_DIR.c_str(), strerror(errno));
+		close(_notify_fd);
+		_notify_fd = -1;
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,102 @@
+/**
+ * Module: conftmplcache.hh
+ * Description: process wide cache of cfg mode template descriptions
+ *
+ * Copyright (c) 2019, AT&T Intellectual Property.  All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ **/
+
+#ifndef __CONFTMPLCACHE_HH__
+#define __CONFTMPLCACHE_HH__
+
+#include <string>
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <mutex>
+
+/**
+ * What the template of a cfg mode node says
+ **/
+class TemplateDescription
+{
+public:
+	TemplateDescription() : _valid(false), _has_tmpl(false), _type(0) {}
+
+	//approximate memory held
+	unsigned long
+	size() const;
+
+	bool _valid; ///< path validated
+	bool _has_tmpl; ///< node.def found
+	std::vector<std::string> _tmpl; ///< "key=value" entries
+	std::vector<std::string> _children; ///< template children
+	int _type; ///< configd node type
+	std::string _tmpl_path; ///< with tag values as node.tag, the cache key
+};
+
+/**
+ * Least recently used template descriptions, keyed by template path,
+ * the cfg path with tag values replaced by node.tag.
+ *
+ * Templates are the same for every user and session, so valid
+ * descriptions are kept across requests up to MAX_BYTES. Templates
+ * only change when packages are installed or removed, so the cache is
+ * emptied whenever dpkg updates its database.
+ **/
+class ConfTemplateCache
+{
+public:
+	static ConfTemplateCache &
+	instance();
+
+	bool
+	get(const std::string &path, TemplateDescription &desc);
+
+	void
+	put(const std::string &path, const TemplateDescription &desc);
+
+	void
+	clear();
+
+	//counters as "hits=N misses=N evictions=N entries=N bytes=N"
+	std::string
+	stats() const;
+
+private:
+	typedef std::list<std::string> LruColl;
+	typedef std::pair<TemplateDescription,LruColl::iterator> Entry;
+	typedef std::unordered_map<std::string,Entry> EntryColl;
+	typedef std::unordered_map<std::string,Entry>::iterator EntryIter;
+
+	ConfTemplateCache() :
+		_notify_fd(-1),
+		_bytes(0),
+		_hits(0),
+		_misses(0),
+		_evictions(0) {}
+	ConfTemplateCache(const ConfTemplateCache &);
+	ConfTemplateCache &operator=(const ConfTemplateCache &);
+
+	bool
+	refresh();
+
+	void
+	reset();
+
+private:
+	static const unsigned long MAX_BYTES = 4 * 1024 * 1024;
+	static const std::string PACKAGE_DB_DIR;
+
+	mutable std::mutex _mutex; //held by every public member
+	int _notify_fd; //-1 while nothing is cached
+	EntryColl _entry_coll;
+	LruColl _lru_coll; //most recently used first
+	unsigned long _bytes;
+	unsigned long _hits;
+	unsigned long _misses;
+	unsigned long _evictions;
+};
+
+#endif //__CONFTMPLCACHE_HH__
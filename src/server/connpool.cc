@@ -0,0 +1,314 @@
+/**
+ * Module: connpool.cc
+ * Description: per process pool of configd and opd connections
+ *
+ * Copyright (c) 2019, AT&T Intellectual Property.  All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ **/
+
+#include <sys/types.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <errno.h>
+#include <syslog.h>
+#include <string>
+#include <list>
+#include <vector>
+#include <algorithm>
+#include <mutex>
+
+#include <client/connect.h>
+#include <opd_client.h>
+
+#include "common.hh"
+#include "connpool.hh"
+
+using namespace std;
+
+/**
+ *
+ **/
+ConnPool &
+ConnPool::instance()
+{
+	static ConnPool pool;
+	return pool;
+}
+
+/**
+ * \brief Credentials a connection opened now would be authorized with
+ **/
+string
+ConnPool::identity()
+{
+	string id = Rest::ulltostring(geteuid()) + ":" + Rest::ulltostring(getegid());
+
+	int ngroups = getgroups(0, NULL);
+	if (ngroups > 0) {
+		std::vector<gid_t> groups(ngroups);
+		ngroups = getgroups(ngroups, &groups[0]);
+		if (ngroups > 0) {
+			groups.resize(ngroups);
+			sort(groups.begin(), groups.end());
+			std::vector<gid_t>::iterator iter = groups.begin();
+			while (iter != groups.end()) {
+				id += ":" + Rest::ulltostring(*iter);
+				++iter;
+			}
+		}
+	}
+	return id;
+}
+
+/**
+ * \brief Whether an idle connection is still usable
+ *
+ * Nothing is expected from the daemon between requests, so anything
+ * readable on the socket means it was closed, or is out of step.
+ **/
+bool
+ConnPool::healthy(int fd)
+{
+	if (fd < 0) {
+		return false;
+	}
+	struct pollfd pfd;
+	pfd.fd = fd;
+	pfd.events = POLLIN | POLLRDHUP;
+	pfd.revents = 0;
+	return (poll(&pfd, 1, 0) == 0);
+}
+
+/**
+ * \brief Keep a pooled connection out of the commands we run
+ *
+ * A connection outlives the request that opened it and carries the
+ * credentials of whoever opened it, a command run for another user
+ * must not inherit it.
+ **/
+void
+ConnPool::set_cloexec(int fd)
+{
+	int flags = fcntl(fd, F_GETFD);
+	if (flags < 0 || fcntl(fd, F_SETFD, flags | FD_CLOEXEC) < 0) {
+		syslog(LOG_ERR, "webgui: Unable to set close-on-exec on daemon connection: %d", errno);
+	}
+}
+
+/**
+ * \brief Whether a connection is unfit for reuse after a call on it failed
+ *
+ * Decided from the socket alone, errno may be left over from anything
+ * earlier. A daemon that went away, or whose reply was not read in
+ * full, leaves the socket readable. A call the daemon answered with an
+ * error leaves the connection in step and usable.
+ **/
+bool
+ConnPool::failed(int fd)
+{
+	return healthy(fd) == false;
+}
+
+/**
+ *
+ **/
+struct configd_conn *
+ConnPool::acquire_configd(const string &sid)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	string id = identity();
+
+	//prefer a connection already on this session
+	ConfigdIter found = _configd_coll.end();
+	ConfigdIter iter = _configd_coll.begin();
+	while (iter != _configd_coll.end()) {
+		if (iter->_busy || iter->_identity != id || (sid.empty() && iter->_bound)) {
+			++iter;
+			continue;
+		}
+		if (healthy(iter->_conn.fd) == false) {
+			configd_close_connection(&iter->_conn);
+			iter = _configd_coll.erase(iter);
+			continue;
+		}
+		if (found == _configd_coll.end() || (iter->_sid == sid && found->_sid != sid)) {
+			found = iter;
+		}
+		++iter;
+	}
+
+	if (found == _configd_coll.end()) {
+		ConfigdEntry entry;
+		entry._identity = id;
+		found = _configd_coll.insert(_configd_coll.end(), entry);
+		if (configd_open_connection(&found->_conn) == -1) {
+			syslog(LOG_ERR, "webgui: Unable to connect to configuration daemon");
+			_configd_coll.erase(found);
+			return NULL;
+		}
+		set_cloexec(found->_conn.fd);
+	}
+
+	if (sid.empty() == false && (found->_bound == false || found->_sid != sid)) {
+		if (configd_set_session_id(&found->_conn, sid.c_str()) != 0) {
+			syslog(LOG_ERR, "webgui: Unable to set configuration session id");
+			configd_close_connection(&found->_conn);
+			_configd_coll.erase(found);
+			return NULL;
+		}
+		found->_sid = sid;
+		found->_bound = true;
+	}
+	found->_busy = true;
+	return &found->_conn;
+}
+
+/**
+ *
+ **/
+void
+ConnPool::release(struct configd_conn *conn, bool broken)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	ConfigdIter iter = _configd_coll.begin();
+	while (iter != _configd_coll.end()) {
+		if (&iter->_conn == conn) {
+			iter->_busy = false;
+			if (broken) {
+				configd_close_connection(&iter->_conn);
+				_configd_coll.erase(iter);
+				return;
+			}
+			trim_configd(iter->_identity);
+			return;
+		}
+		++iter;
+	}
+}
+
+/**
+ *
+ **/
+struct opd_connection *
+ConnPool::acquire_opd()
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	string id = identity();
+
+	OpdIter iter = _opd_coll.begin();
+	while (iter != _opd_coll.end()) {
+		if (iter->_busy || iter->_identity != id) {
+			++iter;
+			continue;
+		}
+		if (healthy(iter->_conn.fd) == false) {
+			opd_close(&iter->_conn);
+			iter = _opd_coll.erase(iter);
+			continue;
+		}
+		iter->_busy = true;
+		return &iter->_conn;
+	}
+
+	OpdEntry entry;
+	entry._identity = id;
+	iter = _opd_coll.insert(_opd_coll.end(), entry);
+	if (opd_open(&iter->_conn) == -1) {
+		syslog(LOG_ERR, "webgui: Unable to connect to operational daemon");
+		_opd_coll.erase(iter);
+		return NULL;
+	}
+	set_cloexec(iter->_conn.fd);
+	iter->_busy = true;
+	return &iter->_conn;
+}
+
+/**
+ *
+ **/
+void
+ConnPool::release(struct opd_connection *conn, bool broken)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	OpdIter iter = _opd_coll.begin();
+	while (iter != _opd_coll.end()) {
+		if (&iter->_conn == conn) {
+			iter->_busy = false;
+			if (broken) {
+				opd_close(&iter->_conn);
+				_opd_coll.erase(iter);
+				return;
+			}
+			trim_opd(iter->_identity);
+			return;
+		}
+		++iter;
+	}
+}
+
+/**
+ * \brief Close idle connections of an identity beyond MAX_IDLE
+ **/
+void
+ConnPool::trim_configd(const string &identity)
+{
+	unsigned long idle = 0;
+	ConfigdIter iter = _configd_coll.begin();
+	while (iter != _configd_coll.end()) {
+		if (iter->_busy == false && iter->_identity == identity && ++idle > MAX_IDLE) {
+			configd_close_connection(&iter->_conn);
+			iter = _configd_coll.erase(iter);
+			continue;
+		}
+		++iter;
+	}
+}
+
+/**
+ *
+ **/
+void
+ConnPool::trim_opd(const string &identity)
+{
+	unsigned long idle = 0;
+	OpdIter iter = _opd_coll.begin();
+	while (iter != _opd_coll.end()) {
+		if (iter->_busy == false && iter->_identity == identity && ++idle > MAX_IDLE) {
+			opd_close(&iter->_conn);
+			iter = _opd_coll.erase(iter);
+			continue;
+		}
+		++iter;
+	}
+}
+
+/**
+ *
+ **/
+void
+ConnPool::clear()
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	ConfigdIter c = _configd_coll.begin();
+	while (c != _configd_coll.end()) {
+		if (c->_busy) {
+			++c;
+			continue;
+		}
+		configd_close_connection(&c->_conn);
+		c = _configd_coll.erase(c);
+	}
+	OpdIter o = _opd_coll.begin();
+	while (o != _opd_coll.end()) {
+		if (o->_busy) {
+			++o;
+			continue;
+		}
+		opd_close(&o->_conn);
+		o = _opd_coll.erase(o);
+	}
+}
@@ -0,0 +1,183 @@
+/**
+ * Module: connpool.hh
+ * Description: per process pool of configd and opd connections
+ *
+ * Copyright (c) 2019, AT&T Intellectual Property.  All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ **/
+
+#ifndef __CONNPOOL_HH__
+#define __CONNPOOL_HH__
+
+#include <string>
+#include <list>
+#include <mutex>
+
+#include <client/connect.h>
+#include <opd_client.h>
+
+/**
+ * Connections are opened on first use and kept open between requests.
+ *
+ * The daemons authorize a client by the credentials it connected with,
+ * so a connection is only handed out again to callers running with the
+ * same effective uid, gid and groups. Configd connections that have
+ * been given a session id are only reused for sessions, the session id
+ * is switched with configd_set_session_id(). Idle connections are
+ * checked before reuse and reopened if the daemon has gone away.
+ **/
+class ConnPool
+{
+public:
+	static ConnPool &
+	instance();
+
+	//sid empty for a connection outside of any configuration session
+	struct configd_conn *
+	acquire_configd(const std::string &sid);
+
+	//broken for a connection that failed, it is closed rather than kept
+	void
+	release(struct configd_conn *conn, bool broken = false);
+
+	struct opd_connection *
+	acquire_opd();
+
+	void
+	release(struct opd_connection *conn, bool broken = false);
+
+	//close all idle connections
+	void
+	clear();
+
+	//after a call on the connection with fd failed, whether it failed in
+	//transport or left the connection unusable; pass the result to release()
+	static bool
+	failed(int fd);
+
+private:
+	class ConfigdEntry
+	{
+	public:
+		ConfigdEntry() : _bound(false), _busy(false) {}
+		struct configd_conn _conn;
+		std::string _identity;
+		std::string _sid;
+		bool _bound; //has had a session id set
+		bool _busy;
+	};
+
+	class OpdEntry
+	{
+	public:
+		OpdEntry() : _busy(false) {}
+		struct opd_connection _conn;
+		std::string _identity;
+		bool _busy;
+	};
+
+	typedef std::list<ConfigdEntry>::iterator ConfigdIter;
+	typedef std::list<OpdEntry>::iterator OpdIter;
+
+	ConnPool() {}
+	ConnPool(const ConnPool &);
+	ConnPool &operator=(const ConnPool &);
+
+	std::string
+	identity();
+
+	static bool
+	healthy(int fd);
+
+	static void
+	set_cloexec(int fd);
+
+	void
+	trim_configd(const std::string &identity);
+
+	void
+	trim_opd(const std::string &identity);
+
+private:
+	static const unsigned long MAX_IDLE = 4; //per identity and daemon
+	std::mutex _mutex; //held by every public member, subtree fetches share the pool
+	std::list<ConfigdEntry> _configd_coll; //entries never move, callers hold &_conn
+	std::list<OpdEntry> _opd_coll;
+};
+
+/**
+ * Holds a pooled configd connection for the lifetime of the object.
+ **/
+class ConfigdLease
+{
+public:
+	ConfigdLease(const std::string &sid = "") :
+		_conn(ConnPool::instance().acquire_configd(sid)),
+		_broken(false) {}
+
+	~ConfigdLease() {
+		if (_conn != NULL) {
+			ConnPool::instance().release(_conn, _broken);
+		}
+	}
+
+	struct configd_conn *
+	get() const {
+		return _conn;
+	}
+
+	//call after a configd call failed, a broken connection is not pooled again
+	void
+	failed() {
+		if (_conn != NULL && ConnPool::failed(_conn->fd)) {
+			_broken = true;
+		}
+	}
+
+private:
+	ConfigdLease(const ConfigdLease &);
+	ConfigdLease &operator=(const ConfigdLease &);
+
+	struct configd_conn *_conn;
+	bool _broken;
+};
+
+/**
+ * Holds a pooled opd connection for the lifetime of the object.
+ **/
+class OpdLease
+{
+public:
+	OpdLease() :
+		_conn(ConnPool::instance().acquire_opd()),
+		_broken(false) {}
+
+	~OpdLease() {
+		if (_conn != NULL) {
+			ConnPool::instance().release(_conn, _broken);
+		}
+	}
+
+	struct opd_connection *
+	get() const {
+		return _conn;
+	}
+
+	//call after an opd call failed, a broken connection is not pooled again
+	void
+	failed() {
+		if (_conn != NULL && ConnPool::failed(_conn->fd)) {
+			_broken = true;
+		}
+	}
+
+private:
+	OpdLease(const OpdLease &);
+	OpdLease &operator=(const OpdLease &);
+
+	struct opd_connection *_conn;
+	bool _broken;
+};
+
+#endif //__CONNPOOL_HH__
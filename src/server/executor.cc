@@ -0,0 +1,308 @@
+/**
+ * Module: executor.cc
+ * Description: run commands for the rest modes
+ *
+ * Copyright (c) 2019, AT&T Intellectual Property.  All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ **/
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <signal.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <string>
+#include <vector>
+
+#include "common.hh"
+#include "executor.hh"
+#include "debug.h"
+
+using namespace std;
+
+extern char **environ;
+
+static const size_t READ_CHUNK = 65536;
+static const useconds_t REAP_TICK = 20000; //usecs between checks for exit
+
+/**
+ *
+ **/
+Executor::Executor(bool debug) :
+	_debug(debug),
+	_timeout(DEFAULT_TIMEOUT),
+	_max_output(Rest::MAX_BODY_SIZE),
+	_timed_out(false),
+	_truncated(false),
+	_stopped(false)
+{
+	memset(&_deadline, 0, sizeof(_deadline));
+	memset(&_usage, 0, sizeof(_usage));
+}
+
+/**
+ *
+ **/
+void
+Executor::set_env(const string &name, const string &value)
+{
+	_env.push_back(name + "=" + value);
+}
+
+/**
+ *
+ **/
+int
+Executor::run_shell(const string &cmd, string &out)
+{
+	std::vector<string> argv;
+	argv.push_back("/bin/sh");
+	argv.push_back("-c");
+	argv.push_back(cmd);
+	return run(argv, out);
+}
+
+/**
+ * \brief Run a command to completion
+ *
+ * \param argv[in] Program path and arguments
+ * \param out[out] stdout and stderr of the command, up to the cap
+ * \return int Exit status, 128 + signal if killed, -1 if not started
+ **/
+int
+Executor::run(const std::vector<string> &argv, string &out)
+{
+	if (argv.empty()) {
+		return -1;
+	}
+	_timed_out = false;
+	_truncated = false;
+	_stopped = false;
+	memset(&_usage, 0, sizeof(_usage));
+
+	//built before the spawn, the child must not allocate
+	std::vector<char*> args;
+	std::vector<string>::const_iterator iter;
+	for (iter = argv.begin(); iter != argv.end(); ++iter) {
+		args.push_back((char*)iter->c_str());
+	}
+	args.push_back(NULL);
+
+	std::vector<char*> envs;
+	for (char **e = environ; e != NULL && *e != NULL; ++e) {
+		//don't leak this to the CLI since it might fetch URL's
+		if (strncmp(*e, "HTTP_PROXY=", 11) == 0) {
+			continue;
+		}
+		bool replaced = false;
+		for (iter = _env.begin(); iter != _env.end() && replaced == false; ++iter) {
+			size_t len = iter->find('=') + 1;
+			replaced = strncmp(*e, iter->c_str(), len) == 0;
+		}
+		if (replaced == false) {
+			envs.push_back(*e);
+		}
+	}
+	for (iter = _env.begin(); iter != _env.end(); ++iter) {
+		envs.push_back((char*)iter->c_str());
+	}
+	envs.push_back(NULL);
+
+	//output through a pipe, input through a socket so that writing to a
+	//command that has gone away fails with EPIPE instead of a signal
+	int out_fds[2], in_fds[2];
+	if (pipe2(out_fds, O_CLOEXEC) < 0) {
+		syslog(LOG_ERR, "webgui: Can't make pipe: %d", errno);
+		return -1;
+	}
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, in_fds) < 0) {
+		syslog(LOG_ERR, "webgui: Can't make socketpair: %d", errno);
+		close(out_fds[0]);
+		close(out_fds[1]);
+		return -1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &_deadline);
+	_deadline.tv_sec += _timeout;
+
+	SpawnArgs sa;
+	sa._argv = &args[0];
+	sa._envp = &envs[0];
+	sa._in = in_fds[1];
+	sa._out = out_fds[1];
+	sa._drop_real_ids = true;
+	pid_t pid = Rest::spawn(sa);
+	close(in_fds[1]);
+	close(out_fds[1]);
+	if (pid < 0) {
+		close(in_fds[0]);
+		close(out_fds[0]);
+		return -1;
+	}
+
+	collect(pid, in_fds[0], out_fds[0], out);
+	int status = reap(pid);
+
+	dsyslog(_debug, "Executor::%s: %s: status %d, %zu bytes, %ld.%06ld user %ld.%06ld sys%s%s",
+		__func__, argv[0].c_str(), status, out.size(),
+		(long)_usage.ru_utime.tv_sec, (long)_usage.ru_utime.tv_usec,
+		(long)_usage.ru_stime.tv_sec, (long)_usage.ru_stime.tv_usec,
+		_timed_out ? ", timed out" : "", _truncated ? ", truncated" : "");
+	return status;
+}
+
+/**
+ * \brief Feed the input and read the output until the command closes it
+ *
+ * Stops the command on the deadline and when the output reaches its cap.
+ **/
+void
+Executor::collect(pid_t pid, int in, int out, string &output)
+{
+	fcntl(out, F_SETFL, fcntl(out, F_GETFL) | O_NONBLOCK);
+	fcntl(in, F_SETFL, fcntl(in, F_GETFL) | O_NONBLOCK);
+	size_t written = 0;
+	if (_input.empty()) {
+		close(in);
+		in = -1;
+	}
+
+	char buf[READ_CHUNK];
+	while (out != -1) {
+		long wait = remaining_msecs();
+		if (wait == 0) {
+			_timed_out = true;
+			stop(pid);
+			break;
+		}
+
+		struct pollfd fds[2];
+		fds[0].fd = out;
+		fds[0].events = POLLIN;
+		fds[0].revents = 0;
+		fds[1].fd = in;
+		fds[1].events = POLLOUT;
+		fds[1].revents = 0;
+		int ret = poll(fds, in != -1 ? 2 : 1, (int)wait);
+		if (ret < 0 && errno != EINTR) {
+			syslog(LOG_ERR, "webgui: poll on command output: %d", errno);
+			stop(pid);
+			break;
+		}
+		if (ret <= 0) {
+			continue;
+		}
+
+		if (in != -1 && fds[1].revents != 0) {
+			ssize_t ct = send(in, _input.data() + written, _input.size() - written, MSG_NOSIGNAL);
+			if (ct > 0) {
+				written += ct;
+			}
+			if (written == _input.size() || (ct < 0 && errno != EAGAIN && errno != EINTR)) {
+				close(in);
+				in = -1;
+			}
+		}
+
+		if (fds[0].revents == 0) {
+			continue;
+		}
+		ssize_t ct = read(out, buf, sizeof(buf));
+		if (ct > 0) {
+			if (_max_output != 0 && output.size() + ct > _max_output) {
+				output.append(buf, _max_output - output.size());
+				_truncated = true;
+				stop(pid);
+				break;
+			}
+			output.append(buf, ct);
+		} else if (ct == 0 || (errno != EAGAIN && errno != EINTR)) {
+			close(out);
+			out = -1;
+		}
+	}
+
+	if (in != -1) {
+		close(in);
+	}
+	if (out != -1) {
+		close(out);
+	}
+}
+
+/**
+ * \brief Wait for the command to exit, stopping it if it outlives its deadline
+ **/
+int
+Executor::reap(pid_t pid)
+{
+	struct timespec kill_at;
+	clock_gettime(CLOCK_MONOTONIC, &kill_at);
+	kill_at.tv_sec += KILL_GRACE;
+
+	int status = 0;
+	while (true) {
+		pid_t ret = wait4(pid, &status, WNOHANG, &_usage);
+		if (ret == pid) {
+			break;
+		}
+		if (ret < 0 && errno != EINTR) {
+			return -1;
+		}
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (_stopped == false && remaining_msecs() == 0) {
+			_timed_out = true;
+			stop(pid);
+			kill_at = now;
+			kill_at.tv_sec += KILL_GRACE;
+		} else if (_stopped && now.tv_sec >= kill_at.tv_sec) {
+			kill(-pid, SIGKILL);
+		}
+		usleep(REAP_TICK);
+	}
+
+	if (WIFEXITED(status)) {
+		return WEXITSTATUS(status);
+	}
+	if (WIFSIGNALED(status)) {
+		return 128 + WTERMSIG(status);
+	}
+	return -1;
+}
+
+/**
+ * \brief Ask the command and its descendants to terminate
+ **/
+void
+Executor::stop(pid_t pid)
+{
+	if (_stopped) {
+		return;
+	}
+	_stopped = true;
+	kill(-pid, SIGTERM);
+}
+
+/**
+ * \brief Milliseconds left until the deadline, -1 without one
+ **/
+long
+Executor::remaining_msecs() const
+{
+	if (_timeout == 0) {
+		return -1;
+	}
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	long msecs = (_deadline.tv_sec - now.tv_sec) * 1000 + (_deadline.tv_nsec - now.tv_nsec) / 1000000;
+	return msecs > 0 ? msecs : 0;
+}
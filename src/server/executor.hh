@@ -0,0 +1,94 @@
+/**
+ * Module: executor.hh
+ * Description: run commands for the rest modes
+ *
+ * Copyright (c) 2019, AT&T Intellectual Property.  All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ **/
+
+#ifndef __EXECUTOR_HH__
+#define __EXECUTOR_HH__
+
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <signal.h>
+#include <string>
+#include <vector>
+
+/**
+ * Runs a command as the requesting user and collects its output.
+ *
+ * The command is exec'd directly, a shell only runs when it is the
+ * command. Its stdin is fed from set_input(), stdout and stderr are
+ * read together. The command and anything it starts are killed when
+ * the deadline passes or the output exceeds its cap.
+ **/
+class Executor
+{
+public:
+	Executor(bool debug);
+
+	//run argv, argv[0] being the path of the program; returns the exit
+	//status, 128 + signal if it was killed, -1 if it could not start
+	int
+	run(const std::vector<std::string> &argv, std::string &out);
+
+	//run cmd with /bin/sh -c
+	int
+	run_shell(const std::string &cmd, std::string &out);
+
+	//add to, or replace in, the inherited environment
+	void
+	set_env(const std::string &name, const std::string &value);
+
+	void
+	set_input(const std::string &input) {_input = input;}
+
+	//seconds, 0 for none
+	void
+	set_timeout(unsigned long timeout) {_timeout = timeout;}
+
+	void
+	set_max_output(unsigned long max_output) {_max_output = max_output;}
+
+	bool
+	timed_out() const {return _timed_out;}
+
+	bool
+	truncated() const {return _truncated;}
+
+	const struct rusage &
+	usage() const {return _usage;}
+
+	static const unsigned long DEFAULT_TIMEOUT = 600; //seconds
+	static const unsigned long KILL_GRACE = 2; //seconds from SIGTERM to SIGKILL
+
+private:
+	void
+	collect(pid_t pid, int in, int out, std::string &output);
+
+	int
+	reap(pid_t pid);
+
+	void
+	stop(pid_t pid);
+
+	long
+	remaining_msecs() const;
+
+private:
+	bool _debug;
+	std::vector<std::string> _env;
+	std::string _input;
+	unsigned long _timeout;
+	unsigned long _max_output;
+	struct timespec _deadline;
+	bool _timed_out;
+	bool _truncated;
+	bool _stopped;
+	struct rusage _usage;
+};
+
+#endif //__EXECUTOR_HH__
@@ -155,6 +155,14 @@ HTTP::serialize()
 			o += "Cache-Control: " + iter->second + "\r\n";
 		} else if (iter->first == Rest::HTTP_RESP_CONTENT_DISPOSITION) {
 			o += "Content-Disposition: " + iter->second + "\r\n";
+		} else if (iter->first == Rest::HTTP_RESP_NEXT_OFFSET) {
+			o += "Vyatta-Next-Offset: " + iter->second + "\r\n";
+		} else if (iter->first == Rest::HTTP_RESP_TOTAL_SIZE) {
+			o += "Vyatta-Total-Size: " + iter->second + "\r\n";
+		} else if (iter->first == Rest::HTTP_RESP_NEXT_LINE) {
+			o += "Vyatta-Next-Line: " + iter->second + "\r\n";
+		} else if (iter->first == Rest::HTTP_RESP_TOTAL_LINES) {
+			o += "Vyatta-Total-Lines: " + iter->second + "\r\n";
 		} else if (iter->first == Rest::HTTP_RESP_VYATTA_SPECIFICATION_VERSION) {
 			o += "Vyatta-Specification-Version: " + iter->second + "\r\n";
 		} else if (iter->first == Rest::HTTP_BODY) {
@@ -84,6 +84,11 @@ main(int argc, char* argv[])
 		syslog(LOG_INFO, "Missing %s directory", RUNDIR);
 	}
 
+	//made while still root, requests only run with the user's euid
+	if (Rest::init_conf_session_dir() == false) {
+		syslog(LOG_ERR, "Configuration session registry is unavailable");
+	}
+
 	//set flag for debug on whether $RUNDIR/debug_webgui2 file is found
 	struct stat tmp;
 	if (stat(RUNDIR "/debug_webgui2", &tmp) == 0) {
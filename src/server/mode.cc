@@ -25,89 +25,26 @@
 
 using namespace std;
 
-int
-Mode::system_out(const char *cmd, string &out)
+/**
+ * \brief Write the request body where older scripts look for it
+ *
+ * App and service scripts get the body on stdin. Scripts that still
+ * read Rest::JSON_INPUT keep working for one more release; the file is
+ * shared by all requests, so they should move to stdin.
+ **/
+bool
+Mode::write_json_input(const string &json)
 {
-  //  fprintf(out_stream,"system out\n");
-  if (cmd == NULL) {
-    return -1;
-  }
-
-  int cp[2]; // Child to parent pipe
-  if( pipe(cp) < 0) {
-    return -1;
-  }
-
-  pid_t pid = fork();
-  if (pid == 0) {
-    //child
-    close(cp[0]);
-    close(0); // Close current stdin.
-    dup2(cp[1],STDOUT_FILENO); // Make stdout go to write end of pipe.
-    dup2(cp[1],STDERR_FILENO); // Make stderr go to write end of pipe.
-    //    fcntl(cp[1],F_SETFD,fcntl(cp[1],F_GETFD) & (~FD_CLOEXEC));
-    close(cp[1]);
-    int ret = 0;
-
-    //set user and group here
-    setregid(getegid(),getegid());
-    setreuid(geteuid(),geteuid());
-
-    // Don't leak this to the CLI since it might fetch URL's
-    unsetenv("HTTP_PROXY");
-
-    //    fprintf(out_stream,"executing: %s\n",cmd);
-    if (execl("/bin/sh", "sh", "-c", cmd, NULL) == -1) {
-      ret = errno;
-    }
-    close(cp[1]);
-    exit(ret);
-  }
-  else {
-    //parent
-    vector<char> data;
-    char buf[8192];
-    memset(buf,'\0',8192);
-    close(cp[1]);
-    fd_set rfds;
-    struct timeval tv;
-
-    int flags = fcntl(cp[0], F_GETFL, 0);
-    fcntl(cp[0], F_SETFL, flags | O_NONBLOCK);
-
-    FD_ZERO(&rfds);
-    FD_SET(cp[0], &rfds);
-    tv.tv_sec = 1;
-    tv.tv_usec = 0;
-    while (select(FD_SETSIZE, &rfds, NULL, NULL, &tv) != -1) {
-      int ret = 0;
-      memset(buf,'\0',8192);
-      if ((ret = read(cp[0], &buf, 8191)) > 0) {
-	data.insert(data.end(), buf, buf+ret);
-      }
-      else if (ret == -1 && errno == EAGAIN) {
-	//try again
-      }
-      else {
-	break;
-      }
-      FD_ZERO(&rfds);
-      FD_SET(cp[0], &rfds);
-      tv.tv_sec = 1;
-      tv.tv_usec = 0;
-
-      fflush(NULL);
-    }
-
-    out = string(data.begin(), data.end());
-
-    //now wait on child to kick the bucket
-    int status;
-    wait(&status);
-    close(cp[0]);
-    return WEXITSTATUS(status);
-  }
-
+	FILE *fd = fopen(Rest::JSON_INPUT.c_str(),"w");
+	if (!fd) {
+		return false;
+	}
+	if (fwrite(json.c_str(),sizeof(char),json.size(),fd) < json.size()) {
+		fclose(fd);
+		return false;
+	}
+	fclose(fd);
+	return true;
 }
 
 void
@@ -157,3 +94,26 @@ Mode::handle_cmd_output(string &cmdout, Session &session)
     session._response.set(Rest::HTTP_BODY,cmdout);
   }
 }
+
+bool
+Mode::get_depth(const string &query, unsigned long &depth)
+{
+  depth = 0;
+  string tmp;
+  if (Rest::get_query_param(query,"depth",tmp) == false) {
+    return true;
+  }
+  if (tmp == "all") {
+    depth = MAX_DEPTH;
+    return true;
+  }
+  char *end = NULL;
+  depth = strtoul(tmp.c_str(),&end,10);
+  if (tmp.empty() || *end != '\0') {
+    return false;
+  }
+  if (depth > MAX_DEPTH) {
+    depth = MAX_DEPTH;
+  }
+  return true;
+}
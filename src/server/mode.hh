@@ -25,13 +25,6 @@ public:
 	process(Session &session) = 0;
 
 
-	/**
-	 * Wrapper for system() call. Parameter holds stdout and stderr of the command.
-	 * Returns the actual return command of the executed cmd.
-	 **/
-	static int
-	system_out(const char *cmd, std::string &out);
-	
 	/**
 	 * Handle output from app/service commands - e.g. parse header overrides.
 	 * And set the given output as session response.
@@ -39,6 +32,22 @@ public:
 	static void
 	handle_cmd_output(std::string &cmdout, Session &session);
 
+	/**
+	 * Write the request body to Rest::JSON_INPUT for app/service scripts
+	 * that read it from there rather than from stdin.
+	 **/
+	static bool
+	write_json_input(const std::string &json);
+
+	/**
+	 * Read the depth= query parameter, a number of levels or "all".
+	 * Depth is 0 without one, returns false if it is invalid.
+	 **/
+	static bool
+	get_depth(const std::string &query, unsigned long &depth);
+
+	const static unsigned long MAX_DEPTH = 64;
+
 protected: //variables
 	bool _debug;
 
@@ -14,16 +14,19 @@
 #include <sys/stat.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <errno.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <vector>
+#include <algorithm>
 #include <string>
 #include <syslog.h>
 #include <iostream>
-#include "rl_str_proc.hh"
 #include "common.hh"
+#include "chunker2_proto.hh"
 #include "multirespcmd.hh"
 #include "debug.h"
 
@@ -68,7 +71,8 @@ MultiResponseCommand::init()
  *
  **/
 string
-MultiResponseCommand::start(string &user, string &cmd)
+MultiResponseCommand::start(string &user, string &cmd, const string &priority,
+			    const OutputFilter &filter, const string &format)
 {
 	string tok = Rest::generate_token();
 	if (tok.length() < 16) {
@@ -76,11 +80,15 @@ MultiResponseCommand::start(string &user, string &cmd)
 		return "";
 	}
 
-	char buffer[1024];
-	bzero(buffer,1024);
-	sprintf(buffer,Rest::CHUNKER_COMMAND_FORMAT.c_str(),tok.c_str(),cmd.c_str(),user.c_str());
+	ChunkerEncoder msg(ChunkerProto::K_COMMAND);
+	msg.add(ChunkerProto::K_TOKEN,tok);
+	msg.add(ChunkerProto::K_STATEMENT,cmd);
+	msg.add(ChunkerProto::K_USER,user);
+	msg.add(ChunkerProto::K_PRIORITY,priority);
+	filter.encode(msg);
+	msg.add(ChunkerProto::K_FORMAT,format);
 
-	if (write(_sock,buffer,sizeof(buffer)) == -1) {
+	if (msg.send(_sock) == false) {
 		char buf[1024];
 		sprintf(buf,"Error on initiating operational mode command: %d",errno);
 		syslog(LOG_ERR, "%s", buf);
@@ -90,6 +98,57 @@ MultiResponseCommand::start(string &user, string &cmd)
 	return tok;
 }
 
+/**
+ * \brief Fill pd from a process record of a chunker reply
+ **/
+void
+MultiResponseCommand::decode_process(const ChunkerField &record, ProcessData &pd)
+{
+	ChunkerMessage::FieldColl fields;
+	if (ChunkerMessage::parse(record._data,record._len,fields) == false) {
+		return;
+	}
+
+	ChunkerMessage::FieldIter iter = fields.begin();
+	while (iter != fields.end()) {
+		switch (iter->_tag) {
+		case ChunkerProto::K_START_TIME:
+			pd._start_time = iter->num();
+			break;
+		case ChunkerProto::K_STATEMENT:
+			pd._command = iter->str();
+			break;
+		case ChunkerProto::K_TOKEN:
+			pd._id = iter->str();
+			break;
+		case ChunkerProto::K_USER:
+			pd._username = iter->str();
+			break;
+		case ChunkerProto::K_OUTPUT:
+			pd._output = iter->str();
+			break;
+		case ChunkerProto::K_STATE:
+			pd._state = iter->str();
+			break;
+		case ChunkerProto::K_FORMAT:
+			pd._format = iter->str();
+			break;
+		case ChunkerProto::K_POSITION:
+			pd._position = iter->num();
+			break;
+		default:
+			break;
+		}
+		++iter;
+	}
+	if (pd._output.empty()) {
+		pd._output = pd._id;
+	}
+}
+
+/**
+ *
+ **/
 ProcessData
 MultiResponseCommand::get_process_details(string &user, string &id)
 {
@@ -98,78 +157,70 @@ MultiResponseCommand::get_process_details(string &user, string &id)
 		return pd;
 	}
 
-	char in[1024];
-	bzero(in,1024);
-	sprintf(in,Rest::CHUNKER_DETAILS_FORMAT.c_str(),id.c_str(),user.c_str());
-
-	if (write(_sock,in,sizeof(in)) == -1) {
+	ChunkerEncoder msg(ChunkerProto::K_DETAILS);
+	msg.add(ChunkerProto::K_TOKEN,id);
+	msg.add(ChunkerProto::K_USER,user);
+	if (msg.send(_sock) == false) {
 		return pd;
 	}
 
-	//now read from the sock...
-	char out[8192];
-	bzero(out,8192);
-	if (read(_sock,out,sizeof(out)) == -1) {
+	ChunkerMessage reply;
+	if (reply.recv(_sock) == false) {
 		return pd;
 	}
 
-	//now stuff into procs and return.
-	StrProc sp(out,"%2C");
-	vector<string> coll = sp.get();
-	vector<string>::iterator iter = coll.begin();
-	if (iter != coll.end()) {
-		StrProc sp2(*iter,"%3A");
-		pd._start_time = strtoul(sp2.get(0).c_str(),NULL,10);
-		pd._command = sp2.get(1);
-		pd._id = sp2.get(2);
-		pd._username = sp2.get(3);
+	ChunkerMessage::FieldIter iter = reply.fields().begin();
+	while (iter != reply.fields().end()) {
+		if (iter->_tag == ChunkerProto::K_RECORD) {
+			decode_process(*iter,pd);
+			break;
+		}
+		++iter;
 	}
 	return pd;
 }
 
 /**
+ * \brief List the background processes of user a page at a time
  *
- *
+ * \param user Owner of the processes
+ * \param limit Maximum number of processes returned, 0 for all
+ * \param cursor Value of next from the previous page, empty for the first
+ * \param next Cursor of the following page, empty on the last page (output)
  **/
 vector<ProcessData>
-MultiResponseCommand::get_processes(string &user)
+MultiResponseCommand::get_processes(string &user, unsigned long limit, const string &cursor, string &next)
 {
 	vector<ProcessData> procs;
-	string tok("123456");
+	next.clear();
 
 	if (user.empty()) {
 		return procs;
 	}
 
-	char in[1024];
-	bzero(in,1024);
-	sprintf(in,Rest::CHUNKER_PROCESS_FORMAT.c_str(),tok.c_str(),user.c_str());
-
-	if (write(_sock,in,sizeof(in)) == -1) {
+	ChunkerEncoder msg(ChunkerProto::K_PROCESS);
+	msg.add(ChunkerProto::K_USER,user);
+	msg.add(ChunkerProto::K_LIMIT,(uint64_t)limit);
+	msg.add(ChunkerProto::K_CURSOR,cursor);
+	if (msg.send(_sock) == false) {
 		return procs;
 	}
 
-	//now read from the sock...
-	char out[8192];
-	bzero(out,8192);
-	if (read(_sock,out,sizeof(out)) == -1) {
+	ChunkerMessage reply;
+	if (reply.recv(_sock) == false) {
 		return procs;
 	}
 
-	//now stuff into procs and return.
-	StrProc sp(out,"%2C");
-	vector<string> coll = sp.get();
-	vector<string>::iterator iter = coll.begin();
-	while (iter != coll.end()) {
-		ProcessData pd;
-		StrProc sp2(*iter,"%3A");
-		pd._start_time = strtoul(sp2.get(0).c_str(),NULL,10);
-		pd._command = sp2.get(1);
-		pd._id = sp2.get(2);
-		pd._username = sp2.get(3);
-		procs.push_back(pd);
+	ChunkerMessage::FieldIter iter = reply.fields().begin();
+	while (iter != reply.fields().end()) {
+		if (iter->_tag == ChunkerProto::K_RECORD) {
+			ProcessData pd;
+			decode_process(*iter,pd);
+			procs.push_back(pd);
+		}
 		++iter;
 	}
+	next = reply.get(ChunkerProto::K_CURSOR);
 	return procs;
 }
 
@@ -182,83 +233,45 @@ string
 MultiResponseCommand::get_chunk(string &user,string &token)
 {
 	string resp;
-	char in[1024];
 
 	if (user.empty() || token.empty()) {
 		return resp;
 	}
 
-	bzero(in,1024);
-	sprintf(in,Rest::CHUNKER_NEXT_FORMAT.c_str(),token.c_str(),user.c_str());
-
-	if (write(_sock,in,sizeof(in)) == -1) {
+	ChunkerEncoder msg(ChunkerProto::K_NEXT);
+	msg.add(ChunkerProto::K_TOKEN,token);
+	msg.add(ChunkerProto::K_USER,user);
+	if (msg.send(_sock) == false) {
 		return resp;
 	}
 
-	//now read from the sock...
-	char out[8192];
-	bzero(out,8192);
-	if (read(_sock,out,sizeof(out)) == -1) {
+	ChunkerMessage reply;
+	if (reply.recv(_sock) == false || reply.has(ChunkerProto::K_READ_OFFSET) == false) {
 		return resp;
 	}
-	//now stuff into procs and return.
-	StrProc sp2(string(out),"%3A");
-	std::string chunk = sp2.get(4);
-	if (chunk.empty() == true) {
-		return resp;
+
+	//output may be shared with other requesters of the same command
+	string output = reply.get(ChunkerProto::K_OUTPUT);
+	if (output.empty() == true) {
+		output = token;
 	}
 
 	//now read in the stuff
-	string file_chunk = Rest::CHUNKER_RESP_TOK_DIR + Rest::CHUNKER_RESP_TOK_BASE + token;
+	string file_chunk = Rest::CHUNKER_RESP_TOK_DIR + Rest::CHUNKER_RESP_TOK_BASE + output;
 
-	long chunk_pos = strtol(chunk.c_str(),NULL,10);
-	if (chunk_pos == 0 && errno == EINVAL) {
-		return resp;
-	}
+	//-1 once the output has been read through
+	long chunk_pos = (long)reply.get_num(ChunkerProto::K_READ_OFFSET);
 
 	struct stat s;
 	if ((lstat(file_chunk.c_str(), &s) == 0) && S_ISREG(s.st_mode) && chunk_pos >= 0) {
 		//found chunk now read next
-		FILE *fp = fopen(file_chunk.c_str(), "r");
-
-		if (fp) {
-			fflush(fp);
-			if (chunk_pos > 0) {
-				if (fseek(fp,chunk_pos,SEEK_SET) != 0) {
-					fclose(fp);
-					return resp;
-				}
-			}
-
-			char buf[Rest::CHUNKER_READ_SIZE+1];
-			bzero(buf,Rest::CHUNKER_READ_SIZE+1);
-			int left = Rest::CHUNKER_READ_SIZE;
-			int read = 0;
-			int ct = 0;
-			while ((left > 0) && (read = fread(buf,1,left,fp)) > -1) {
-				left = left - read;
-				if (read > 0) {
-					resp += string(buf);
-				}
-				if (feof(fp) != 0) {
-					break;
-				}
-				if (++ct > 5) {
-					break; //let's only attempt this 5 times then give up.
-				}
-				bzero(buf,Rest::CHUNKER_READ_SIZE);
-			}
-			fclose(fp);
-		}
+		read_range(file_chunk,chunk_pos,Rest::CHUNKER_READ_SIZE,resp);
 	} else { //need to determine if the chunker is done, or the request needs to be resent
-		//will look for end file, otherwise return true
-		string end_file = Rest::CHUNKER_RESP_TOK_DIR + Rest::CHUNKER_RESP_TOK_BASE + token + "_end";
+		//will look for end file, otherwise return true. The files are
+		//removed by the chunker once the last requester has gone.
+		string end_file = Rest::CHUNKER_RESP_TOK_DIR + Rest::CHUNKER_RESP_TOK_BASE + output + "_end";
 		if ((lstat(end_file.c_str(), &s) == 0)) {
 			resp = "END";
-			unlink(end_file.c_str());
-
-			string data_file = Rest::CHUNKER_RESP_TOK_DIR + Rest::CHUNKER_RESP_TOK_BASE + token;
-			unlink(data_file.c_str());
 		}
 	}
 	return resp;
@@ -266,27 +279,182 @@ MultiResponseCommand::get_chunk(string &user,string &token)
 
 
 /**
+ * \brief Read a range of output from a background process
  *
+ * Stateless counterpart to get_chunk(), the caller owns the cursor so
+ * ranges can be re-read or read in parallel. The caller is expected
+ * to have verified ownership of the process via get_process_details().
  *
+ * \param id Output token of the background process, see ProcessData::_output
+ * \param offset Byte offset to start reading from
+ * \param length Maximum number of bytes to read
+ * \param out Data read (output)
+ * \param total Number of bytes produced so far (output)
+ * \param done Whether the process has finished producing output (output)
+ * \return bool Whether the output could be read
  **/
-void
-MultiResponseCommand::kill(string &user, string &tok)
+bool
+MultiResponseCommand::get_range(string &id, unsigned long offset, unsigned long length,
+				string &out, unsigned long &total, bool &done)
 {
-	char buffer[1024];
-	bzero(buffer,1024);
+	total = 0;
+	done = false;
+	if (id.empty()) {
+		return false;
+	}
 
-	if (user.empty() || tok.empty()) {
-		return;
+	//check for completion first so that total is final when done is set
+	struct stat s;
+	string end_file = Rest::CHUNKER_RESP_TOK_DIR + Rest::CHUNKER_RESP_TOK_BASE + id + "_end";
+	done = (lstat(end_file.c_str(), &s) == 0);
+
+	string file_chunk = Rest::CHUNKER_RESP_TOK_DIR + Rest::CHUNKER_RESP_TOK_BASE + id;
+	if (lstat(file_chunk.c_str(), &s) != 0 || !S_ISREG(s.st_mode)) {
+		//nothing produced yet
+		return done || errno == ENOENT;
+	}
+	total = s.st_size;
+	if (offset >= total) {
+		return true;
 	}
+	if (length > total - offset) {
+		length = total - offset;
+	}
+	return read_range(file_chunk,offset,length,out);
+}
 
-	sprintf(buffer,Rest::CHUNKER_DELETE_FORMAT.c_str(),tok.c_str(),user.c_str());
+/**
+ * \brief Read a range of lines of output from a background process
+ *
+ * Uses the line index kept by the chunker alongside the output, an
+ * array of the byte offsets at which lines start, so only the
+ * requested lines are read. At most 65536 lines, and no more than
+ * MAX_BODY_SIZE bytes, are returned per call.
+ *
+ * \param id Output token of the background process, see ProcessData::_output
+ * \param first First line, or the number of lines to read when from_end is set
+ * \param end Line after the last one to read, ignored when from_end is set
+ * \param from_end Read the last first lines
+ * \param out Lines read (output)
+ * \param next Line after the last one read (output)
+ * \param lines Number of complete lines produced so far (output)
+ * \param done Whether the process has finished producing output (output)
+ * \return bool Whether the output could be read
+ **/
+bool
+MultiResponseCommand::get_lines(string &id, unsigned long first, unsigned long end, bool from_end,
+				string &out, unsigned long &next, unsigned long &lines, bool &done)
+{
+	static const unsigned long max_lines = 65536;
+	next = lines = 0;
+	done = false;
+	if (id.empty()) {
+		return false;
+	}
+
+	struct stat s;
+	string file = Rest::CHUNKER_RESP_TOK_DIR + Rest::CHUNKER_RESP_TOK_BASE + id;
+	done = (lstat((file + "_end").c_str(), &s) == 0);
+
+	int fd = open((file + "_idx").c_str(), O_RDONLY);
+	if (fd < 0) {
+		//nothing produced yet
+		return done || errno == ENOENT;
+	}
+
+	//the index is read before the output's size, as it is written after the output
+	bool ret = false;
+	unsigned long starts = 0;
+	uint64_t last = 0;
+	if (fstat(fd, &s) == 0) {
+		starts = s.st_size / sizeof(uint64_t);
+		ret = (starts == 0 || pread(fd, &last, sizeof(last), (starts - 1) * sizeof(last)) == sizeof(last));
+	}
+	if (ret == false || starts == 0 || lstat(file.c_str(), &s) != 0) {
+		close(fd);
+		return ret;
+	}
+	uint64_t size = s.st_size;
+	//while the process runs its last line may be partial, only lines
+	//followed by the start of another count; a final newline starts a
+	//line that is still empty
+	lines = (done == false || last == size) ? starts - 1 : starts;
+
+	if (from_end) {
+		first = (lines > first) ? lines - first : 0;
+		end = lines;
+	} else if (end > lines) {
+		end = lines;
+	}
+	if (end > first + max_lines) {
+		end = first + max_lines;
+	}
+	next = first;
+	if (first >= end) {
+		close(fd);
+		return true;
+	}
 
-	ssize_t num = write(_sock,buffer,sizeof(buffer));
-	if (num < 0) {
-		//    char buf[80];
-		//    sprintf(buf,"%d, and %d",num,errno);
+	//offsets of lines first through end, end may be past the index
+	vector<uint64_t> offsets(min<unsigned long>(end + 1, starts) - first);
+	ssize_t want = offsets.size() * sizeof(uint64_t);
+	ret = (pread(fd, &offsets[0], want, first * sizeof(uint64_t)) == want);
+	close(fd);
+	if (ret == false) {
+		return false;
+	}
+	offsets.resize(end - first + 1, done ? size : last);
+	while (end > first + 1 && offsets[end - first] - offsets[0] > Rest::MAX_BODY_SIZE) {
+		--end;
+	}
+
+	next = end;
+	return read_range(file, offsets[0], offsets[end - first] - offsets[0], out);
+}
+
+/**
+ * \brief Binary safe read of length bytes at offset from file
+ **/
+bool
+MultiResponseCommand::read_range(const string &file, unsigned long offset, unsigned long length, string &out)
+{
+	int fd = open(file.c_str(), O_RDONLY);
+	if (fd < 0) {
+		return false;
+	}
+
+	out.resize(length);
+	size_t got = 0;
+	while (got < length) {
+		ssize_t n = pread(fd, &out[got], length - got, offset + got);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			break;
+		}
+		got += n;
+	}
+	out.resize(got);
+	close(fd);
+	return true;
+}
+
+/**
+ *
+ *
+ **/
+void
+MultiResponseCommand::kill(string &user, string &tok)
+{
+	if (user.empty() || tok.empty()) {
 		return;
 	}
+
+	ChunkerEncoder msg(ChunkerProto::K_DELETE);
+	msg.add(ChunkerProto::K_TOKEN,tok);
+	msg.add(ChunkerProto::K_USER,user);
+	msg.send(_sock);
 	return;
 }
 
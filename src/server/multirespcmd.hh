@@ -15,6 +15,9 @@
 #include <string>
 #include <vector>
 #include <set>
+#include "chunker2_filter.hh"
+
+class ChunkerField;
 
 /**
  *
@@ -23,11 +26,17 @@
 class ProcessData
 {
 public:
+	ProcessData() : _start_time(0), _last_update(0), _position(0) {}
+
 	std::string _username;
 	unsigned long _start_time;
 	unsigned long _last_update;
 	std::string _id;
+	std::string _output; ///< token of the shared output, may differ from _id
 	std::string _command;
+	std::string _state; ///< queued, running or finished
+	std::string _format; ///< text or ndjson
+	unsigned long _position; ///< place in the chunker's queue when queued
 };
 
 /**
@@ -47,24 +56,39 @@ public:
 	init();
 
 	std::string
-	start(std::string &user, std::string &cmd);
+	start(std::string &user, std::string &cmd, const std::string &priority = "normal",
+	      const OutputFilter &filter = OutputFilter(), const std::string &format = "text");
 
 	ProcessData
 	get_process_details(std::string &user, std::string &id);
 
 	std::vector<ProcessData>
-	get_processes(std::string &user);
+	get_processes(std::string &user, unsigned long limit, const std::string &cursor, std::string &next);
 
 	std::string
 	get_chunk(std::string &user, std::string &id);
 
+	bool
+	get_range(std::string &id, unsigned long offset, unsigned long length,
+		  std::string &out, unsigned long &total, bool &done);
+
+	bool
+	get_lines(std::string &id, unsigned long first, unsigned long end, bool from_end,
+		  std::string &out, unsigned long &next, unsigned long &lines, bool &done);
+
 	void
 	kill(std::string &user, std::string &id);
 
 private:
+	static void
+	decode_process(const ChunkerField &record, ProcessData &pd);
+
 	std::string
 	get_next_resp_file(std::string &tok);
 
+	static bool
+	read_range(const std::string &file, unsigned long offset, unsigned long length, std::string &out);
+
 	std::string
 	generate_token();
 
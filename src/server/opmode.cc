@@ -21,6 +21,7 @@
 #include <unistd.h>
 #include <curl/curl.h>
 #include <vector>
+#include <limits.h>
 #include <string>
 #include <dirent.h>
 #include "http.hh"
@@ -28,6 +29,8 @@
 #include "rl_str_proc.hh"
 #include "common.hh"
 #include "configuration.hh"
+#include "connpool.hh"
+#include "optmplcache.hh"
 #include "mode.hh"
 #include "opmode.hh"
 #include "debug.h"
@@ -46,6 +49,19 @@ OpMode::~OpMode()
 	curl_easy_cleanup(_curl_handle);
 }
 
+string OpMode::conv_url(string tmp)
+{
+	int len;
+	char *decode = curl_easy_unescape(_curl_handle, tmp.c_str(),
+			tmp.length(), &len);
+	if (decode == NULL) {
+		return string("");
+	}
+	tmp = string(decode, len);
+	curl_free(decode);
+	return tmp;
+}
+
 
 /**
  * \brief Process a operational mode request
@@ -62,7 +78,8 @@ OpMode::process(Session &session)
 	dsyslog(_debug, "OPMODE COMMAND");
 
 	//request body contains key, value pairs that need to be passed down as json
-	string path = session._request.get(Rest::HTTP_REQ_URI);
+	string path = Rest::strip_query(session._request.get(Rest::HTTP_REQ_URI));
+	string query = session._request.get(Rest::HTTP_REQ_QUERY_STRING);
 	if (path.empty()) {
 		session.vyatta_debug("op:1");
 		ERROR(session,Error::VALIDATION_FAILURE);
@@ -104,8 +121,40 @@ OpMode::process(Session &session)
 			return;
 		}
 
+		//only admins may jump the queue
+		string priority = "normal";
+		Rest::get_query_param(query,"priority",priority);
+		if (priority != "low" && (priority != "high" || session._access_level != Session::k_VYATTACFG)) {
+			priority = "normal";
+		}
+
+		//optional stages applied to the output by the chunker
+		string match, regex, head, tail, bytes;
+		if (Rest::get_query_param(query,"match",match)) {
+			match = conv_url(match);
+		}
+		if (Rest::get_query_param(query,"regex",regex)) {
+			regex = conv_url(regex);
+		}
+		Rest::get_query_param(query,"head",head);
+		Rest::get_query_param(query,"tail",tail);
+		Rest::get_query_param(query,"bytes",bytes);
+		OutputFilter filter;
+		if (filter.set(match,regex,head,tail,bytes) == false) {
+			ERROR(session,Error::VALIDATION_FAILURE);
+			return;
+		}
+
+		//output as plain text, or as NDJSON records
+		string format = "text";
+		Rest::get_query_param(query,"format",format);
+		if (format != "text" && format != "ndjson") {
+			ERROR(session,Error::VALIDATION_FAILURE);
+			return;
+		}
+
 		dsyslog(_debug, "Command: %s", cmd.c_str());
-		string id = op_cmd.start(session._user,cmd);
+		string id = op_cmd.start(session._user,cmd,priority,filter,format);
 		if (id.empty()) {
 			ERROR(session,Error::SERVER_ERROR);
 			return;
@@ -125,7 +174,19 @@ OpMode::process(Session &session)
 		//
 		//////////////////////////////////////////////////////////////////////////////////
 		if (path == Rest::OP_REQ_ROOT) {
-			//gets list of background processes
+			//gets list of background processes, a page at a time when limit is given
+			unsigned long limit = 0;
+			string cursor, next, tmp;
+			if (Rest::get_query_param(query,"limit",tmp)) {
+				char *end = NULL;
+				limit = strtoul(tmp.c_str(),&end,10);
+				if (tmp.empty() || *end != '\0' || limit == 0) {
+					ERROR(session,Error::VALIDATION_FAILURE);
+					return;
+				}
+			}
+			Rest::get_query_param(query,"cursor",cursor);
+
 			MultiResponseCommand op_cmd(_debug);
 			if (op_cmd.init() == false) {
 				session.vyatta_debug("op:chunker init failed");
@@ -133,7 +194,7 @@ OpMode::process(Session &session)
 				return;
 			}
 
-			std::vector<ProcessData> coll = op_cmd.get_processes(session._user);
+			std::vector<ProcessData> coll = op_cmd.get_processes(session._user,limit,cursor,next);
 			//now serialize this into the body
 
 			JSON json;
@@ -148,12 +209,21 @@ OpMode::process(Session &session)
 					sprintf(buf,"%ld",iter->_last_update);
 					ttmp += "\"updated\":\"" + string(buf) + "\",";
 					ttmp += "\"id\":\"" + iter->_id + "\",";
+					if (iter->_state.empty() == false) {
+						ttmp += "\"state\":\"" + iter->_state + "\",";
+					}
+					if (iter->_state == "queued") {
+						ttmp += "\"position\":\"" + Rest::ulltostring(iter->_position) + "\",";
+					}
 					ttmp += "\"command\":\"" + iter->_command + "\"}";
 
 					json.add_array("process",ttmp,true);
 					++iter;
 				}
 			}
+			if (next.empty() == false) {
+				json.add_value("next",next);
+			}
 			string resp;
 			json.serialize(resp);
 			session._response.set(Rest::HTTP_BODY,resp);
@@ -183,33 +253,18 @@ OpMode::process(Session &session)
 				return;
 			}
 
-			//implement json processor here
-			//but, for now will piece it together by hand.
-
-
+			unsigned long depth;
+			if (get_depth(query,depth) == false) {
+				ERROR(session,Error::VALIDATION_FAILURE);
+				return;
+			}
 
 			JSON json;
-			json.add_value("help",params._help);
-
-			if (params._action == true) {
+			unsigned long count = 0;
+			node_json(conf, op_path, params, depth, is_admin, count, json);
+			if (count > MAX_SUBTREE_NODES) {
 				string t("true");
-				json.add_value("action",t);
-			} else {
-				string f("false");
-				json.add_value("action",f);
-			}
-
-			std::vector<NodeParams>::iterator i = params._children_coll.begin();
-			while (i != params._children_coll.end()) {
-				json.add_array("children",i->_name);
-				++i;
-			}
-
-			set<string>::iterator j = params._enum.begin();
-			while (j != params._enum.end()) {
-				string tmp = *j;
-				json.add_array("enum",tmp);
-				++j;
+				json.add_value("truncated",t);
 			}
 
 			string r;
@@ -237,6 +292,7 @@ OpMode::process(Session &session)
 
 				session.vyatta_debug(": " + id);
 
+				ProcessData pd;
 				{
 					MultiResponseCommand op_cmd(_debug);
 					if (op_cmd.init() == false) {
@@ -244,7 +300,7 @@ OpMode::process(Session &session)
 						session.vyatta_debug("op:chunker init failed");
 						return;
 					}
-					ProcessData pd = op_cmd.get_process_details(session._user,id);
+					pd = op_cmd.get_process_details(session._user,id);
 					if (pd._id == "") {
 						//not found, therefore mark as an ended process
 						ERROR(session,Error::OPMODE_PROCESS_FINISHED);
@@ -252,6 +308,18 @@ OpMode::process(Session &session)
 					}
 				}
 
+				//offset given, client is managing the cursor
+				string offset;
+				if (Rest::get_query_param(query,"offset",offset)) {
+					get_range(session,pd,query);
+					return;
+				}
+				if (Rest::get_query_param(query,"lines",offset) ||
+				    Rest::get_query_param(query,"last",offset)) {
+					get_lines(session,pd,query);
+					return;
+				}
+
 				string out;
 				MultiResponseCommand op_cmd(_debug);
 				{
@@ -274,7 +342,7 @@ OpMode::process(Session &session)
 				} else if (out.empty() == true) {
 					ERROR(session,Error::ACCEPTED);
 				} else {
-					session._response.set(Rest::HTTP_RESP_CONTENT_TYPE,"text/plain");
+					session._response.set(Rest::HTTP_RESP_CONTENT_TYPE,output_type(pd));
 					session._response.set(Rest::HTTP_BODY,out);
 					session._response._verbatim_body = true;
 					ERROR(session,Error::OK);
@@ -318,6 +386,217 @@ OpMode::process(Session &session)
 	}
 }
 
+/**
+ * \brief Return a range of output from a background process
+ *
+ * Handles GET /rest/op/<id>?offset=N&length=M. The client owns the
+ * cursor, the response carries the offset to continue reading from and
+ * the number of bytes produced so far. Reading at the end of a finished
+ * process returns 410, the process is removed on DELETE.
+ *
+ * \param[in] session Current gui session
+ * \param[in] pd Background process, as returned by get_process_details()
+ * \param[in] query Request query string
+ **/
+void
+OpMode::get_range(Session &session, ProcessData &pd, const string &query)
+{
+	string tmp;
+	unsigned long offset = 0;
+	unsigned long length = Rest::CHUNKER_READ_SIZE;
+	if (Rest::get_query_param(query,"offset",tmp)) {
+		char *end = NULL;
+		offset = strtoul(tmp.c_str(),&end,10);
+		if (tmp.empty() || *end != '\0') {
+			ERROR(session,Error::VALIDATION_FAILURE);
+			return;
+		}
+	}
+	if (Rest::get_query_param(query,"length",tmp)) {
+		char *end = NULL;
+		length = strtoul(tmp.c_str(),&end,10);
+		if (tmp.empty() || *end != '\0' || length == 0) {
+			ERROR(session,Error::VALIDATION_FAILURE);
+			return;
+		}
+		if (length > Rest::MAX_BODY_SIZE) {
+			length = Rest::MAX_BODY_SIZE;
+		}
+	}
+
+	MultiResponseCommand op_cmd(_debug);
+	string out;
+	unsigned long total;
+	bool done;
+	if (op_cmd.get_range(pd._output,offset,length,out,total,done) == false) {
+		ERROR(session,Error::SERVER_ERROR);
+		return;
+	}
+
+	session._response.set(Rest::HTTP_RESP_NEXT_OFFSET,Rest::ulltostring(offset + out.length()));
+	session._response.set(Rest::HTTP_RESP_TOTAL_SIZE,Rest::ulltostring(total));
+	if (out.empty() == false) {
+		session._response.set(Rest::HTTP_RESP_CONTENT_TYPE,output_type(pd));
+		session._response.set(Rest::HTTP_BODY,out);
+		session._response._verbatim_body = true;
+		ERROR(session,Error::OK);
+	} else if (done == true) {
+		ERROR(session,Error::OPMODE_PROCESS_FINISHED);
+	} else {
+		ERROR(session,Error::ACCEPTED);
+	}
+}
+
+/**
+ * \brief Return a range of lines of output from a background process
+ *
+ * Handles GET /rest/op/<id>?lines=A-B for lines [A,B) counting from
+ * zero, B may be omitted to read to the end, and GET /rest/op/<id>?last=N
+ * for the last N lines. The response carries the line to continue
+ * reading from and the number of lines produced so far.
+ *
+ * \param[in] session Current gui session
+ * \param[in] pd Background process, as returned by get_process_details()
+ * \param[in] query Request query string
+ **/
+void
+OpMode::get_lines(Session &session, ProcessData &pd, const string &query)
+{
+	string tmp;
+	unsigned long first = 0;
+	unsigned long end = ULONG_MAX;
+	bool from_end = false;
+	char *stop = NULL;
+	if (Rest::get_query_param(query,"last",tmp)) {
+		from_end = true;
+		first = strtoul(tmp.c_str(),&stop,10);
+		if (tmp.empty() || *stop != '\0') {
+			ERROR(session,Error::VALIDATION_FAILURE);
+			return;
+		}
+	} else if (Rest::get_query_param(query,"lines",tmp)) {
+		size_t pos = tmp.find('-');
+		string a = tmp.substr(0,pos);
+		string b = (pos == string::npos) ? string("") : tmp.substr(pos+1);
+		first = strtoul(a.c_str(),&stop,10);
+		if (a.empty() || *stop != '\0' || pos == string::npos) {
+			ERROR(session,Error::VALIDATION_FAILURE);
+			return;
+		}
+		if (b.empty() == false) {
+			end = strtoul(b.c_str(),&stop,10);
+			if (*stop != '\0' || end < first) {
+				ERROR(session,Error::VALIDATION_FAILURE);
+				return;
+			}
+		}
+	}
+
+	MultiResponseCommand op_cmd(_debug);
+	string out;
+	unsigned long next, lines;
+	bool done;
+	if (op_cmd.get_lines(pd._output,first,end,from_end,out,next,lines,done) == false) {
+		ERROR(session,Error::SERVER_ERROR);
+		return;
+	}
+
+	session._response.set(Rest::HTTP_RESP_NEXT_LINE,Rest::ulltostring(next));
+	session._response.set(Rest::HTTP_RESP_TOTAL_LINES,Rest::ulltostring(lines));
+	if (out.empty() == false) {
+		session._response.set(Rest::HTTP_RESP_CONTENT_TYPE,output_type(pd));
+		session._response.set(Rest::HTTP_BODY,out);
+		session._response._verbatim_body = true;
+		ERROR(session,Error::OK);
+	} else if (done == true) {
+		ERROR(session,Error::OPMODE_PROCESS_FINISHED);
+	} else {
+		ERROR(session,Error::ACCEPTED);
+	}
+}
+
+/**
+ * \brief Content type of the output of a background process
+ *
+ * NDJSON output holds one record per line, so line range reads
+ * return whole records.
+ **/
+string
+OpMode::output_type(const ProcessData &pd)
+{
+	if (pd._format == "ndjson") {
+		return string("application/x-ndjson");
+	}
+	return string("text/plain");
+}
+
+/**
+ * \brief Add an op node, and depth levels of its descendants, to json
+ *
+ * Descendants are objects in a "nodes" array. Tag values are not known
+ * in advance, so "*" children are not descended into.
+ *
+ * \param conf[in] Configuration to read templates through
+ * \param path[in] Op path of the node
+ * \param params[in] Node to add
+ * \param depth[in] Levels of descendants to add
+ * \param is_admin[in] Passed through to get_operational_node
+ * \param count[in,out] Descendants added so far, stops past MAX_SUBTREE_NODES
+ * \param json[out] Node object
+ **/
+void
+OpMode::node_json(Configuration &conf, const string &path, TemplateParams &params,
+		  unsigned long depth, bool is_admin, unsigned long &count, JSON &json)
+{
+	json.add_value("help",params._help);
+
+	if (params._action == true) {
+		string t("true");
+		json.add_value("action",t);
+	} else {
+		string f("false");
+		json.add_value("action",f);
+	}
+
+	std::vector<NodeParams>::iterator i = params._children_coll.begin();
+	while (i != params._children_coll.end()) {
+		string name = i->_name;
+		json.add_array("children",name);
+		++i;
+	}
+
+	set<string>::iterator j = params._enum.begin();
+	while (j != params._enum.end()) {
+		string tmp = *j;
+		json.add_array("enum",tmp);
+		++j;
+	}
+
+	if (depth == 0) {
+		return;
+	}
+	for (i = params._children_coll.begin(); i != params._children_coll.end(); ++i) {
+		string name = i->_name;
+		if (name == "*") {
+			continue;
+		}
+		if (++count > MAX_SUBTREE_NODES) {
+			return;
+		}
+		string child_path = path + "/" + name;
+		TemplateParams child;
+		if (conf.get_operational_node(child_path, child, is_admin) == false) {
+			continue;
+		}
+		JSON child_json;
+		child_json.add_value("name",name);
+		node_json(conf, child_path, child, depth - 1, is_admin, count, child_json);
+		string rep;
+		child_json.serialize(rep);
+		json.add_array("nodes",rep,true);
+	}
+}
+
 /**
  * \brief Verify if this a op mode command
  *
@@ -331,7 +610,6 @@ OpMode::process(Session &session)
 bool
 OpMode::validate_op_cmd(const std::string &cmd, string &path)
 {
-	struct opd_connection opd_conn;
 	bool result(false);
 	struct ::vector *v;
 	size_t pfx_len(sizeof("/rest/op/") - 1);
@@ -344,20 +622,32 @@ OpMode::validate_op_cmd(const std::string &cmd, string &path)
 		return false;
 	}
 
-	if (opd_open(&opd_conn) == -1) {
+	OpdLease opd_conn;
+	if (opd_conn.get() == NULL) {
 		syslog(LOG_ERR, "Unable to connect to opd");
 		return false;
 	}
 
 	// remove /rest/op/ pfx
 	string tmp = cmd.substr(pfx_len);
-	v = opd_expand(&opd_conn, tmp.c_str(), NULL);
+	bool failed = false;
+	if (OpTemplateCache::instance().expand(opd_conn.get(), tmp, failed)) {
+		path = tmp;
+		dsyslog(_debug, "OpMode::%s path = %s (cached)", __func__, path.c_str());
+		return true;
+	}
+	if (failed) {
+		opd_conn.failed();
+	}
+	//not a template path, opd may still expand it
+	v = opd_expand(opd_conn.get(), tmp.c_str(), NULL);
 	if (v) {
 		path = tmp;
 		result = true;
 		vector_free(v);
+	} else {
+		opd_conn.failed();
 	}
-	opd_close(&opd_conn);
 	dsyslog(_debug, "OpMode::%s path = %s", __func__, path.c_str());
 	return result;
 }
@@ -17,8 +17,11 @@
 #include <set>
 #include "http.hh"
 #include "mode.hh"
+#include "multirespcmd.hh"
 
 typedef void CURL;
+class Configuration;
+class TemplateParams;
 
 
 class OpMode : protected Mode
@@ -31,11 +34,29 @@ public:
 	process(Session &session);
 
 private:
+	std::string
+	conv_url(std::string tmp);
+
+	void
+	get_range(Session &session, ProcessData &pd, const std::string &query);
+
+	void
+	get_lines(Session &session, ProcessData &pd, const std::string &query);
+
+	std::string
+	output_type(const ProcessData &pd);
+
 	bool
 	validate_op_cmd(const std::string &cmd, std::string &path);
 
+	void
+	node_json(Configuration &conf, const std::string &path, TemplateParams &params,
+		  unsigned long depth, bool is_admin, unsigned long &count, JSON &json);
+
 private: //variables
 	CURL *_curl_handle;
+
+	const static unsigned long MAX_SUBTREE_NODES = 10000;
 };
 
 
@@ -0,0 +1,205 @@
+/**
+ * Module: optmplcache.cc
+ * Description: in memory copy of the op mode template tree
+ *
+ * Copyright (c) 2019, AT&T Intellectual Property.  All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ **/
+
+#include <sys/types.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <syslog.h>
+#include <string>
+#include <vector>
+#include <set>
+#include <map>
+
+#include <vyatta-util/map.h>
+#include <vyatta-util/vector.h>
+#include <opd_client.h>
+
+#include "common.hh"
+#include "optmplcache.hh"
+
+using namespace std;
+
+/**
+ *
+ **/
+OpTemplateCache &
+OpTemplateCache::instance()
+{
+	static OpTemplateCache cache;
+	return cache;
+}
+
+/**
+ *
+ **/
+bool
+OpTemplateCache::expand(struct opd_connection *conn, const string &path, bool &failed)
+{
+	if (refresh() == false) {
+		return false;
+	}
+	return (resolve(conn, path, failed) != NULL);
+}
+
+/**
+ *
+ **/
+bool
+OpTemplateCache::get(struct opd_connection *conn, const string &path,
+		     std::vector<string> &tmpl, std::vector<string> &children, bool &failed)
+{
+	if (refresh() == false) {
+		return false;
+	}
+	Node *node = resolve(conn, path, failed);
+	if (node == NULL) {
+		return false;
+	}
+	tmpl = node->_tmpl;
+	children = node->_children;
+	return true;
+}
+
+/**
+ *
+ **/
+void
+OpTemplateCache::clear()
+{
+	if (_notify_fd != -1) {
+		close(_notify_fd);
+		_notify_fd = -1;
+	}
+	_node_coll.clear();
+}
+
+/**
+ * \brief Drop the tree if a watched template directory changed
+ *
+ * \return bool false if changes cannot be watched, nothing is cached then
+ **/
+bool
+OpTemplateCache::refresh()
+{
+	if (_notify_fd != -1) {
+		char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+		bool changed = false;
+		while (read(_notify_fd, buf, sizeof(buf)) > 0) {
+			changed = true;
+		}
+		if (changed == false) {
+			return true;
+		}
+		syslog(LOG_DEBUG, "webgui: op templates changed, dropping cache");
+		clear();
+	}
+
+	_notify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (_notify_fd == -1) {
+		syslog(LOG_ERR, "webgui: inotify_init1: %s", strerror(errno));
+		return false;
+	}
+	return true;
+}
+
+/**
+ * \brief Walk path from the root, reading nodes not yet cached
+ *
+ * A path component matches a child of the same name, otherwise the
+ * node.tag child if there is one.
+ *
+ * \return Node* NULL if path is not a known template node
+ **/
+OpTemplateCache::Node *
+OpTemplateCache::resolve(struct opd_connection *conn, const string &path, bool &failed)
+{
+	string key, real;
+	Node *node = load(conn, key, real, failed);
+
+	size_t start = 0;
+	while (node != NULL && start <= path.length()) {
+		size_t end = path.find('/', start);
+		if (end == string::npos) {
+			end = path.length();
+		}
+		string comp = path.substr(start, end - start);
+		start = end + 1;
+		if (comp.empty()) {
+			continue;
+		}
+
+		if (comp != "node.tag" && node->_child_set.find(comp) != node->_child_set.end()) {
+			key += "/" + comp;
+		} else if (node->_child_set.find("node.tag") != node->_child_set.end()) {
+			key += "/node.tag";
+		} else {
+			return NULL;
+		}
+		real += (real.empty() ? "" : "/") + comp;
+		node = load(conn, key, real, failed);
+	}
+	return node;
+}
+
+/**
+ * \brief Cached node for a template path, read from opd on first use
+ *
+ * \param key[in] Template path, "" for the root
+ * \param real[in] Op path as opd expects it, with tag values
+ * \param failed[out] Set if an opd call failed
+ **/
+OpTemplateCache::Node *
+OpTemplateCache::load(struct opd_connection *conn, const string &key, const string &real, bool &failed)
+{
+	NodeIter iter = _node_coll.find(key);
+	if (iter != _node_coll.end()) {
+		return &iter->second;
+	}
+	if (conn == NULL) {
+		return NULL;
+	}
+
+	//only cache what can be watched
+	string dir = Rest::OP_COMMAND_DIR + key;
+	if (inotify_add_watch(_notify_fd, dir.c_str(),
+			      IN_CREATE | IN_DELETE | IN_MODIFY | IN_CLOSE_WRITE |
+			      IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF) == -1) {
+		return NULL;
+	}
+
+	//a node opd failed on is not kept, the next request asks again
+	struct ::vector *v = opd_children(conn, real.c_str(), NULL);
+	if (v == NULL) {
+		failed = true;
+		return NULL;
+	}
+	struct ::map *m = opd_tmpl(conn, real.c_str(), NULL);
+	if (m == NULL) {
+		vector_free(v);
+		failed = true;
+		return NULL;
+	}
+
+	Node &node = _node_coll[key];
+	const char *child = NULL;
+	while ((child = vector_next(v, child))) {
+		node._children.push_back(child);
+		node._child_set.insert(child);
+	}
+	vector_free(v);
+
+	const char *next = NULL;
+	while ((next = map_next(m, next))) {
+		node._tmpl.push_back(next);
+	}
+	map_free(m);
+	return &node;
+}
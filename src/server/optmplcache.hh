@@ -0,0 +1,79 @@
+/**
+ * Module: optmplcache.hh
+ * Description: in memory copy of the op mode template tree
+ *
+ * Copyright (c) 2019, AT&T Intellectual Property.  All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ **/
+
+#ifndef __OPTMPLCACHE_HH__
+#define __OPTMPLCACHE_HH__
+
+#include <string>
+#include <vector>
+#include <set>
+#include <map>
+
+#include <opd_client.h>
+
+/**
+ * Op mode templates only change when packages are installed, so what
+ * opd returns for a template node is kept for the life of the process.
+ * Nodes are read from opd the first time a path through them is
+ * resolved, and each node's template directory is watched with inotify.
+ * Any change below a cached directory drops the whole tree.
+ *
+ * Nodes are keyed by template path, tag values map to "node.tag".
+ * Dynamic "allowed" values are not cached.
+ **/
+class OpTemplateCache
+{
+public:
+	static OpTemplateCache &
+	instance();
+
+	//whether path names an op mode template node; failed is set if an
+	//opd call on conn failed, for the caller to check the connection
+	bool
+	expand(struct opd_connection *conn, const std::string &path, bool &failed);
+
+	//template entries ("key=value") and child names of the node at path
+	bool
+	get(struct opd_connection *conn, const std::string &path,
+	    std::vector<std::string> &tmpl, std::vector<std::string> &children, bool &failed);
+
+	void
+	clear();
+
+private:
+	class Node
+	{
+	public:
+		std::vector<std::string> _tmpl;
+		std::vector<std::string> _children;
+		std::set<std::string> _child_set;
+	};
+
+	typedef std::map<std::string,Node> NodeColl;
+	typedef std::map<std::string,Node>::iterator NodeIter;
+
+	OpTemplateCache() : _notify_fd(-1) {}
+	OpTemplateCache(const OpTemplateCache &);
+	OpTemplateCache &operator=(const OpTemplateCache &);
+
+	Node *
+	resolve(struct opd_connection *conn, const std::string &path, bool &failed);
+
+	Node *
+	load(struct opd_connection *conn, const std::string &key, const std::string &real, bool &failed);
+
+	bool
+	refresh();
+
+private:
+	int _notify_fd; //-1 while nothing is cached
+	NodeColl _node_coll;
+};
+
+#endif //__OPTMPLCACHE_HH__
@@ -22,6 +22,7 @@
 #include "http.hh"
 #include "common.hh"
 #include "configuration.hh"
+#include "connpool.hh"
 #include "mode.hh"
 #include "permissions.hh"
 #include "debug.h"
@@ -72,24 +73,21 @@ Permissions::process(Session &session)
 	string method = session._request.get(Rest::HTTP_REQ_METHOD);
 	if (method == "GET") {
 		string resp;
-		struct configd_conn _conn;
-		struct opd_connection _opd_conn;
 		json_t *out = json_object();
 		struct ::map *perm = NULL;
 
-		if (configd_open_connection(&_conn) == -1) {
-			syslog(LOG_ERR, "webgui: Unable to connect to configuration daemon");
-		} else {
-			perm = configd_auth_getperms(&_conn, NULL);
-			configd_close_connection(&_conn);
+		//the pool logs a failure to connect
+		struct configd_conn *conn = ConnPool::instance().acquire_configd("");
+		if (conn != NULL) {
+			perm = configd_auth_getperms(conn, NULL);
+			ConnPool::instance().release(conn, perm == NULL && ConnPool::failed(conn->fd));
 
 			json_object_set_new(out, "conf", maptojson(perm));
 		}
-		if (opd_open(&_opd_conn) == -1) {
-			syslog(LOG_ERR, "webgui: Unable to connect to operational daemon");
-		} else {
-			perm = opd_getperms(&_opd_conn, NULL);
-			opd_close(&_opd_conn);
+		struct opd_connection *opd_conn = ConnPool::instance().acquire_opd();
+		if (opd_conn != NULL) {
+			perm = opd_getperms(opd_conn, NULL);
+			ConnPool::instance().release(opd_conn, perm == NULL && ConnPool::failed(opd_conn->fd));
 
 			json_object_set_new(out, "op", maptojson(perm));
 		}
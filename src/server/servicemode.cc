@@ -10,9 +10,12 @@
 #include <string.h>
 #include <stdio.h>
 #include <unistd.h>
+#include <string>
+#include <vector>
 #include "http.hh"
 #include "configuration.hh"
 #include "rl_str_proc.hh"
+#include "executor.hh"
 #include "servicemode.hh"
 
 using namespace std;
@@ -56,37 +59,35 @@ ServiceMode::execute_service(Session &session, std::string &path)
     return;
   }
 
-  string environment = "export REQUEST_METHOD=" + session._request.get(Rest::HTTP_REQ_METHOD) + ";";
+  //the request body is the script's stdin
+  Executor exec(_debug);
+  exec.set_env("REQUEST_METHOD", session._request.get(Rest::HTTP_REQ_METHOD));
   if (session._session_key.empty() == false) {
-    environment += "export SESSION=" + session._session_key + ";";
+    exec.set_env("SESSION", session._session_key);
   }
   if (session._user.empty() == false) {
-    environment += "export VYATTA_SESSION_USERNAME=" + session._user + ";";
+    exec.set_env("VYATTA_SESSION_USERNAME", session._user);
   }
-  environment += "export VYATTA_ACCESS_LEVEL=service-user;";
-
+  exec.set_env("VYATTA_ACCESS_LEVEL", "service-user");
   string json = session._request.get(Rest::HTTP_BODY);
-  FILE *fd = fopen(Rest::JSON_INPUT.c_str(), "w");
-  if (!fd) {
-    ERROR(session,Error::SERVER_ERROR);
-    return;
-  }
-
-  if (fwrite(json.c_str(), sizeof(char), json.size(), fd) < json.size()) {
-    fclose(fd);
+  exec.set_input(json);
+  if (Mode::write_json_input(json) == false) {
     ERROR(session,Error::SERVER_ERROR);
     return;
   }
-  fclose(fd);
 
-  string servicecmd = "/bin/bash -p -c '" + environment + "umask 000; "
+  string servicecmd = "umask 000; "
                    "source /usr/lib/cgi-bin/vyatta-service;_vyatta_service_run "
-                   + command  + " < "+ Rest::JSON_INPUT +"'";
+                   + command;
+  std::vector<string> argv;
+  argv.push_back("/bin/bash");
+  argv.push_back("-p");
+  argv.push_back("-c");
+  argv.push_back(servicecmd);
 
   string cmdout;
 
-  int err = 0;
-  if ((err = Mode::system_out(servicecmd.c_str(), cmdout)) != 0) {
+  if (exec.run(argv, cmdout) != 0) {
     ERROR(session,Error::SERVICEMODE_SCRIPT_ERROR);
   }
 
@@ -28,9 +28,6 @@ private:
 
 	void
 	execute_service(Session &session, std::string &path);
-
-	int
-	system_out(const char *cmd, std::string &out);
 };
 
 #endif //__SERVICEMODE_HH__